@@ -0,0 +1,406 @@
+// Microbenchmarks for the client's per-frame work, for comparing one commit against another.
+//
+//   GameBench [--filter S] [--repetitions N] [--min-time MS] [--warmup MS] [--json FILE]
+//
+// Covers MyGame::on_receive for each state command of an eight player game (applying the event
+// included), MyGame::update with moving players, findClosestSite, the territory pass,
+// renderText, and a whole frame drawn by SDL's software renderer so no window is needed.
+//
+// Each case warms up for --warmup milliseconds, which also sizes a repetition to about
+// --min-time milliseconds, then runs --repetitions of them. The table shows ns per operation
+// across repetitions; --json writes the same numbers for scripts to diff between commits.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+
+#include "MyGame.h"
+#include "Protocol.h"
+
+//MyGame's private passes, reached through its friend declaration
+class GameBench {
+public:
+    static int findClosestSite(MyGame& game, int x, int y) {
+        return game.findClosestSite(x, y);
+    }
+
+    static void rebuildTerritory(MyGame& game) {
+        game.rebuildTerritory();
+    }
+
+    static void renderText(MyGame& game, SDL_Renderer* renderer, const char* text, int x, int y, int size) {
+        game.renderText(renderer, text, x, y, size);
+    }
+};
+
+// --- game setup ------------------------------------------------------------
+
+static const int PLAYERS = 8;
+static const int WIDTH = 800, HEIGHT = 600;
+static const float FRAME_SECONDS = 1.0f / 60;
+
+static void receive(MyGame& game, const std::string& message) {
+    std::string cmd;
+    std::vector<std::string> args;
+    if (parse_message(message.c_str(), static_cast<int>(message.length()), cmd, args)) {
+        game.on_receive(cmd, args);
+        game.processEvents();
+    }
+}
+
+static std::string join(const std::string& cmd, const std::vector<std::string>& args) {
+    std::string message = cmd;
+    for (size_t i = 0; i < args.size(); i++) {
+        message += "," + args[i];
+    }
+    return message;
+}
+
+static std::string random_bitset(int sites, std::mt19937& rng) {
+    SiteBitset bits;
+    bits.resize(sites);
+    for (int i = 0; i < sites; i++) {
+        bits.assign(i, rng() % 4 == 0);
+    }
+    return bits.encode();
+}
+
+static std::string site_positions(int sites, std::mt19937& rng) {
+    std::vector<std::string> args;
+    for (int i = 0; i < sites; i++) {
+        args.push_back(std::to_string(20 + rng() % (WIDTH - 40)));
+        args.push_back(std::to_string(20 + rng() % (HEIGHT - 40)));
+    }
+    return join("SITE_POSITIONS", args);
+}
+
+static std::string positions(std::mt19937& rng) {
+    std::vector<std::string> args;
+    for (int i = 0; i < PLAYERS; i++) {
+        args.push_back(std::to_string(20 + rng() % (WIDTH - 40)));
+        args.push_back(std::to_string(20 + rng() % (HEIGHT - 40)));
+    }
+    return join("POSITIONS", args);
+}
+
+//One message per state command, as an eight player server sends them over a map of sites
+static std::vector<std::pair<std::string, std::string> > state_messages(int sites, std::mt19937& rng) {
+    std::vector<std::pair<std::string, std::string> > messages;
+    std::vector<std::string> ownership, scores, resources, buildings, full;
+
+    for (int i = 0; i < PLAYERS; i++) {
+        ownership.push_back(random_bitset(sites, rng));
+        scores.push_back(std::to_string(rng() % 1000));
+        resources.push_back(std::to_string(rng() % 500));
+        resources.push_back(std::to_string(rng() % 50));
+    }
+    for (int i = 0; i < BUILDING_KINDS; i++) {
+        buildings.push_back(random_bitset(sites, rng));
+    }
+
+    full.push_back("P" + std::to_string(PLAYERS));
+    full.insert(full.end(), ownership.begin(), ownership.end());
+    full.insert(full.end(), buildings.begin(), buildings.end());
+    full.push_back("255");
+    full.push_back("0");
+    full.push_back("0");
+    full.insert(full.end(), scores.begin(), scores.end());
+    full.insert(full.end(), resources.begin(), resources.end());
+    for (int i = 0; i < PLAYERS; i++) {
+        full.push_back(std::to_string(20 + rng() % (WIDTH - 40)));
+        full.push_back(std::to_string(20 + rng() % (HEIGHT - 40)));
+    }
+    full.push_back("0");
+    full.push_back("0.0");
+    full.push_back("-1");
+
+    messages.push_back(std::make_pair("LOBBY_INFO", "LOBBY_INFO,2,5,8,8,8,8"));
+    messages.push_back(std::make_pair("SITE_POSITIONS", site_positions(sites, rng)));
+    messages.push_back(std::make_pair("OWNERSHIP", join("OWNERSHIP", ownership)));
+    messages.push_back(std::make_pair("SCORES", join("SCORES", scores)));
+    messages.push_back(std::make_pair("RESOURCES", join("RESOURCES", resources)));
+    messages.push_back(std::make_pair("PLAYER_POS", "PLAYER_POS,3,412,287"));
+    messages.push_back(std::make_pair("BUILDINGS", join("BUILDINGS", buildings)));
+    messages.push_back(std::make_pair("PLAYER_STATES", "PLAYER_STATES,255,0,0"));
+    messages.push_back(std::make_pair("COMBAT_STATE", "COMBAT_STATE,0,0.0,-1"));
+    messages.push_back(std::make_pair("FULL_STATE", join("FULL_STATE", full)));
+    messages.push_back(std::make_pair("POSITIONS", positions(rng)));
+    return messages;
+}
+
+//A running eight player game on a map of sites, with every player walking somewhere
+static void start_game(MyGame& game, int sites, std::mt19937& rng) {
+    game.initialize();
+    receive(game, "JOINED_ROOM,0,1,bench," + std::to_string(PLAYERS));
+    receive(game, "GAME_START," + std::to_string(PLAYERS));
+    receive(game, site_positions(sites, rng));
+
+    std::vector<std::pair<std::string, std::string> > state = state_messages(sites, rng);
+    for (size_t i = 0; i < state.size(); i++) {
+        if (state[i].first != "SITE_POSITIONS") {
+            receive(game, state[i].second);
+        }
+    }
+}
+
+//Gives every player that has arrived somewhere new to walk to
+static void keep_moving(std::mt19937& rng) {
+    for (int i = 1; i <= game_data.playerCount; i++) {
+        Player& player = game_data.player(i);
+        if (!player.isMoving) {
+            player.targetPosition = Point(20 + rng() % (WIDTH - 40), 20 + rng() % (HEIGHT - 40));
+            player.isMoving = true;
+        }
+    }
+}
+
+// --- harness ---------------------------------------------------------------
+
+struct BenchCase {
+    std::string name;
+    std::function<void()> setup;
+    std::function<void(long long ops)> run;
+};
+
+struct Result {
+    std::string name;
+    long long opsPerRepetition;
+    std::vector<double> nsPerOp;
+    double min, median, mean, stddev, max;
+};
+
+static double seconds_since(Uint64 start) {
+    return (SDL_GetPerformanceCounter() - start) / static_cast<double>(SDL_GetPerformanceFrequency());
+}
+
+static Result measure(const BenchCase& c, int repetitions, double minTimeMs, double warmupMs) {
+    c.setup();
+
+    //Warm up in growing batches, then size a repetition from the rate it reached
+    long long warmupOps = 0;
+    long long batch = 1;
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (seconds_since(start) * 1000.0 < warmupMs) {
+        c.run(batch);
+        warmupOps += batch;
+        batch *= 2;
+    }
+    double nsPerOp = seconds_since(start) * 1e9 / warmupOps;
+
+    Result result;
+    result.name = c.name;
+    result.opsPerRepetition = std::max(1LL, static_cast<long long>(minTimeMs * 1e6 / nsPerOp));
+
+    for (int r = 0; r < repetitions; r++) {
+        start = SDL_GetPerformanceCounter();
+        c.run(result.opsPerRepetition);
+        result.nsPerOp.push_back(seconds_since(start) * 1e9 / result.opsPerRepetition);
+    }
+
+    std::vector<double> sorted = result.nsPerOp;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += sorted[i];
+    }
+    result.mean = sum / n;
+
+    double squares = 0;
+    for (size_t i = 0; i < n; i++) {
+        squares += (sorted[i] - result.mean) * (sorted[i] - result.mean);
+    }
+    result.stddev = n > 1 ? sqrt(squares / (n - 1)) : 0.0;
+
+    result.min = sorted.front();
+    result.max = sorted.back();
+    result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    return result;
+}
+
+static bool write_json(const std::string& path, const std::vector<Result>& results, int repetitions) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"GameBench\",\n  \"repetitions\": %d,\n  \"results\": [\n", repetitions);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"ops_per_repetition\": %lld, \"ns_per_op\": "
+            "{\"min\": %.2f, \"median\": %.2f, \"mean\": %.2f, \"stddev\": %.2f, \"max\": %.2f}}%s\n",
+            r.name.c_str(), r.opsPerRepetition, r.min, r.median, r.mean, r.stddev, r.max,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string jsonPath;
+    int repetitions = 10;
+    double minTimeMs = 100;
+    double warmupMs = 200;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (arg == "--repetitions" && i + 1 < argc) {
+            repetitions = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--min-time" && i + 1 < argc) {
+            minTimeMs = atof(argv[++i]);
+        }
+        else if (arg == "--warmup" && i + 1 < argc) {
+            warmupMs = atof(argv[++i]);
+        }
+        else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--filter S] [--repetitions N] [--min-time MS] [--warmup MS] [--json FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    log_set_level(LOG_LEVEL_OFF);
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+    if (!renderer) {
+        fprintf(stderr, "ERROR: no software renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    MyGame game;
+    std::mt19937 rng(12345);
+    volatile long long sink = 0;
+    std::vector<BenchCase> cases;
+
+    //Receive path, one case per command. Messages are parsed up front so only on_receive and apply are timed.
+    std::mt19937 messageRng(1);
+    std::vector<std::pair<std::string, std::string> > messages = state_messages(256, messageRng);
+    for (size_t m = 0; m < messages.size(); m++) {
+        std::string wire = messages[m].second;
+        BenchCase c;
+        c.name = "on_receive/" + messages[m].first;
+        c.setup = [&game, &rng]() { start_game(game, 256, rng); };
+        c.run = [&game, wire](long long ops) {
+            std::string cmd;
+            std::vector<std::string> args;
+            parse_message(wire.c_str(), static_cast<int>(wire.length()), cmd, args);
+            for (long long i = 0; i < ops; i++) {
+                game.on_receive(cmd, args);
+                game.processEvents();
+            }
+        };
+        cases.push_back(c);
+    }
+
+    const int PLAYER_COUNTS[] = { 2, 8 };
+    for (size_t p = 0; p < sizeof(PLAYER_COUNTS) / sizeof(PLAYER_COUNTS[0]); p++) {
+        int players = PLAYER_COUNTS[p];
+        BenchCase c;
+        c.name = "update/" + std::to_string(players) + "p";
+        c.setup = [&game, &rng, players]() {
+            start_game(game, 256, rng);
+            game_data.playerCount = players;
+        };
+        c.run = [&game, &rng](long long ops) {
+            for (long long i = 0; i < ops; i++) {
+                keep_moving(rng);
+                game.update(FRAME_SECONDS);
+            }
+        };
+        cases.push_back(c);
+    }
+
+    const int SITE_COUNTS[] = { 64, 1024 };
+    for (size_t s = 0; s < sizeof(SITE_COUNTS) / sizeof(SITE_COUNTS[0]); s++) {
+        int sites = SITE_COUNTS[s];
+
+        BenchCase closest;
+        closest.name = "findClosestSite/" + std::to_string(sites);
+        closest.setup = [&game, &rng, sites]() { start_game(game, sites, rng); };
+        closest.run = [&game, &sink](long long ops) {
+            for (long long i = 0; i < ops; i++) {
+                sink += GameBench::findClosestSite(game, static_cast<int>((i * 7919) % WIDTH), static_cast<int>((i * 104729) % HEIGHT));
+            }
+        };
+        cases.push_back(closest);
+
+        BenchCase territory;
+        territory.name = "territory/" + std::to_string(sites);
+        territory.setup = closest.setup;
+        territory.run = [&game](long long ops) {
+            for (long long i = 0; i < ops; i++) {
+                GameBench::rebuildTerritory(game);
+            }
+        };
+        cases.push_back(territory);
+    }
+
+    BenchCase text;
+    text.name = "renderText";
+    text.setup = [&game, &rng]() { start_game(game, 256, rng); };
+    text.run = [&game, renderer](long long ops) {
+        for (long long i = 0; i < ops; i++) {
+            GameBench::renderText(game, renderer, "P1: 1234 56", 10, 10, 2);
+        }
+    };
+    cases.push_back(text);
+
+    //What loop() does for a frame, with a POSITIONS arriving every frame as it would from the server
+    std::string framePositions = positions(rng);
+    BenchCase frame;
+    frame.name = "frame/headless";
+    frame.setup = [&game, &rng]() { start_game(game, 256, rng); };
+    frame.run = [&game, &rng, renderer, framePositions](long long ops) {
+        for (long long i = 0; i < ops; i++) {
+            receive(game, framePositions);
+            keep_moving(rng);
+            game.update(FRAME_SECONDS);
+            SDL_SetRenderDrawColor(renderer, 20, 20, 30, 255);
+            SDL_RenderClear(renderer);
+            game.render(renderer);
+            SDL_RenderPresent(renderer);
+        }
+    };
+    cases.push_back(frame);
+
+    printf("%-28s %10s %12s %12s %12s %12s %12s\n", "case", "ops/rep", "min ns", "median ns", "mean ns", "stddev ns", "max ns");
+
+    std::vector<Result> results;
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (!filter.empty() && cases[i].name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        Result r = measure(cases[i], repetitions, minTimeMs, warmupMs);
+        printf("%-28s %10lld %12.1f %12.1f %12.1f %12.1f %12.1f\n", r.name.c_str(), r.opsPerRepetition,
+            r.min, r.median, r.mean, r.stddev, r.max);
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+
+    if (!jsonPath.empty() && !write_json(jsonPath, results, repetitions)) {
+        fprintf(stderr, "ERROR: could not write %s\n", jsonPath.c_str());
+        return 1;
+    }
+
+    return 0;
+}
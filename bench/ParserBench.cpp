@@ -0,0 +1,528 @@
+// Throughput and robustness benchmark for the receive path (MessageFramer, parse_message, MyGame::on_receive
+// and applying the event).
+//
+//   ParserBench [--iterations N] [--seed S]     benchmark a generated corpus
+//   ParserBench --fuzz [--iterations N]         mutate the corpus and check the parser survives it
+//
+// Both modes also stream messages for a MAX_SITES map through the framer in recv-sized pieces,
+// and --fuzz fails if any of them arrives cut short.
+//
+// Build with -DBENCH_SANITIZE=ON to catch out of bounds reads during --fuzz.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <streambuf>
+
+#include "AllocTracker.h"
+#include "MyGame.h"
+#include "Protocol.h"
+
+// --- corpus ----------------------------------------------------------------
+
+enum CaseKind {
+    CASE_VALID,
+    CASE_TRUNCATED,
+    CASE_OVERSIZED,
+    CASE_MALFORMED,
+    CASE_KIND_COUNT
+};
+
+static const char* CASE_KIND_NAMES[CASE_KIND_COUNT] = { "valid", "truncated", "oversized", "malformed" };
+
+struct Case {
+    std::string command;
+    CaseKind kind;
+    std::string message;
+};
+
+struct CommandSpec {
+    const char* name;
+    int argCount;
+    int players;    //room size the form is for, two player forms are what older servers send
+};
+
+//Every command MyGame::on_receive understands, with the argument count the server sends.
+//Commands whose layout depends on the room size are listed for two and eight players.
+static const CommandSpec COMMANDS[] = {
+    { "LOBBY_INFO", 3, 2 }, { "JOINED_ROOM", 3, 2 }, { "ROOM_FULL", 1, 2 }, { "GAME_START", 0, 2 },
+    { "SNAPSHOT", 1, 2 }, { "RESUMED", 2, 2 }, { "SITE_POSITIONS", 16, 2 }, { "OWNERSHIP", 2, 2 },
+    { "SCORES", 2, 2 }, { "RESOURCES", 4, 2 }, { "PLAYER_POS", 3, 2 }, { "BUILDINGS", 3, 2 },
+    { "PLAYER_STATES", 1, 2 }, { "COMBAT_STATE", 2, 2 }, { "FULL_STATE", 18, 2 }, { "COMBAT_START", 1, 2 },
+    { "COMBAT_INTERRUPT", 0, 2 }, { "COMBAT_END", 1, 2 }, { "RETREAT", 2, 2 }, { "POSITIONS", 4, 2 },
+
+    { "LOBBY_INFO", 6, 8 }, { "JOINED_ROOM", 4, 8 }, { "GAME_START", 1, 8 }, { "OWNERSHIP", 8, 8 },
+    { "SCORES", 8, 8 }, { "RESOURCES", 16, 8 }, { "PLAYER_POS", 3, 8 }, { "PLAYER_STATES", 3, 8 },
+    { "FULL_STATE", 58, 8 }, { "POSITIONS", 16, 8 }, { "STATE_HASH", 3, 8 }
+};
+
+static const int COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+//Tagged FULL_STATE layout for eight players, see decode_message
+static const int FULL_STATE_8P_POSITIONS = 39;
+static const int FULL_STATE_8P_TIMER = 56;
+
+static std::string valid_arg(const CommandSpec& spec, int index, std::mt19937& rng) {
+    std::string cmd = spec.name;
+    bool wide = spec.players > 2;
+
+    if (cmd == "FULL_STATE" && wide) {
+        if (index == 0) {
+            return "P" + std::to_string(spec.players);
+        }
+        if (index == FULL_STATE_8P_TIMER) {
+            return std::to_string(std::uniform_real_distribution<float>(0.0f, 10.0f)(rng));
+        }
+        if (index >= FULL_STATE_8P_POSITIONS && index < FULL_STATE_8P_POSITIONS + 2 * spec.players) {
+            return std::to_string(20 + rng() % (index % 2 == 0 ? 560 : 760));
+        }
+        if (index == FULL_STATE_8P_TIMER + 1) {
+            return "-1";
+        }
+        return std::to_string(rng() % 256);
+    }
+    if ((cmd == "LOBBY_INFO" && index >= 3) || (cmd == "JOINED_ROOM" && index == 3) || (cmd == "GAME_START")) {
+        return std::to_string(2 + rng() % (MAX_PLAYERS - 1));
+    }
+    if ((cmd == "COMBAT_STATE" && index == 1) || (cmd == "FULL_STATE" && index == 17)) {
+        return std::to_string(std::uniform_real_distribution<float>(0.0f, 10.0f)(rng));
+    }
+    if (cmd == "JOINED_ROOM" && index == 2) {
+        return "token" + std::to_string(rng() % 100000);
+    }
+    if (cmd == "SITE_POSITIONS" || cmd == "POSITIONS" || (cmd == "PLAYER_POS" && index > 0) ||
+        (cmd == "FULL_STATE" && index >= 12 && index <= 15)) {
+        return std::to_string(20 + rng() % (index % 2 == 0 ? 760 : 560));
+    }
+    if (cmd == "LOBBY_INFO") {
+        return std::to_string(rng() % 3);
+    }
+    if (cmd == "PLAYER_POS" || cmd == "RETREAT" || cmd == "COMBAT_END" || (cmd == "RESUMED" && index == 1) ||
+        (cmd == "JOINED_ROOM" && index == 1) || (cmd == "STATE_HASH" && index == 0)) {
+        return std::to_string(1 + rng() % spec.players);
+    }
+    if (cmd == "COMBAT_START") {
+        return std::to_string(rng() % 8);
+    }
+    return std::to_string(rng() % 256);
+}
+
+static std::string build_message(const std::string& cmd, const std::vector<std::string>& args) {
+    std::string message = cmd;
+    for (size_t i = 0; i < args.size(); i++) {
+        message += "," + args[i];
+    }
+    return message;
+}
+
+static Case make_case(const CommandSpec& spec, CaseKind kind, std::mt19937& rng) {
+    std::string cmd = spec.name;
+    std::vector<std::string> args;
+    for (int i = 0; i < spec.argCount; i++) {
+        args.push_back(valid_arg(spec, i, rng));
+    }
+
+    Case c;
+    c.command = spec.players > 2 ? cmd + "x" + std::to_string(spec.players) : cmd;
+    c.kind = kind;
+
+    switch (kind) {
+    case CASE_VALID:
+        c.message = build_message(cmd, args);
+        break;
+
+    case CASE_TRUNCATED: {
+        //A partial frame, cut anywhere after the command name
+        std::string full = build_message(cmd, args);
+        size_t cut = cmd.length() + rng() % (full.length() - cmd.length() + 1);
+        c.message = full.substr(0, cut);
+        break;
+    }
+
+    case CASE_OVERSIZED: {
+        //Too many arguments and numbers that don't fit in an int
+        for (int i = 0; i < 64; i++) {
+            args.push_back(std::to_string(rng()));
+        }
+        if (!args.empty()) {
+            args[rng() % args.size()] = "99999999999999999999";
+        }
+        c.message = build_message(cmd, args);
+        break;
+    }
+
+    case CASE_MALFORMED:
+    default: {
+        static const char* junk[] = { "abc", "-", "1e99", "nan", "inf", "-2147483649", "0x", " ", "-1", "999" };
+        if (!args.empty()) {
+            args[rng() % args.size()] = junk[rng() % (sizeof(junk) / sizeof(junk[0]))];
+        }
+        //Wrong argument count, e.g. FULL_STATE with fewer or more fields than expected
+        if (rng() % 2 == 0 && !args.empty()) {
+            args.resize(rng() % args.size());
+        }
+        else {
+            args.push_back(junk[rng() % (sizeof(junk) / sizeof(junk[0]))]);
+        }
+        c.message = build_message(cmd, args);
+        break;
+    }
+    }
+
+    return c;
+}
+
+static std::vector<Case> generate_corpus(std::mt19937& rng, int perKind) {
+    std::vector<Case> corpus;
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        for (int kind = 0; kind < CASE_KIND_COUNT; kind++) {
+            for (int n = 0; n < perKind; n++) {
+                corpus.push_back(make_case(COMMANDS[i], static_cast<CaseKind>(kind), rng));
+            }
+        }
+    }
+    return corpus;
+}
+
+//Receive thread's read size, see Main.cpp
+static const int RECV_CHUNK_BYTES = 4096;
+
+//Messages for a map at MAX_SITES, each several KB on the wire: the site list, and an eight
+//player FULL_STATE with full-width bitsets where player p owns every site i with i % 8 == p
+static std::string large_stream(std::mt19937& rng) {
+    std::string stream = "GAME_START," + std::to_string(MAX_PLAYERS) + "\n";
+
+    stream += "SITE_POSITIONS";
+    for (int i = 0; i < MAX_SITES; i++) {
+        stream += "," + std::to_string(20 + rng() % 760) + "," + std::to_string(20 + rng() % 560);
+    }
+    stream += "\n";
+
+    stream += "FULL_STATE,P" + std::to_string(MAX_PLAYERS);
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        SiteBitset owned;
+        owned.resize(MAX_SITES);
+        for (int i = p; i < MAX_SITES; i += MAX_PLAYERS) {
+            owned.set(i);
+        }
+        stream += "," + owned.encode();
+    }
+    for (int i = 0; i < BUILDING_KINDS; i++) {
+        SiteBitset built;
+        built.resize(MAX_SITES);
+        built.set(static_cast<int>(rng() % MAX_SITES));
+        stream += "," + built.encode();
+    }
+    stream += ",0,0,0";
+    for (int i = 0; i < 5 * MAX_PLAYERS; i++) {
+        stream += "," + std::to_string(20 + rng() % 560);
+    }
+    stream += ",0,0.0,-1\n";
+
+    return stream;
+}
+
+static const int LARGE_STREAM_MESSAGES = 3;
+
+//Hands stream to a framer in reads of random size up to the receive thread's, each from an
+//exactly sized heap copy so sanitizers see any overread. Returns the number of messages applied.
+static int feed_stream(MyGame& game, const std::string& stream, std::mt19937& rng, std::string& cmd,
+    std::vector<std::string>& args) {
+    MessageFramer framer;
+    int applied = 0;
+
+    for (size_t offset = 0; offset < stream.length();) {
+        size_t length = std::min(stream.length() - offset, static_cast<size_t>(1 + rng() % RECV_CHUNK_BYTES));
+        char* chunk = static_cast<char*>(malloc(length));
+        memcpy(chunk, stream.data() + offset, length);
+        framer.feed(chunk, static_cast<int>(length));
+        free(chunk);
+        offset += length;
+
+        const char* message;
+        int messageLength;
+        while (framer.next(message, messageLength)) {
+            if (parse_message(message, messageLength, cmd, args)) {
+                game.on_receive(cmd, args);
+                game.processEvents();
+                applied++;
+            }
+        }
+    }
+
+    return applied;
+}
+
+//The large map came through whole: every site, and every player's share of them
+static bool check_large_stream(int applied, std::string& why) {
+    if (applied != LARGE_STREAM_MESSAGES) {
+        why = std::to_string(applied) + " of " + std::to_string(LARGE_STREAM_MESSAGES) + " large messages applied";
+        return false;
+    }
+    if (static_cast<int>(game_data.sites.size()) != MAX_SITES) {
+        why = "large map has " + std::to_string(game_data.sites.size()) + " sites";
+        return false;
+    }
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        if (game_data.ownership[p].count() != MAX_SITES / MAX_PLAYERS) {
+            why = "player " + std::to_string(p + 1) + " owns " + std::to_string(game_data.ownership[p].count()) + " sites";
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- harness ---------------------------------------------------------------
+
+//Swallows the client's console logging so we time parsing rather than the terminal
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+};
+
+static void prime_game(MyGame& game) {
+    std::mt19937 rng(1);
+    const char* setup[] = { "GAME_START" };
+    std::vector<std::string> args;
+    std::string cmd;
+
+    for (size_t i = 0; i < sizeof(setup) / sizeof(setup[0]); i++) {
+        parse_message(setup[i], static_cast<int>(strlen(setup[i])), cmd, args);
+        game.on_receive(cmd, args);
+        game.processEvents();
+    }
+
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        if (std::string(COMMANDS[i].name) == "SITE_POSITIONS") {
+            Case c = make_case(COMMANDS[i], CASE_VALID, rng);
+            parse_message(c.message.c_str(), static_cast<int>(c.message.length()), cmd, args);
+            game.on_receive(cmd, args);
+            game.processEvents();
+        }
+    }
+}
+
+//Invariants the rest of the client relies on after any message
+static bool check_state(std::string& why) {
+    int siteCount = static_cast<int>(game_data.sites.size());
+    if (siteCount > MAX_SITES) {
+        why = "site list has " + std::to_string(siteCount) + " entries";
+        return false;
+    }
+    if (game_data.playerCount < 2 || game_data.playerCount > MAX_PLAYERS) {
+        why = "player count is " + std::to_string(game_data.playerCount);
+        return false;
+    }
+    if (siteCount > 0) {
+        bool fitted = game_data.castles.size() == siteCount;
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            fitted = fitted && game_data.ownership[i].size() == siteCount;
+        }
+        if (!fitted) {
+            why = "site bitsets do not match the site list";
+            return false;
+        }
+    }
+    if (game_data.combatTimeUs < 0) {
+        why = "combat timer is negative";
+        return false;
+    }
+    return true;
+}
+
+//Runs one message from an exactly sized heap copy so sanitizers see any overread
+static void feed(MyGame& game, const std::string& message, std::string& cmd, std::vector<std::string>& args) {
+    size_t length = message.length();
+    char* buffer = static_cast<char*>(malloc(length ? length : 1));
+    memcpy(buffer, message.data(), length);
+
+    if (parse_message(buffer, static_cast<int>(length), cmd, args)) {
+        game.on_receive(cmd, args);
+        game.processEvents();
+    }
+
+    free(buffer);
+}
+
+struct Timing {
+    Uint64 messages;
+    Uint64 ticks;
+    Uint64 allocations;
+
+    Timing() : messages(0), ticks(0), allocations(0) {}
+};
+
+static int run_benchmark(int iterations, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<Case> corpus = generate_corpus(rng, 16);
+
+    MyGame game;
+    game.initialize();
+    prime_game(game);
+
+    std::map<std::string, Timing> perCase;
+    Timing total;
+    std::string cmd;
+    std::vector<std::string> args;
+    args.reserve(128);
+
+    double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+
+    std::string stream = large_stream(rng);
+
+    for (int it = 0; it < iterations; it++) {
+        Uint64 allocsBefore = alloc_total_count();
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        int applied = feed_stream(game, stream, rng, cmd, args);
+
+        Timing& framed = perCase["large map/framed"];
+        framed.messages += applied;
+        framed.ticks += SDL_GetPerformanceCounter() - start;
+        framed.allocations += alloc_total_count() - allocsBefore;
+
+        for (size_t i = 0; i < corpus.size(); i++) {
+            const Case& c = corpus[i];
+
+            Uint64 allocsBefore = alloc_total_count();
+            Uint64 start = SDL_GetPerformanceCounter();
+
+            if (parse_message(c.message.c_str(), static_cast<int>(c.message.length()), cmd, args)) {
+                game.on_receive(cmd, args);
+                game.processEvents();
+            }
+
+            Uint64 ticks = SDL_GetPerformanceCounter() - start;
+            Uint64 allocs = alloc_total_count() - allocsBefore;
+
+            Timing& t = perCase[c.command + "/" + CASE_KIND_NAMES[c.kind]];
+            t.messages++;
+            t.ticks += ticks;
+            t.allocations += allocs;
+
+            total.messages++;
+            total.ticks += ticks;
+            total.allocations += allocs;
+        }
+    }
+
+    printf("%-32s %10s %12s %12s\n", "command/kind", "messages", "ns/msg", "allocs/msg");
+    for (std::map<std::string, Timing>::const_iterator it = perCase.begin(); it != perCase.end(); ++it) {
+        const Timing& t = it->second;
+        printf("%-32s %10llu %12.1f %12.2f\n", it->first.c_str(), static_cast<unsigned long long>(t.messages),
+            t.ticks * 1e9 / freq / t.messages, static_cast<double>(t.allocations) / t.messages);
+    }
+
+    double seconds = total.ticks / freq;
+    printf("\nTOTAL: %llu messages in %.3f s, %.0f messages/s, %.1f ns/msg, %.2f allocs/msg\n",
+        static_cast<unsigned long long>(total.messages), seconds, total.messages / seconds,
+        seconds * 1e9 / total.messages, static_cast<double>(total.allocations) / total.messages);
+    return 0;
+}
+
+static std::string mutate(const std::string& input, std::mt19937& rng) {
+    std::string s = input;
+    int mutations = 1 + rng() % 4;
+
+    for (int m = 0; m < mutations; m++) {
+        size_t pos = s.empty() ? 0 : rng() % s.length();
+        switch (rng() % 6) {
+        case 0: if (!s.empty()) s[pos] = static_cast<char>(rng() % 256); break;
+        case 1: s.insert(pos, 1, ','); break;
+        case 2: if (!s.empty()) s.erase(pos, 1 + rng() % 8); break;
+        case 3: s.insert(pos, std::to_string(static_cast<int>(rng()))); break;
+        case 4: s = s.substr(0, pos); break;
+        default: s.insert(pos, 1, '\0'); break;
+        }
+    }
+
+    return s;
+}
+
+static int run_fuzz(int iterations, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<Case> corpus = generate_corpus(rng, 4);
+
+    MyGame game;
+    game.initialize();
+    prime_game(game);
+
+    std::string cmd;
+    std::vector<std::string> args;
+    std::string why;
+    Uint64 executed = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        const Case& base = corpus[rng() % corpus.size()];
+        std::string input = (it % 4 == 0) ? base.message : mutate(base.message, rng);
+
+        try {
+            feed(game, input, cmd, args);
+        }
+        catch (const std::exception& e) {
+            fprintf(stderr, "FUZZ FAILURE: exception escaped on_receive (%s) for input '%s'\n", e.what(), input.c_str());
+            return 1;
+        }
+
+        if (!check_state(why)) {
+            fprintf(stderr, "FUZZ FAILURE: %s after input '%s'\n", why.c_str(), input.c_str());
+            return 1;
+        }
+
+        //Keep a valid map around most of the time so the site-indexed paths are exercised
+        if (game_data.sites.empty() && rng() % 2 == 0) {
+            prime_game(game);
+        }
+
+        executed++;
+    }
+
+    //Well formed but too big for one recv, so only the framer keeps them whole
+    for (int i = 0; i < 20; i++) {
+        int applied = feed_stream(game, large_stream(rng), rng, cmd, args);
+        if (!check_large_stream(applied, why)) {
+            fprintf(stderr, "FUZZ FAILURE: %s\n", why.c_str());
+            return 1;
+        }
+        executed++;
+    }
+
+    printf("FUZZ OK: %llu inputs, no crashes or invariant violations\n", static_cast<unsigned long long>(executed));
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool fuzz = false;
+    int iterations = -1;
+    unsigned seed = 12345;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--fuzz") {
+            fuzz = true;
+        }
+        else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        }
+        else {
+            fprintf(stderr, "usage: %s [--fuzz] [--iterations N] [--seed S]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    NullBuffer null;
+    std::streambuf* console = std::cout.rdbuf(&null);
+
+    int result = fuzz ? run_fuzz(iterations > 0 ? iterations : 200000, seed)
+                      : run_benchmark(iterations > 0 ? iterations : 50, seed);
+
+    std::cout.rdbuf(console);
+    return result;
+}
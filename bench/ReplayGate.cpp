@@ -0,0 +1,333 @@
+// Performance regression gate: replays recorded matches (see --record) headless and checks the
+// client's cost against a stored baseline.
+//
+//   ReplayGate --baseline FILE [--update] [--runs N] [--no-render] [--metrics a,b,...] MATCH.rec...
+//
+// Each match is replayed as fast as possible into SDL's software renderer, once to warm up
+// (first-use allocations, caches) and then --runs times (default 3), keeping the best run:
+//
+//   cpu_ms          process CPU time for the whole match
+//   frame_p50_us    frame time percentiles, processEvents + update + render of one recorded frame
+//   frame_p95_us
+//   frame_p99_us
+//   allocations     operator new calls during the match
+//   peak_heap_kb    most heap held at once during the match, above what was held before it
+//
+// The baseline is a text file of "<match> <metric> <value>" lines, plus "tolerance <metric> <percent>"
+// lines that override the defaults below. A metric more than its tolerance above the baseline is a
+// regression and the gate exits 1. --update writes the measured values as the new baseline, keeping
+// the tolerance lines. --metrics checks (and with --update, stores) only the metrics listed, e.g.
+// allocations and peak_heap_kb against a baseline that wasn't recorded on this machine.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <streambuf>
+
+#include "AllocTracker.h"
+#include "MyGame.h"
+#include "Replay.h"
+
+// --- metrics and baseline --------------------------------------------------
+
+struct MetricSpec {
+    const char* name;
+    double tolerancePercent;    //default allowance over the baseline before it counts as a regression
+};
+
+//Timings are the best of several runs but still vary with the machine's load, allocations don't vary at all
+static const MetricSpec METRICS[] = {
+    { "cpu_ms", 15.0 },
+    { "frame_p50_us", 15.0 },
+    { "frame_p95_us", 20.0 },
+    { "frame_p99_us", 30.0 },
+    { "allocations", 2.0 },
+    { "peak_heap_kb", 10.0 }
+};
+
+static const int METRIC_COUNT = sizeof(METRICS) / sizeof(METRICS[0]);
+
+typedef std::map<std::string, double> Measurement;
+
+struct Baseline {
+    std::map<std::string, Measurement> matches;
+    std::map<std::string, double> tolerances;
+};
+
+static bool load_baseline(const std::string& path, Baseline& baseline) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string first, metric;
+        double value;
+        if (!(fields >> first >> metric >> value)) {
+            fprintf(stderr, "ignoring baseline line: %s\n", line.c_str());
+            continue;
+        }
+
+        if (first == "tolerance") {
+            baseline.tolerances[metric] = value;
+        }
+        else {
+            baseline.matches[first][metric] = value;
+        }
+    }
+    return true;
+}
+
+static bool save_baseline(const std::string& path, const Baseline& baseline) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    fprintf(out, "# ReplayGate baseline: <match> <metric> <value>, tolerance <metric> <percent over baseline>\n");
+    for (std::map<std::string, double>::const_iterator it = baseline.tolerances.begin(); it != baseline.tolerances.end(); ++it) {
+        fprintf(out, "tolerance %s %g\n", it->first.c_str(), it->second);
+    }
+    for (std::map<std::string, Measurement>::const_iterator match = baseline.matches.begin(); match != baseline.matches.end(); ++match) {
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            Measurement::const_iterator value = match->second.find(METRICS[m].name);
+            if (value != match->second.end()) {
+                fprintf(out, "%s %s %.1f\n", match->first.c_str(), METRICS[m].name, value->second);
+            }
+        }
+    }
+
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+//Comma separated list from --metrics, empty for all
+static bool gated(const std::vector<std::string>& only, const char* metric) {
+    return only.empty() || std::find(only.begin(), only.end(), metric) != only.end();
+}
+
+//Matches are keyed by file name so the baseline doesn't depend on where they are checked out
+static std::string match_name(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// --- harness ---------------------------------------------------------------
+
+//Swallows the client's console output so it doesn't bury the report
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+};
+
+static bool replay_once(const std::string& path, SDL_Renderer* renderer, Measurement& result) {
+    MyGame* game = new MyGame();
+    game->initialize();
+
+    ReplayOptions options;
+    options.path = path;
+    options.realtime = false;
+
+    ReplayStats* stats = new ReplayStats();
+
+    Uint64 allocationsBefore = alloc_total_count();
+    Uint64 heapBefore = alloc_live_bytes();
+    alloc_reset_peak();
+
+    NullBuffer null;
+    std::streambuf* console = std::cout.rdbuf(&null);
+    bool ok = run_replay(*game, options, renderer, *stats);
+    std::cout.rdbuf(console);
+
+    result["cpu_ms"] = stats->cpuMs;
+    result["frame_p50_us"] = static_cast<double>(stats->frameUs.percentile(0.50));
+    result["frame_p95_us"] = static_cast<double>(stats->frameUs.percentile(0.95));
+    result["frame_p99_us"] = static_cast<double>(stats->frameUs.percentile(0.99));
+    result["allocations"] = static_cast<double>(alloc_total_count() - allocationsBefore);
+    result["peak_heap_kb"] = (alloc_peak_bytes() - heapBefore) / 1024.0;
+
+    ok = ok && stats->frames > 0;
+    delete stats;
+    delete game;
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::string baselinePath;
+    std::vector<std::string> matches;
+    bool update = false;
+    bool render = true;
+    int runs = 3;
+    std::vector<std::string> only;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        }
+        else if (arg == "--update") {
+            update = true;
+        }
+        else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--no-render") {
+            render = false;
+        }
+        else if (arg == "--metrics" && i + 1 < argc) {
+            std::istringstream names(argv[++i]);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                only.push_back(name);
+            }
+        }
+        else if (arg.compare(0, 2, "--") != 0) {
+            matches.push_back(arg);
+        }
+        else {
+            matches.clear();
+            break;
+        }
+    }
+
+    if (baselinePath.empty() || matches.empty()) {
+        fprintf(stderr, "usage: %s --baseline FILE [--update] [--runs N] [--no-render] [--metrics a,b,...] MATCH.rec...\n", argv[0]);
+        return 2;
+    }
+
+    for (size_t i = 0; i < only.size(); i++) {
+        bool known = false;
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            known = known || only[i] == METRICS[m].name;
+        }
+        if (!known) {
+            fprintf(stderr, "ERROR: unknown metric %s\n", only[i].c_str());
+            return 2;
+        }
+    }
+
+    log_set_level(LOG_LEVEL_OFF);
+
+    Baseline baseline;
+    bool haveBaseline = load_baseline(baselinePath, baseline);
+    if (!haveBaseline && !update) {
+        fprintf(stderr, "ERROR: could not read baseline %s, run with --update to create it\n", baselinePath.c_str());
+        return 1;
+    }
+
+    SDL_Surface* surface = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    if (render) {
+        surface = SDL_CreateRGBSurfaceWithFormat(0, 800, 600, 32, SDL_PIXELFORMAT_ARGB8888);
+        renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+        if (!renderer) {
+            fprintf(stderr, "ERROR: no software renderer: %s\n", SDL_GetError());
+            return 1;
+        }
+    }
+
+    int regressions = 0;
+    int missing = 0;
+    bool replayed = true;
+
+    printf("%-24s %-14s %12s %12s %9s %9s\n", "match", "metric", "baseline", "measured", "change", "allowed");
+
+    for (size_t i = 0; i < matches.size() && replayed; i++) {
+        std::string name = match_name(matches[i]);
+
+        //Run 0 warms up and is thrown away. Best of the rest for timings, allocations and heap
+        //are the same every run after the first.
+        Measurement best;
+        for (int r = 0; r <= runs && replayed; r++) {
+            Measurement run;
+            if (!replay_once(matches[i], renderer, run)) {
+                fprintf(stderr, "ERROR: could not replay %s\n", matches[i].c_str());
+                replayed = false;
+            }
+            if (r == 0 || !replayed) {
+                continue;
+            }
+            for (Measurement::const_iterator it = run.begin(); it != run.end(); ++it) {
+                if (r == 1 || it->second < best[it->first]) {
+                    best[it->first] = it->second;
+                }
+            }
+        }
+
+        if (!replayed) {
+            break;
+        }
+
+        std::map<std::string, Measurement>::const_iterator stored = baseline.matches.find(name);
+
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            const char* metric = METRICS[m].name;
+            if (!gated(only, metric)) {
+                best.erase(metric);
+                continue;
+            }
+            double measured = best[metric];
+            double tolerance = baseline.tolerances.count(metric) ? baseline.tolerances[metric] : METRICS[m].tolerancePercent;
+
+            Measurement::const_iterator expected;
+            if (stored == baseline.matches.end() || (expected = stored->second.find(metric)) == stored->second.end()) {
+                printf("%-24s %-14s %12s %12.1f %9s %8.0f%%  no baseline\n", name.c_str(), metric, "-", measured, "-", tolerance);
+                missing++;
+                continue;
+            }
+
+            //Anything measured at zero or near it is held to an absolute slack of one unit
+            double allowed = std::max(expected->second * (1.0 + tolerance / 100.0), expected->second + 1.0);
+            double change = expected->second > 0 ? (measured / expected->second - 1.0) * 100.0 : 0.0;
+            bool regressed = measured > allowed;
+
+            printf("%-24s %-14s %12.1f %12.1f %+8.1f%% %8.0f%%%s\n", name.c_str(), metric, expected->second, measured,
+                change, tolerance, regressed ? "  REGRESSION" : "");
+            if (regressed) {
+                regressions++;
+            }
+        }
+
+        if (update) {
+            baseline.matches[name] = best;
+        }
+    }
+
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+    }
+
+    if (!replayed) {
+        return 1;
+    }
+
+    if (update) {
+        if (!save_baseline(baselinePath, baseline)) {
+            fprintf(stderr, "ERROR: could not write baseline %s\n", baselinePath.c_str());
+            return 1;
+        }
+        printf("\nBaseline %s updated\n", baselinePath.c_str());
+        return 0;
+    }
+
+    if (regressions > 0 || missing > 0) {
+        printf("\nFAILED: %d regressions, %d metrics without a baseline\n", regressions, missing);
+        return 1;
+    }
+
+    printf("\nOK: %zu matches within tolerance\n", matches.size());
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Query cost of the site spatial index against site count.
+//
+//   SpatialBench [--queries N] [--seed S]
+//
+// For each map size it times a linear scan over the old array-of-structs site layout and
+// over the SiteArrays columns, SpatialIndex::nearest, nearestWithin(50) and queryRadius,
+// plus a full territory pass over an 800x600 screen at 2px steps, and checks the grid
+// agrees with the linear scan.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "MyGame.h"
+#include "SpatialIndex.h"
+
+//How sites were laid out before SiteArrays, kept to show what the column layout buys
+struct LegacySite {
+    Point center;
+    SDL_Color neutralColor;
+    bool hasCastle;
+    bool hasGoldMine;
+    bool hasBarracks;
+};
+
+static int linear_nearest(const std::vector<LegacySite>& sites, int x, int y) {
+    int closest = -1;
+    long long best = 0;
+    for (size_t i = 0; i < sites.size(); i++) {
+        long long dx = sites[i].center.x - x;
+        long long dy = sites[i].center.y - y;
+        long long d = dx * dx + dy * dy;
+        if (closest < 0 || d < best) {
+            best = d;
+            closest = static_cast<int>(i);
+        }
+    }
+    return closest;
+}
+
+static int linear_nearest(const SiteArrays& sites, int x, int y) {
+    const int* sx = sites.x.data();
+    const int* sy = sites.y.data();
+    int count = static_cast<int>(sites.size());
+
+    int closest = -1;
+    long long best = 0;
+    for (int i = 0; i < count; i++) {
+        long long dx = sx[i] - x;
+        long long dy = sy[i] - y;
+        long long d = dx * dx + dy * dy;
+        if (closest < 0 || d < best) {
+            best = d;
+            closest = i;
+        }
+    }
+    return closest;
+}
+
+static double ns_per(Uint64 ticks, int count) {
+    return ticks * 1e9 / static_cast<double>(SDL_GetPerformanceFrequency()) / count;
+}
+
+int main(int argc, char** argv) {
+    int queries = 200000;
+    unsigned seed = 12345;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--queries" && i + 1 < argc) {
+            queries = atoi(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        }
+        else {
+            fprintf(stderr, "usage: %s [--queries N] [--seed S]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const int SITE_COUNTS[] = { 8, 64, 256, 1024, 4096 };
+    const int WIDTH = 800, HEIGHT = 600, STEP = 2;
+
+    printf("%8s %10s %12s %12s %12s %12s %12s %14s %14s\n", "sites", "build us", "AoS scan ns", "SoA scan ns",
+        "nearest ns", "within50 ns", "radius ns", "territory ms", "linear terr ms");
+
+    std::mt19937 rng(seed);
+    volatile long long sink = 0;
+    int mismatches = 0;
+
+    for (size_t n = 0; n < sizeof(SITE_COUNTS) / sizeof(SITE_COUNTS[0]); n++) {
+        int count = SITE_COUNTS[n];
+
+        SiteArrays sites;
+        std::vector<LegacySite> legacy;
+        for (int i = 0; i < count; i++) {
+            sites.add(rng() % WIDTH, rng() % HEIGHT);
+
+            LegacySite site = { Point(sites.x[i], sites.y[i]), sites.neutralColor[i], false, false, false };
+            legacy.push_back(site);
+        }
+
+        std::vector<int> qx(queries), qy(queries);
+        for (int q = 0; q < queries; q++) {
+            qx[q] = rng() % WIDTH;
+            qy[q] = rng() % HEIGHT;
+        }
+
+        SpatialIndex index;
+        Uint64 start = SDL_GetPerformanceCounter();
+        index.build(sites);
+        Uint64 buildTicks = SDL_GetPerformanceCounter() - start;
+
+        //The linear scan gets fewer queries on big maps, it is only there for comparison
+        int linearQueries = std::max(1000, queries / std::max(1, count / 64));
+        start = SDL_GetPerformanceCounter();
+        for (int q = 0; q < linearQueries; q++) {
+            sink += linear_nearest(legacy, qx[q], qy[q]);
+        }
+        Uint64 legacyTicks = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int q = 0; q < linearQueries; q++) {
+            sink += linear_nearest(sites, qx[q], qy[q]);
+        }
+        Uint64 linearTicks = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int q = 0; q < queries; q++) {
+            sink += index.nearest(qx[q], qy[q]);
+        }
+        Uint64 nearestTicks = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int q = 0; q < queries; q++) {
+            sink += index.nearestWithin(qx[q], qy[q], 50.0f);
+        }
+        Uint64 withinTicks = SDL_GetPerformanceCounter() - start;
+
+        std::vector<int> found;
+        start = SDL_GetPerformanceCounter();
+        for (int q = 0; q < queries; q++) {
+            found.clear();
+            index.queryRadius(qx[q], qy[q], 50.0f, found);
+            sink += found.size();
+        }
+        Uint64 radiusTicks = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int y = 0; y < HEIGHT; y += STEP) {
+            for (int x = 0; x < WIDTH; x += STEP) {
+                sink += index.nearest(x, y);
+            }
+        }
+        Uint64 territoryTicks = SDL_GetPerformanceCounter() - start;
+
+        start = SDL_GetPerformanceCounter();
+        for (int y = 0; y < HEIGHT; y += STEP) {
+            for (int x = 0; x < WIDTH; x += STEP) {
+                sink += linear_nearest(sites, x, y);
+            }
+        }
+        Uint64 linearTerritoryTicks = SDL_GetPerformanceCounter() - start;
+
+        for (int q = 0; q < std::min(queries, 20000); q++) {
+            if (index.nearest(qx[q], qy[q]) != linear_nearest(sites, qx[q], qy[q])) {
+                mismatches++;
+            }
+        }
+
+        double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+        printf("%8d %10.1f %12.1f %12.1f %12.1f %12.1f %12.1f %14.3f %14.3f\n", count,
+            buildTicks * 1e6 / freq,
+            ns_per(legacyTicks, linearQueries),
+            ns_per(linearTicks, linearQueries),
+            ns_per(nearestTicks, queries),
+            ns_per(withinTicks, queries),
+            ns_per(radiusTicks, queries),
+            territoryTicks * 1e3 / freq,
+            linearTerritoryTicks * 1e3 / freq);
+    }
+
+    if (mismatches > 0) {
+        fprintf(stderr, "ERROR: grid nearest disagreed with the linear scan %d times\n", mismatches);
+        return 1;
+    }
+
+    return 0;
+}
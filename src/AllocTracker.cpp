@@ -0,0 +1,254 @@
+#include "AllocTracker.h"
+#include "Log.h"
+#include "Metrics.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+//Every block carries its size in front so delete can take it off the live total.
+//16 bytes keeps the pointer handed out as aligned as malloc's.
+static const size_t HEADER = 16;
+
+//Plain data only, so it needs no constructor and is usable from the first allocation on any thread
+struct ThreadAllocs {
+    AllocCounts counts[ALLOC_SUBSYSTEMS];
+    AllocSubsystem current;
+    bool steady;                //inside a frame that should not allocate
+    Uint64 steadyCount;
+    AllocSubsystem firstSubsystem;
+    size_t firstSize;
+};
+
+static thread_local ThreadAllocs thread_allocs;
+
+static std::atomic<Uint64> totalCount(0);
+static std::atomic<Uint64> liveBytes(0);
+static std::atomic<Uint64> peakBytes(0);
+static std::atomic<int> assertMode(ALLOC_ASSERT_OFF);
+
+static void* allocate(size_t size) {
+    char* block = static_cast<char*>(malloc(size + HEADER));
+    if (!block) {
+        return nullptr;
+    }
+    memcpy(block, &size, sizeof(size));
+
+    ThreadAllocs& t = thread_allocs;
+    t.counts[t.current].count++;
+    t.counts[t.current].bytes += size;
+    //Messages and clicks arrive when something happens, not every frame, so they are off the budget.
+    //On the main thread that is on_receive during a replay and the input handlers.
+    if (t.steady && t.current != ALLOC_NETWORK && t.current != ALLOC_INPUT) {
+        if (t.steadyCount++ == 0) {
+            t.firstSubsystem = t.current;
+            t.firstSize = size;
+        }
+        if (assertMode.load(std::memory_order_relaxed) == ALLOC_ASSERT_BREAK) {
+            SDL_TriggerBreakpoint();
+        }
+    }
+
+    totalCount.fetch_add(1, std::memory_order_relaxed);
+    Uint64 live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    Uint64 peak = peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+
+    return block + HEADER;
+}
+
+static void release(void* p) {
+    if (!p) {
+        return;
+    }
+    char* block = static_cast<char*>(p) - HEADER;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    free(block);
+}
+
+void* alloc_tracked(size_t size) {
+    return allocate(size);
+}
+
+void alloc_tracked_free(void* p) {
+    release(p);
+}
+
+void* operator new(size_t size) {
+    void* p = allocate(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p) noexcept {
+    release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    release(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    release(p);
+}
+#endif
+
+const char* alloc_subsystem_name(AllocSubsystem subsystem) {
+    static const char* const NAMES[ALLOC_SUBSYSTEMS] = { "other", "network", "apply", "input", "update", "render" };
+    return subsystem >= 0 && subsystem < ALLOC_SUBSYSTEMS ? NAMES[subsystem] : "unknown";
+}
+
+AllocCounts alloc_thread_counts(AllocSubsystem subsystem) {
+    return thread_allocs.counts[subsystem];
+}
+
+AllocCounts alloc_thread_total() {
+    AllocCounts total = { 0, 0 };
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        total.count += thread_allocs.counts[i].count;
+        total.bytes += thread_allocs.counts[i].bytes;
+    }
+    return total;
+}
+
+Uint64 alloc_total_count() {
+    return totalCount.load(std::memory_order_relaxed);
+}
+
+Uint64 alloc_live_bytes() {
+    return liveBytes.load(std::memory_order_relaxed);
+}
+
+Uint64 alloc_peak_bytes() {
+    return peakBytes.load(std::memory_order_relaxed);
+}
+
+void alloc_reset_peak() {
+    peakBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+AllocScope::AllocScope(AllocSubsystem subsystem) : previous(thread_allocs.current) {
+    thread_allocs.current = subsystem;
+}
+
+AllocScope::~AllocScope() {
+    thread_allocs.current = previous;
+}
+
+void alloc_set_assert(AllocAssert mode) {
+    assertMode.store(mode, std::memory_order_relaxed);
+}
+
+// --- per frame --------------------------------------------------------------
+
+static Histogram frame_allocations("frame_allocations", "Allocations on the main thread per frame");
+static Histogram frame_allocated_bytes("frame_allocated_bytes", "Bytes allocated on the main thread per frame");
+
+//Main thread only
+static AllocCounts frameStart[ALLOC_SUBSYSTEMS];
+static AllocCounts frameTotals[ALLOC_SUBSYSTEMS];
+static Uint64 frameMax[ALLOC_SUBSYSTEMS];
+static Uint64 frames = 0;
+static Uint64 steadyFrames = 0;
+static Uint64 flaggedFrames = 0;
+
+void alloc_frame_begin(bool steady) {
+    ThreadAllocs& t = thread_allocs;
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        frameStart[i] = t.counts[i];
+    }
+    t.steady = steady;
+    t.steadyCount = 0;
+}
+
+bool alloc_frame_end() {
+    ThreadAllocs& t = thread_allocs;
+    bool steady = t.steady;
+    Uint64 steadyCount = t.steadyCount;
+    t.steady = false;
+
+    Uint64 count = 0;
+    Uint64 bytes = 0;
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        Uint64 n = t.counts[i].count - frameStart[i].count;
+        Uint64 b = t.counts[i].bytes - frameStart[i].bytes;
+        frameTotals[i].count += n;
+        frameTotals[i].bytes += b;
+        if (n > frameMax[i]) {
+            frameMax[i] = n;
+        }
+        count += n;
+        bytes += b;
+    }
+
+    frames++;
+    frame_allocations.record(count);
+    frame_allocated_bytes.record(bytes);
+
+    if (!steady) {
+        return true;
+    }
+    steadyFrames++;
+    if (steadyCount == 0) {
+        return true;
+    }
+
+    flaggedFrames++;
+    if (assertMode.load(std::memory_order_relaxed) != ALLOC_ASSERT_OFF) {
+        LOG_ERROR(LOG_GAME, "[ALLOC] Steady frame made %llu allocations (%llu bytes), the first %u bytes in %s",
+            static_cast<unsigned long long>(steadyCount), static_cast<unsigned long long>(bytes),
+            static_cast<unsigned>(t.firstSize), alloc_subsystem_name(t.firstSubsystem));
+    }
+    return false;
+}
+
+void alloc_print_stats() {
+    if (frames == 0) {
+        return;
+    }
+
+    printf("=== ALLOCATIONS PER FRAME (main thread, %llu frames) ===\n", static_cast<unsigned long long>(frames));
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        if (frameTotals[i].count == 0) {
+            continue;
+        }
+        printf("  %-8s %8.2f allocs %10.1f bytes, at most %llu in a frame\n", alloc_subsystem_name(static_cast<AllocSubsystem>(i)),
+            static_cast<double>(frameTotals[i].count) / frames, static_cast<double>(frameTotals[i].bytes) / frames,
+            static_cast<unsigned long long>(frameMax[i]));
+    }
+    printf("  steady frames: %llu, %llu of them allocated\n", static_cast<unsigned long long>(steadyFrames),
+        static_cast<unsigned long long>(flaggedFrames));
+    printf("  heap: %llu KB live, %llu KB peak\n", static_cast<unsigned long long>(alloc_live_bytes() / 1024),
+        static_cast<unsigned long long>(alloc_peak_bytes() / 1024));
+}
@@ -0,0 +1,77 @@
+#ifndef __ALLOC_TRACKER_H__
+#define __ALLOC_TRACKER_H__
+
+#include "SDL.h"
+
+//Counts every operator new in the program, through the replacement global operators in
+//AllocTracker.cpp. Each thread counts into its own totals, split by the subsystem it last
+//declared with ALLOC_SCOPE, so counting is a few plain increments. Live and peak heap bytes
+//are process wide.
+//
+//The main loop brackets each frame with alloc_frame_begin/alloc_frame_end. A frame begun as
+//steady (PLAYING, past its first second) is expected to allocate nothing outside NETWORK and
+//INPUT scopes, which run on events rather than every frame; with an assert mode set, any
+//other allocation in one is reported, or stops in the debugger at the allocation.
+
+enum AllocSubsystem {
+    ALLOC_OTHER,
+    ALLOC_NETWORK,      //receive and send threads, decoding inbound messages
+    ALLOC_APPLY,        //applying inbound events on the main thread
+    ALLOC_INPUT,
+    ALLOC_UPDATE,
+    ALLOC_RENDER,
+    ALLOC_SUBSYSTEMS
+};
+
+enum AllocAssert {
+    ALLOC_ASSERT_OFF,
+    ALLOC_ASSERT_LOG,   //log each steady frame that allocated, with where
+    ALLOC_ASSERT_BREAK  //SDL_TriggerBreakpoint on the allocation itself
+};
+
+struct AllocCounts {
+    Uint64 count;
+    Uint64 bytes;
+};
+
+const char* alloc_subsystem_name(AllocSubsystem subsystem);
+
+//Calling thread's totals since it started
+AllocCounts alloc_thread_counts(AllocSubsystem subsystem);
+AllocCounts alloc_thread_total();
+
+//Whole process
+Uint64 alloc_total_count();
+Uint64 alloc_live_bytes();
+Uint64 alloc_peak_bytes();
+//Starts the peak again from what is live now
+void alloc_reset_peak();
+
+//malloc and free for allocators built on them (aligned_malloc), counted like operator new
+void* alloc_tracked(size_t size);
+void alloc_tracked_free(void* p);
+
+//Attributes the calling thread's allocations to subsystem until the end of the scope
+class AllocScope {
+
+private:
+    AllocSubsystem previous;
+
+public:
+    explicit AllocScope(AllocSubsystem subsystem);
+    ~AllocScope();
+};
+
+#define ALLOC_CONCAT2(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT2(a, b)
+#define ALLOC_SCOPE(subsystem) AllocScope ALLOC_CONCAT(allocScope, __LINE__)(subsystem)
+
+void alloc_set_assert(AllocAssert mode);
+
+//Per-frame accounting for the calling (main) thread
+void alloc_frame_begin(bool steady);
+//False if a steady frame allocated
+bool alloc_frame_end();
+void alloc_print_stats();
+
+#endif
@@ -0,0 +1,121 @@
+#include "InboundQueue.h"
+
+#include <iostream>
+
+const char* event_type_name(InboundEventType type) {
+    static const char* const NAMES[] = {
+        "LOBBY_INFO", "JOINED_ROOM", "ROOM_FULL", "SNAPSHOT", "RESUMED", "RESUME_FAILED", "GAME_START",
+        "SITE_POSITIONS", "OWNERSHIP", "SCORES", "RESOURCES", "PLAYER_POS", "BUILDINGS", "PLAYER_STATES",
+        "COMBAT_STATE", "FULL_STATE", "GAME_OVER", "COMBAT_START", "COMBAT_INTERRUPT", "COMBAT_END",
+        "RETREAT", "POSITIONS", "STATE_HASH", "CONNECTION_LOST", "RESYNC_STARTED", "SESSION_RESET",
+        "CONNECTING", "CONNECTED"
+    };
+    int index = static_cast<int>(type);
+    return index >= 0 && index < static_cast<int>(sizeof(NAMES) / sizeof(NAMES[0])) ? NAMES[index] : "UNKNOWN";
+}
+
+InboundQueue::InboundQueue() {
+    SDL_AtomicSet(&queued, 0);
+    SDL_AtomicSet(&allocatedEvents, PREALLOCATED_EVENTS);
+    SDL_AtomicSet(&allocatedPayloads, PREALLOCATED_PAYLOADS);
+    for (int i = 0; i < PREALLOCATED_EVENTS; i++) {
+        spareEvents.push(new InboundEvent());
+    }
+    for (int i = 0; i < PREALLOCATED_PAYLOADS; i++) {
+        sparePayloads.push(new InboundPayload());
+    }
+    ages.publish("inbound_event_age_us", "Time from receiving a server message to applying it");
+    drainDepth.publish("inbound_drain_depth", "Server messages applied per frame");
+}
+
+//Events still in flight belong to whoever acquired or popped them
+InboundQueue::~InboundQueue() {
+    InboundEvent* event;
+    while ((event = pop()) != nullptr) {
+        delete event->payload;
+        delete event;
+    }
+    while ((event = spareEvents.pop()) != nullptr) {
+        delete event;
+    }
+    InboundPayload* payload;
+    while ((payload = sparePayloads.pop()) != nullptr) {
+        delete payload;
+    }
+}
+
+InboundEvent* InboundQueue::acquire(InboundEventType type, bool withPayload) {
+    InboundEvent* event = spareEvents.pop();
+    if (!event) {
+        event = new InboundEvent();
+        SDL_AtomicIncRef(&allocatedEvents);
+    }
+    event->reset(type);
+
+    if (withPayload) {
+        event->payload = sparePayloads.pop();
+        if (!event->payload) {
+            event->payload = new InboundPayload();
+            SDL_AtomicIncRef(&allocatedPayloads);
+        }
+        event->payload->coords.clear();
+        event->payload->token.clear();
+    }
+    return event;
+}
+
+void InboundQueue::push(InboundEvent* event) {
+    if (event->receivedAt == 0) {
+        event->receivedAt = SDL_GetPerformanceCounter();
+    }
+
+    SDL_AtomicIncRef(&queued);
+    events.push(event);
+}
+
+void InboundQueue::push(InboundEventType type) {
+    push(acquire(type));
+}
+
+InboundEvent* InboundQueue::pop() {
+    InboundEvent* event = events.pop();
+    if (event) {
+        SDL_AtomicAdd(&queued, -1);
+    }
+    return event;
+}
+
+//Bitsets and coords keep their capacity, the next message of the same shape decodes in place
+void InboundQueue::release(InboundEvent* event) {
+    if (event->payload) {
+        sparePayloads.push(event->payload);
+        event->payload = nullptr;
+    }
+    spareEvents.push(event);
+}
+
+void InboundQueue::recordAge(Uint64 receivedAt) {
+    ages.record(metrics_elapsed_us(receivedAt));
+}
+
+void InboundQueue::recordDrain(int drained) {
+    drainDepth.record(static_cast<Uint64>(drained));
+}
+
+void InboundQueue::printStats() {
+    Uint64 drains = drainDepth.count();
+
+    std::cout << "=== INBOUND QUEUE ===" << std::endl;
+    std::cout << ages.count() << " events over " << drains << " frames";
+    if (drains > 0) {
+        std::cout << ", mean depth " << static_cast<double>(drainDepth.sum()) / drains << ", max depth " << drainDepth.max();
+    }
+    std::cout << std::endl;
+    std::cout << SDL_AtomicGet(&allocatedEvents) << " events and " << SDL_AtomicGet(&allocatedPayloads)
+        << " payloads allocated (" << PREALLOCATED_EVENTS << " and " << PREALLOCATED_PAYLOADS << " up front)" << std::endl;
+    if (ages.count() > 0) {
+        std::cout << "Age when applied (us): mean " << ages.mean() << ", p50 <" << ages.percentile(0.50)
+            << ", p99 <" << ages.percentile(0.99) << ", max " << ages.max() << std::endl;
+    }
+    std::cout << "=====================" << std::endl;
+}
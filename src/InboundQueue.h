@@ -0,0 +1,241 @@
+#ifndef __INBOUND_QUEUE_H__
+#define __INBOUND_QUEUE_H__
+
+#include <string>
+#include <vector>
+
+#include "SDL.h"
+#include "OutboundQueue.h"
+#include "SiteBitset.h"
+
+//Largest room the protocol can describe. Player numbers run 1..MAX_PLAYERS.
+const int MAX_PLAYERS = 8;
+
+enum InboundEventType {
+    EVENT_LOBBY_INFO,       //values: room 1-3 player counts, room 1-3 capacities
+    EVENT_JOINED_ROOM,      //values: room, player, players in the room or 0; token
+    EVENT_ROOM_FULL,        //values: room
+    EVENT_SNAPSHOT,         //values: snapshot id
+    EVENT_RESUMED,          //values: room, player, last snapshot id we presented
+    EVENT_RESUME_FAILED,
+    EVENT_GAME_START,       //values: players in the game or 0
+    EVENT_SITE_POSITIONS,   //coords: x,y pairs
+    EVENT_OWNERSHIP,        //ownership per player
+    EVENT_SCORES,           //scores per player
+    EVENT_RESOURCES,        //gold and levies per player
+    EVENT_PLAYER_POS,       //values: player, x, y
+    EVENT_BUILDINGS,        //buildings
+    EVENT_PLAYER_STATES,    //values: moving mask, capturing mask, in combat
+    EVENT_COMBAT_STATE,     //values: combat flags, site or -1; timer
+    EVENT_FULL_STATE,       //everything above, values as PLAYER_STATES then combat flags, site; see decode_message
+    EVENT_GAME_OVER,        //values: winner
+    EVENT_COMBAT_START,     //values: site
+    EVENT_COMBAT_INTERRUPT,
+    EVENT_COMBAT_END,       //values: winner
+    EVENT_RETREAT,          //values: player, site
+    EVENT_POSITIONS,        //x, y per player
+    EVENT_STATE_HASH,       //values: player; tick, hash
+
+    //Raised by the connection itself rather than the server
+    EVENT_CONNECTION_LOST,
+    EVENT_RESYNC_STARTED,   //reconnected and presented RESUME, waiting for the server to catch us up
+    EVENT_SESSION_RESET,    //reconnected without a session to resume
+    EVENT_CONNECTING,       //first connection to the server under way
+    EVENT_CONNECTED
+};
+
+//Name for logs and traces, e.g. "SNAPSHOT" for EVENT_SNAPSHOT
+const char* event_type_name(InboundEventType type);
+
+const int MAX_EVENT_VALUES = 6;
+
+enum BuildingKind {
+    BUILDING_CASTLE,
+    BUILDING_GOLD_MINE,
+    BUILDING_BARRACKS,
+    BUILDING_KINDS
+};
+
+//The variable-size part of a message: bitsets, site coordinates and the session token. Only the
+//commands listed by message_has_payload carry one, so every other event stays small.
+//Per-player arrays are indexed by player number - 1, as in InboundEvent.
+struct InboundPayload {
+    SiteBitset ownership[MAX_PLAYERS];
+    SiteBitset buildings[BUILDING_KINDS];
+    std::vector<int> coords;
+    std::string token;
+
+    InboundPayload* next;   //free list link, owned by InboundQueue
+
+    InboundPayload() : next(nullptr) {}
+};
+
+//One decoded server message, built on the receive thread and applied on the main thread.
+//Everything is parsed before it is queued, so applying an event can't fail.
+//Per-player arrays are indexed by player number - 1 and only the first `players` entries are set.
+struct InboundEvent {
+    InboundEventType type;
+    Uint64 receivedAt;
+    Uint32 message;         //sequence number of the server message it came from, 0 for the connection's own
+
+    int values[MAX_EVENT_VALUES];
+    float timer;
+
+    int players;
+    int scores[MAX_PLAYERS];
+    int gold[MAX_PLAYERS];
+    int levies[MAX_PLAYERS];
+    int x[MAX_PLAYERS];
+    int y[MAX_PLAYERS];
+
+    Uint64 tick;
+    Uint64 hash;
+
+    InboundPayload* payload;    //nullptr unless the type carries one, see InboundPayload
+
+    InboundEvent* next;     //queue link, owned by InboundQueue
+
+    InboundEvent(InboundEventType type = EVENT_GAME_START) : payload(nullptr), next(nullptr) {
+        reset(type);
+    }
+
+    //Back to a freshly constructed event, keeping the payload pointer
+    void reset(InboundEventType newType) {
+        type = newType;
+        receivedAt = 0;
+        message = 0;
+        timer = 0.0f;
+        players = 0;
+        tick = 0;
+        hash = 0;
+        for (int i = 0; i < MAX_EVENT_VALUES; i++) {
+            values[i] = 0;
+        }
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            scores[i] = gold[i] = levies[i] = x[i] = y[i] = 0;
+        }
+    }
+};
+
+//Lock-free multi-producer, single-consumer list of nodes linked through their `next` member
+//(intrusive, Vyukov style). Producers never wait on each other or on the consumer.
+template <typename T>
+class IntrusiveQueue {
+
+private:
+    T stub;
+    void* head;             //last pushed, swapped by producers
+    T* tail;                //next to pop, consumer only
+
+    static void** nextSlot(T* node) {
+        return reinterpret_cast<void**>(&node->next);
+    }
+
+    IntrusiveQueue(const IntrusiveQueue&);
+    IntrusiveQueue& operator=(const IntrusiveQueue&);
+
+public:
+    IntrusiveQueue() : head(&stub), tail(&stub) {}
+
+    //Swap ourselves in as the new head, then hook the old head up to us. Between the two
+    //steps the consumer sees the old head with no next and just stops there for now.
+    void push(T* node) {
+        SDL_AtomicSetPtr(nextSlot(node), nullptr);
+        SDL_MemoryBarrierRelease();
+        T* previous = static_cast<T*>(SDL_AtomicSetPtr(&head, node));
+        SDL_AtomicSetPtr(nextSlot(previous), node);
+    }
+
+    //Consumer only. nullptr when empty, or when a producer is halfway through a push
+    //(the node shows up on the next call)
+    T* pop() {
+        T* first = tail;
+        T* next = static_cast<T*>(SDL_AtomicGetPtr(nextSlot(first)));
+
+        //Step over the stub, it only exists so the list is never empty
+        if (first == &stub) {
+            if (!next) {
+                return nullptr;
+            }
+            tail = next;
+            first = next;
+            next = static_cast<T*>(SDL_AtomicGetPtr(nextSlot(first)));
+        }
+
+        if (next) {
+            tail = next;
+            SDL_MemoryBarrierAcquire();
+            return first;
+        }
+
+        //first is the last node. Unless a producer is mid-push, put the stub behind it so it can be handed out
+        if (first != SDL_AtomicGetPtr(&head)) {
+            return nullptr;
+        }
+
+        push(&stub);
+
+        next = static_cast<T*>(SDL_AtomicGetPtr(nextSlot(first)));
+        if (next) {
+            tail = next;
+            SDL_MemoryBarrierAcquire();
+            return first;
+        }
+
+        return nullptr;
+    }
+};
+
+//Events from the receive thread to the main thread. Events and payloads are recycled: the main
+//thread hands each one back through release() once applied and the receive thread picks it up
+//again in acquire(), so a steady stream of messages allocates nothing once the vectors and
+//strings inside have grown to the largest message seen.
+//
+//acquire() is for one thread at a time: the main thread before the network threads start, then
+//the receive thread (or whichever thread drives on_receive in a replay or benchmark).
+class InboundQueue {
+
+private:
+    IntrusiveQueue<InboundEvent> events;            //receive thread to main thread
+    IntrusiveQueue<InboundEvent> spareEvents;       //back again
+    IntrusiveQueue<InboundPayload> sparePayloads;
+    SDL_atomic_t queued;
+    SDL_atomic_t allocatedEvents;
+    SDL_atomic_t allocatedPayloads;
+
+    //Consumer side stats, published as inbound_event_age_us and inbound_drain_depth
+    Histogram ages;         //microseconds from receive to apply
+    Histogram drainDepth;   //events applied per frame
+
+    InboundQueue(const InboundQueue&);
+    InboundQueue& operator=(const InboundQueue&);
+
+public:
+    //Enough for the busiest frames seen; more are allocated if they are all in flight at once
+    static const int PREALLOCATED_EVENTS = 256;
+    static const int PREALLOCATED_PAYLOADS = 32;
+
+    InboundQueue();
+    ~InboundQueue();
+
+    //Producer side. A reset event of the given type, with a payload if asked for
+    InboundEvent* acquire(InboundEventType type, bool withPayload = false);
+    //Takes ownership, stamps receivedAt if the producer didn't
+    void push(InboundEvent* event);
+    //For the connection's own events, which carry nothing but their type
+    void push(InboundEventType type);
+    //Consumer only. nullptr when empty, or when a producer is halfway through a push
+    //(the event shows up on the next call)
+    InboundEvent* pop();
+    //Any thread, once done with an acquired or popped event
+    void release(InboundEvent* event);
+    int depth() { return SDL_AtomicGet(&queued); }
+
+    //Consumer only, called after applying an event and once per drain
+    void recordAge(Uint64 receivedAt);
+    void recordDrain(int drained);
+
+    void printStats();
+};
+
+#endif
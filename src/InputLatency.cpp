@@ -0,0 +1,234 @@
+#include "InputLatency.h"
+
+#include <cstring>
+#include <iostream>
+
+static const char* SPAN_NAMES[InputLatency::SPANS] = {
+    "dispatch", "handle", "queue", "server", "wait", "frame", "total", "predicted"
+};
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static LatencyAction action_of(const std::string& message) {
+    if (starts_with(message, "MOVE,")) {
+        return ACTION_MOVE;
+    }
+    if (starts_with(message, "JOIN_ROOM")) {
+        return ACTION_JOIN;
+    }
+    if (starts_with(message, "BUILD_")) {
+        return ACTION_BUILD;
+    }
+    if (starts_with(message, "RETREAT")) {
+        return ACTION_RETREAT;
+    }
+    return ACTION_NONE;
+}
+
+static Uint64 elapsed_us(Uint64 from, Uint64 to) {
+    return to > from ? (to - from) * 1000000 / SDL_GetPerformanceFrequency() : 0;
+}
+
+InputLatency::InputLatency() : lock(SDL_CreateMutex()), nextTag(0), openTag(-1), tagged(0), answered(0), unanswered(0) {
+    for (int i = 0; i < MAX_SAMPLES; i++) {
+        samples[i].tag = -1;
+    }
+    for (int s = 0; s < SPANS; s++) {
+        spans[s].publish("input_latency_us", "Click to photon, time spent in each stage of a click's request",
+            std::string("stage=\"") + SPAN_NAMES[s] + "\"");
+    }
+}
+
+InputLatency::~InputLatency() {
+    SDL_DestroyMutex(lock);
+}
+
+InputLatency::Sample* InputLatency::find(int tag) {
+    if (tag < 0) {
+        return nullptr;
+    }
+    Sample& sample = samples[tag % MAX_SAMPLES];
+    return sample.tag == tag ? &sample : nullptr;
+}
+
+void InputLatency::release(Sample& sample) {
+    sample.tag = -1;
+}
+
+void InputLatency::beginInput(const SDL_Event& event) {
+    if (event.type != SDL_MOUSEBUTTONDOWN) {
+        return;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    //SDL stamps events in SDL_GetTicks milliseconds. Replayed clicks carry no timestamp.
+    Uint64 eventAt = now;
+    Uint32 ticks = SDL_GetTicks();
+    if (event.button.timestamp != 0 && event.button.timestamp <= ticks) {
+        Uint64 ageTicks = static_cast<Uint64>(ticks - event.button.timestamp) * SDL_GetPerformanceFrequency() / 1000;
+        eventAt = ageTicks < now ? now - ageTicks : now;
+    }
+
+    SDL_LockMutex(lock);
+
+    int tag = nextTag;
+    nextTag = (nextTag + 1) & 0x7FFFFFFF;
+
+    //The ring has wrapped onto a request still in flight, it has been waiting far longer than any answer should
+    Sample& sample = samples[tag % MAX_SAMPLES];
+    if (sample.tag >= 0 && sample.action != ACTION_NONE) {
+        unanswered++;
+    }
+
+    sample.tag = tag;
+    sample.action = ACTION_NONE;
+    sample.predicted = false;
+    for (int s = 0; s < LATENCY_STAGES; s++) {
+        sample.at[s] = 0;
+    }
+    sample.at[LATENCY_EVENT] = eventAt;
+    sample.at[LATENCY_INPUT] = now;
+    openTag = tag;
+
+    SDL_UnlockMutex(lock);
+}
+
+void InputLatency::endInput() {
+    SDL_LockMutex(lock);
+
+    //A click that didn't send anything has nothing to measure
+    Sample* sample = find(openTag);
+    if (sample && sample->action == ACTION_NONE) {
+        release(*sample);
+    }
+    openTag = -1;
+
+    SDL_UnlockMutex(lock);
+}
+
+int InputLatency::noteEnqueued(const std::string& message) {
+    LatencyAction action = action_of(message);
+    if (action == ACTION_NONE) {
+        return -1;
+    }
+
+    SDL_LockMutex(lock);
+
+    int tag = -1;
+    Sample* sample = find(openTag);
+    if (sample && sample->action == ACTION_NONE) {
+        sample->action = action;
+        sample->at[LATENCY_ENQUEUE] = SDL_GetPerformanceCounter();
+        tag = sample->tag;
+        tagged++;
+    }
+
+    SDL_UnlockMutex(lock);
+    return tag;
+}
+
+void InputLatency::noteWritten(int tag) {
+    if (tag < 0) {
+        return;
+    }
+
+    SDL_LockMutex(lock);
+
+    Sample* sample = find(tag);
+    if (sample && sample->at[LATENCY_WRITE] == 0) {
+        sample->at[LATENCY_WRITE] = SDL_GetPerformanceCounter();
+    }
+
+    SDL_UnlockMutex(lock);
+}
+
+void InputLatency::noteAnswered(LatencyAction action, Uint64 receivedAt) {
+    SDL_LockMutex(lock);
+
+    //The oldest request of this kind that is on the wire and went out before the answer arrived
+    Sample* oldest = nullptr;
+    for (int i = 0; i < MAX_SAMPLES; i++) {
+        Sample& sample = samples[i];
+        if (sample.tag < 0 || sample.action != action || sample.at[LATENCY_WRITE] == 0 ||
+            sample.at[LATENCY_ACK] != 0 || sample.at[LATENCY_WRITE] > receivedAt) {
+            continue;
+        }
+        if (!oldest || sample.tag < oldest->tag) {
+            oldest = &sample;
+        }
+    }
+
+    if (oldest) {
+        oldest->at[LATENCY_ACK] = receivedAt;
+        oldest->at[LATENCY_APPLY] = SDL_GetPerformanceCounter();
+    }
+
+    SDL_UnlockMutex(lock);
+}
+
+void InputLatency::notePresent() {
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 timeout = static_cast<Uint64>(LATENCY_TIMEOUT_MS) * SDL_GetPerformanceFrequency() / 1000;
+
+    SDL_LockMutex(lock);
+
+    for (int i = 0; i < MAX_SAMPLES; i++) {
+        Sample& sample = samples[i];
+        if (sample.tag < 0 || sample.action == ACTION_NONE) {
+            continue;
+        }
+
+        const Uint64* at = sample.at;
+        if (!sample.predicted) {
+            spans[SPAN_PREDICTED].record(elapsed_us(at[LATENCY_EVENT], now));
+            sample.predicted = true;
+        }
+
+        if (at[LATENCY_APPLY] != 0) {
+            sample.at[LATENCY_PRESENT] = now;
+            spans[SPAN_DISPATCH].record(elapsed_us(at[LATENCY_EVENT], at[LATENCY_INPUT]));
+            spans[SPAN_HANDLE].record(elapsed_us(at[LATENCY_INPUT], at[LATENCY_ENQUEUE]));
+            spans[SPAN_QUEUE].record(elapsed_us(at[LATENCY_ENQUEUE], at[LATENCY_WRITE]));
+            spans[SPAN_SERVER].record(elapsed_us(at[LATENCY_WRITE], at[LATENCY_ACK]));
+            spans[SPAN_WAIT].record(elapsed_us(at[LATENCY_ACK], at[LATENCY_APPLY]));
+            spans[SPAN_FRAME].record(elapsed_us(at[LATENCY_APPLY], at[LATENCY_PRESENT]));
+            spans[SPAN_TOTAL].record(elapsed_us(at[LATENCY_EVENT], at[LATENCY_PRESENT]));
+            answered++;
+            release(sample);
+        }
+        else if (now - at[LATENCY_INPUT] > timeout) {
+            unanswered++;
+            release(sample);
+        }
+    }
+
+    SDL_UnlockMutex(lock);
+}
+
+void InputLatency::printStats() {
+    SDL_LockMutex(lock);
+
+    std::cout << "=== CLICK TO PHOTON (us) ===" << std::endl;
+    std::cout << tagged << " requests from clicks, " << answered << " answered and shown, " << unanswered
+        << " unanswered" << std::endl;
+
+    Uint64 total = spans[SPAN_TOTAL].mean();
+    for (int s = 0; s < SPANS; s++) {
+        const Histogram& h = spans[s];
+        std::cout << SPAN_NAMES[s] << ": " << h.count() << " samples";
+        if (h.count() > 0) {
+            std::cout << ", mean " << h.mean() << ", p50 <" << h.percentile(0.50) << ", p99 <" << h.percentile(0.99)
+                << ", max " << h.max();
+            if (s < SPAN_TOTAL && total > 0) {
+                std::cout << " (" << h.mean() * 100 / total << "% of total)";
+            }
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "============================" << std::endl;
+
+    SDL_UnlockMutex(lock);
+}
@@ -0,0 +1,113 @@
+#ifndef __INPUT_LATENCY_H__
+#define __INPUT_LATENCY_H__
+
+#include <string>
+
+#include "SDL.h"
+#include "Metrics.h"
+
+//Click-to-photon: every click that sends a request is tagged, and the tag follows it through
+//each stage until the frame that first shows the server's answer is presented.
+enum LatencyStage {
+    LATENCY_EVENT,      //SDL timestamp of the click, millisecond resolution
+    LATENCY_INPUT,      //MyGame::input starts handling it
+    LATENCY_ENQUEUE,    //request pushed to the outbound queue
+    LATENCY_WRITE,      //socket write returned on the send thread
+    LATENCY_ACK,        //server's answer received
+    LATENCY_APPLY,      //answer applied by processEvents
+    LATENCY_PRESENT,    //first SDL_RenderPresent after the apply
+    LATENCY_STAGES
+};
+
+//Requests a click can make and what the server answers each with
+enum LatencyAction {
+    ACTION_MOVE,        //MOVE -> PLAYER_POS for us
+    ACTION_JOIN,        //JOIN_ROOM -> JOINED_ROOM or ROOM_FULL
+    ACTION_BUILD,       //BUILD_* -> BUILDINGS
+    ACTION_RETREAT,     //RETREAT -> RETREAT for us
+    ACTION_KINDS,
+    ACTION_NONE = ACTION_KINDS
+};
+
+//The main thread tags and presents, the send thread reports writes. A fixed ring of samples,
+//so nothing is allocated per click. Samples not answered within LATENCY_TIMEOUT_MS (a MOVE
+//replaced in the queue by a newer one, a request lost to a reconnect) are counted and dropped.
+class InputLatency {
+
+public:
+    static const int MAX_SAMPLES = 32;
+    static const Uint32 LATENCY_TIMEOUT_MS = 5000;
+
+    //Time between consecutive stages, then the two end-to-end figures
+    enum Span {
+        SPAN_DISPATCH,      //event -> input
+        SPAN_HANDLE,        //input -> enqueue
+        SPAN_QUEUE,         //enqueue -> write
+        SPAN_SERVER,        //write -> ack, network both ways plus the server
+        SPAN_WAIT,          //ack -> apply, waiting for the next frame
+        SPAN_FRAME,         //apply -> present, update, render and present
+        SPAN_TOTAL,         //event -> present
+        SPAN_PREDICTED,     //event -> first present after the click, what client prediction shows
+        SPANS
+    };
+
+private:
+    struct Sample {
+        int tag;            //-1 while the slot is free
+        LatencyAction action;
+        bool predicted;
+        Uint64 at[LATENCY_STAGES];
+    };
+
+    SDL_mutex* lock;
+    Sample samples[MAX_SAMPLES];
+    int nextTag;
+    int openTag;            //click MyGame::input is handling, -1 outside it
+    Uint64 tagged;
+    Uint64 answered;
+    Uint64 unanswered;
+
+    //Published as input_latency_us{stage="..."}
+    Histogram spans[SPANS];
+
+    InputLatency(const InputLatency&);
+    InputLatency& operator=(const InputLatency&);
+
+    Sample* find(int tag);
+    void release(Sample& sample);
+
+public:
+    InputLatency();
+    ~InputLatency();
+
+    //Main thread, around MyGame::input handling a click
+    void beginInput(const SDL_Event& event);
+    void endInput();
+
+    //Main thread, from MyGame::send. Tags message with the click being handled, returns the tag or -1.
+    int noteEnqueued(const std::string& message);
+
+    //Send thread, once the tagged message is on the socket
+    void noteWritten(int tag);
+
+    //Main thread, applying the server's answer to action, received at receivedAt
+    void noteAnswered(LatencyAction action, Uint64 receivedAt);
+
+    //Main thread, right after SDL_RenderPresent
+    void notePresent();
+
+    void printStats();
+};
+
+//Brackets MyGame::input so only the click it handles gets the request's tag
+class InputLatencyScope {
+
+private:
+    InputLatency& latency;
+
+public:
+    InputLatencyScope(InputLatency& latency, const SDL_Event& event) : latency(latency) { latency.beginInput(event); }
+    ~InputLatencyScope() { latency.endInput(); }
+};
+
+#endif
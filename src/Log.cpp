@@ -0,0 +1,271 @@
+#include "Log.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static const int RING_SIZE = 1024;      //lines per thread, a power of two
+static const int LINE_LENGTH = 240;     //longer lines are cut short
+
+//Lines per second each thread may log per category, 0 for no limit. Errors always get through.
+static const int RATE_LIMITS[LOG_CATEGORIES] = {
+    100,    //LOG_NET
+    50,     //LOG_STATE
+    20,     //LOG_SYNC
+    0,      //LOG_GAME
+    0       //LOG_INPUT
+};
+
+static const char* LEVEL_NAMES[] = { "DEBUG", "INFO", "WARN", "ERROR", "OFF" };
+static const char* CATEGORY_NAMES[LOG_CATEGORIES] = { "net", "state", "sync", "game", "input" };
+
+struct LogLine {
+    Uint64 time;
+    LogLevel level;
+    LogCategory category;
+    int suppressed;     //lines of this category the thread dropped over its budget just before this one
+    char text[LINE_LENGTH];
+};
+
+//Single producer (the owning thread), single consumer (the writer). Counters only ever
+//grow, the slot is the counter modulo RING_SIZE.
+struct LogRing {
+    LogLine lines[RING_SIZE];
+    SDL_atomic_t written;
+    SDL_atomic_t read;
+    SDL_atomic_t dropped;
+    char name[16];
+
+    //Rate limiting, owning thread only
+    int tokens[LOG_CATEGORIES];
+    Uint32 refilledAt[LOG_CATEGORIES];
+    int suppressed[LOG_CATEGORIES];
+
+    int droppedReported;    //writer only
+    LogRing* next;
+};
+
+//Rings are never freed, a thread that exits may still have lines waiting
+static void* rings = nullptr;
+static SDL_atomic_t ringCount;
+static thread_local LogRing* threadRing = nullptr;
+
+static LogLevel runtimeLevel = LOG_LEVEL_INFO;
+
+static FILE* output = nullptr;
+static SDL_Thread* writer = nullptr;
+static SDL_atomic_t running;
+static Uint64 startTime = 0;
+
+static LogRing* ring_for_thread() {
+    if (threadRing) {
+        return threadRing;
+    }
+
+    LogRing* ring = new LogRing();
+    SDL_AtomicSet(&ring->written, 0);
+    SDL_AtomicSet(&ring->read, 0);
+    SDL_AtomicSet(&ring->dropped, 0);
+    snprintf(ring->name, sizeof(ring->name), "t%d", SDL_AtomicAdd(&ringCount, 1) + 1);
+
+    Uint32 now = SDL_GetTicks();
+    for (int c = 0; c < LOG_CATEGORIES; c++) {
+        ring->tokens[c] = RATE_LIMITS[c];
+        ring->refilledAt[c] = now;
+        ring->suppressed[c] = 0;
+    }
+    ring->droppedReported = 0;
+
+    //Push onto the list of rings, the writer only ever walks it
+    void* head;
+    do {
+        head = SDL_AtomicGetPtr(&rings);
+        ring->next = static_cast<LogRing*>(head);
+    } while (!SDL_AtomicCASPtr(&rings, head, ring));
+
+    threadRing = ring;
+    return ring;
+}
+
+//Token bucket per category, refilled at RATE_LIMITS per second up to one second's worth
+static bool take_token(LogRing* ring, LogCategory category) {
+    int limit = RATE_LIMITS[category];
+    if (limit == 0) {
+        return true;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    Uint32 elapsed = now - ring->refilledAt[category];
+    int refill = static_cast<int>(static_cast<Uint64>(elapsed) * limit / 1000);
+    if (refill > 0) {
+        ring->tokens[category] = ring->tokens[category] + refill > limit ? limit : ring->tokens[category] + refill;
+        ring->refilledAt[category] += static_cast<Uint32>(static_cast<Uint64>(refill) * 1000 / limit);
+    }
+
+    if (ring->tokens[category] == 0) {
+        return false;
+    }
+    ring->tokens[category]--;
+    return true;
+}
+
+void log_write(LogLevel level, LogCategory category, const char* format, ...) {
+    LogRing* ring = ring_for_thread();
+
+    if (level < LOG_LEVEL_ERROR && !take_token(ring, category)) {
+        ring->suppressed[category]++;
+        return;
+    }
+
+    unsigned written = static_cast<unsigned>(SDL_AtomicGet(&ring->written));
+    unsigned read = static_cast<unsigned>(SDL_AtomicGet(&ring->read));
+    if (written - read >= static_cast<unsigned>(RING_SIZE)) {
+        SDL_AtomicAdd(&ring->dropped, 1);
+        return;
+    }
+
+    LogLine& line = ring->lines[written & (RING_SIZE - 1)];
+    line.time = SDL_GetPerformanceCounter();
+    line.level = level;
+    line.category = category;
+    line.suppressed = ring->suppressed[category];
+    ring->suppressed[category] = 0;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line.text, sizeof(line.text), format, args);
+    va_end(args);
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->written, static_cast<int>(written + 1));
+}
+
+static void write_line(const LogRing* ring, const LogLine& line) {
+    double seconds = static_cast<double>(static_cast<long long>(line.time - startTime)) / SDL_GetPerformanceFrequency();
+    fprintf(output, "%10.3f %-5s %-5s %-4s %s", seconds, LEVEL_NAMES[line.level],
+        CATEGORY_NAMES[line.category], ring->name, line.text);
+    if (line.suppressed > 0) {
+        fprintf(output, " (+%d similar suppressed)", line.suppressed);
+    }
+    fputc('\n', output);
+}
+
+//Writes out everything logged so far, oldest first across all threads. False if there was nothing.
+static bool drain() {
+    bool any = false;
+
+    for (;;) {
+        LogRing* oldest = nullptr;
+        LogLine* next = nullptr;
+
+        for (LogRing* ring = static_cast<LogRing*>(SDL_AtomicGetPtr(&rings)); ring; ring = ring->next) {
+            unsigned read = static_cast<unsigned>(SDL_AtomicGet(&ring->read));
+            if (read == static_cast<unsigned>(SDL_AtomicGet(&ring->written))) {
+                continue;
+            }
+            SDL_MemoryBarrierAcquire();
+
+            LogLine* line = &ring->lines[read & (RING_SIZE - 1)];
+            if (!next || line->time < next->time) {
+                oldest = ring;
+                next = line;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        write_line(oldest, *next);
+        any = true;
+
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicAdd(&oldest->read, 1);
+    }
+
+    for (LogRing* ring = static_cast<LogRing*>(SDL_AtomicGetPtr(&rings)); ring; ring = ring->next) {
+        int dropped = SDL_AtomicGet(&ring->dropped);
+        if (dropped != ring->droppedReported) {
+            fprintf(output, "[log] %d lines from %s dropped, ring full\n", dropped - ring->droppedReported, ring->name);
+            ring->droppedReported = dropped;
+            any = true;
+        }
+    }
+
+    if (any) {
+        fflush(output);
+    }
+    return any;
+}
+
+static int writer_main(void*) {
+    while (SDL_AtomicGet(&running)) {
+        if (!drain()) {
+            SDL_Delay(2);
+        }
+    }
+    drain();
+    return 0;
+}
+
+bool log_start(const std::string& path) {
+    if (writer) {
+        return true;
+    }
+
+    output = stdout;
+    if (!path.empty()) {
+        output = fopen(path.c_str(), "w");
+        if (!output) {
+            output = stdout;
+            return false;
+        }
+    }
+
+    startTime = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&running, 1);
+    writer = SDL_CreateThread(writer_main, "LogWriterThread", nullptr);
+    return writer != nullptr;
+}
+
+void log_stop() {
+    if (!writer) {
+        return;
+    }
+
+    SDL_AtomicSet(&running, 0);
+    SDL_WaitThread(writer, nullptr);
+    writer = nullptr;
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    output = nullptr;
+}
+
+void log_set_level(LogLevel level) {
+    runtimeLevel = level;
+}
+
+bool log_parse_level(const std::string& name, LogLevel& level) {
+    for (int l = LOG_LEVEL_DEBUG; l <= LOG_LEVEL_OFF; l++) {
+        std::string levelName = LEVEL_NAMES[l];
+        for (size_t i = 0; i < levelName.size(); i++) {
+            levelName[i] = static_cast<char>(levelName[i] - 'A' + 'a');
+        }
+        if (name == levelName) {
+            level = static_cast<LogLevel>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool log_enabled(LogLevel level) {
+    return level >= runtimeLevel;
+}
+
+void log_thread_name(const char* name) {
+    LogRing* ring = ring_for_thread();
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
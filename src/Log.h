@@ -0,0 +1,77 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <string>
+
+#include "SDL.h"
+
+//Levelled logging that never touches the console on the calling thread.
+//
+//LOG_INFO(LOG_GAME, "Joined room %d", room) formats straight into a ring owned by the calling
+//thread; a background thread started by log_start merges the rings in time order and writes
+//them out, flushing once per batch. A full ring drops the line rather than block, so the
+//receive thread can never stall on stdout.
+//
+//Levels below LOG_COMPILED_LEVEL compile to nothing, arguments included. Above that,
+//log_set_level picks what is kept at runtime. Each category has a lines-per-second budget
+//per thread; lines over it are counted and the count is reported with the next line that
+//gets through.
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+enum LogCategory {
+    LOG_NET,        //traffic and connection handling
+    LOG_STATE,      //game state updates from the server
+    LOG_SYNC,       //reconciliation, desyncs, reconnect recovery
+    LOG_GAME,       //lobby, game and combat lifecycle
+    LOG_INPUT,      //what the player asked for
+    LOG_CATEGORIES
+};
+
+//Set with -DLOG_COMPILED_LEVEL=<n> (0 debug ... 4 off), release builds can strip debug lines entirely
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define LOG_PRINTF_FORMAT(fmt, args)
+#endif
+
+#define LOG_AT(level, category, ...) \
+    do { \
+        if ((level) >= LOG_COMPILED_LEVEL && log_enabled(level)) { \
+            log_write(level, category, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#define LOG_WARN(category, ...) LOG_AT(LOG_LEVEL_WARN, category, __VA_ARGS__)
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+
+//Starts the writer thread, output goes to path or stdout if it's empty. Until then lines
+//pile up in the rings and are dropped once they fill.
+bool log_start(const std::string& path = "");
+//Stops the writer after it has written everything already logged
+void log_stop();
+
+void log_set_level(LogLevel level);
+//"debug", "info", "warn", "error" or "off"
+bool log_parse_level(const std::string& name, LogLevel& level);
+bool log_enabled(LogLevel level);
+
+//Name shown for lines from the calling thread
+void log_thread_name(const char* name);
+
+//Use the LOG_* macros rather than calling this directly
+void log_write(LogLevel level, LogCategory category, const char* format, ...) LOG_PRINTF_FORMAT(3, 4);
+
+#endif
@@ -1,79 +1,289 @@
+#include <algorithm>
+
 #include "SDL_net.h"
 #include "MyGame.h"
+#include "Protocol.h"
+#include "Recorder.h"
+#include "Replay.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "AllocTracker.h"
 
 using namespace std;
 
 const char* IP_NAME = "localhost";
 const Uint16 PORT = 55555;
 
+//Reconnect backoff, first retry is immediate so a localhost blip recovers well under a second
+const Uint32 RECONNECT_BASE_DELAY_MS = 50;
+const Uint32 RECONNECT_MAX_DELAY_MS = 2000;
+//Longest a network thread goes without checking is_running, so shutdown can join it promptly
+const Uint32 SHUTDOWN_POLL_MS = 50;
+//Read size for the receive thread, messages longer than this arrive over several reads
+const int RECEIVE_CHUNK_BYTES = 4096;
+
 bool is_running = true;
 
 MyGame* game = nullptr;
 
-static int on_receive(void* socket_ptr) {
-    TCPsocket socket = (TCPsocket)socket_ptr;
+//--record <file> logs all traffic, --replay <file> plays a log back without a server
+Recorder recorder;
+string record_path;
+ReplayOptions replay_options;
+
+//--tick-rate <hz> sets the simulation step to the server's tick, 0 keeps the client default
+int tick_rate = 0;
+//--lockstep exchanges state hashes with the other clients to catch desyncs
+bool lockstep = false;
+//--log-level <level> and --log-file <file>, console output is written by a background thread
+LogLevel log_level = LOG_LEVEL_INFO;
+string log_path;
+//--metrics-file <file> exports metrics every --metrics-interval <s> seconds (default 10), F9 exports now
+string metrics_file;
+int metrics_interval = 10;
+//--trace <file> records a timeline of every thread and writes it as Chrome trace-event JSON at exit
+string trace_file;
+//--alloc-assert logs every steady PLAYING frame that allocates, --alloc-break stops in the debugger at the allocation
+AllocAssert alloc_assert = ALLOC_ASSERT_OFF;
+//--headless runs without a window on SDL's dummy video driver and draws into an off-screen surface,
+//--no-render skips drawing altogether. --frame-rate <hz> paces the loop (default 0, as fast as it
+//goes) and --duration <s> quits after that long, for soak and perf runs on machines with no display.
+bool headless = false;
+bool render_frames = true;
+int frame_rate = 0;
+int duration_s = 0;
+
+//A match is steady once it has been PLAYING this long, before that first-use allocations are expected
+const double STEADY_AFTER_S = 1.0;
+
+static Histogram frame_time("frame_time_us", "Time between the starts of consecutive frames");
+
+//Startup milestones, in milliseconds from the start of main
+Uint64 launch_time = 0;
+static Gauge startup_first_frame("startup_first_frame_ms", "Time from launch to the first frame on screen");
+static Gauge startup_connect("startup_connect_ms", "Time from launch to the first connection to the server");
+static Gauge startup_lobby("startup_lobby_ms", "Time from launch to the first frame showing the room list");
+
+IPaddress server_ip;
+//Set once SDLNet_ResolveHost has worked, after that only the socket is retried
+bool host_resolved = false;
+
+//First connection, made on its own thread while the main thread sets up the game.
+//The connect thread posts connect_done when it has finished trying, first_socket is null if it gave up.
+TCPsocket first_socket = nullptr;
+SDL_sem* connect_done = nullptr;
+
+//Current socket, swapped by the receive thread on reconnect and read by the send thread
+TCPsocket active_socket = nullptr;
+SDL_mutex* socket_lock = nullptr;
+
+static TCPsocket get_socket() {
+    SDL_LockMutex(socket_lock);
+    TCPsocket socket = active_socket;
+    SDL_UnlockMutex(socket_lock);
+    return socket;
+}
 
-    const int message_length = 1024;
+static void set_socket(TCPsocket socket) {
+    SDL_LockMutex(socket_lock);
+    active_socket = socket;
+    SDL_UnlockMutex(socket_lock);
+}
 
-    char message[message_length];
-    int received;
+static long long ms_since_launch() {
+    return static_cast<long long>(metrics_elapsed_us(launch_time) / 1000);
+}
+
+//Keeps trying until connected or the client quits. The host is resolved first if that hasn't
+//worked yet, so a client started before the network is up still gets in.
+static TCPsocket connect_with_retry(const char* tag) {
+    Uint32 delay = 0;
+    int attempt = 0;
 
-    do {
-        received = SDLNet_TCP_Recv(socket, message, message_length);
-        message[received] = '\0';
+    while (is_running) {
+        //In slices, so quitting doesn't wait out the backoff
+        for (Uint32 waited = 0; waited < delay && is_running; waited += SHUTDOWN_POLL_MS) {
+            SDL_Delay(min(SHUTDOWN_POLL_MS, delay - waited));
+        }
+        if (!is_running) {
+            break;
+        }
+
+        attempt++;
+        if (!host_resolved) {
+            host_resolved = SDLNet_ResolveHost(&server_ip, IP_NAME, PORT) == 0;
+        }
+        TCPsocket socket = host_resolved ? SDLNet_TCP_Open(&server_ip) : nullptr;
+
+        if (socket) {
+            LOG_INFO(LOG_NET, "[%s] Connected on attempt %d", tag, attempt);
+            return socket;
+        }
+
+        delay = (delay == 0) ? RECONNECT_BASE_DELAY_MS : min(delay * 2, RECONNECT_MAX_DELAY_MS);
+        LOG_WARN(LOG_NET, "[%s] Attempt %d failed: %s, retrying in %u ms", tag, attempt, SDLNet_GetError(), delay);
+    }
+
+    return nullptr;
+}
 
-        char* pch = strtok(message, ",");
+static int on_connect(void*) {
+    log_thread_name("connect");
+    trace_thread_name("connect");
 
-        string cmd(pch);
+    Uint64 start = trace_now();
+    first_socket = connect_with_retry("CONNECT");
+    trace_span("connect", "net", start);
+
+    if (first_socket) {
+        startup_connect.set(ms_since_launch());
+        LOG_INFO(LOG_NET, "[STARTUP] Connected %lld ms after launch", ms_since_launch());
+    }
+    SDL_SemPost(connect_done);
+    return 0;
+}
+
+//SDLNet_TCP_Recv blocks until the server sends something, and closing the socket from another
+//thread doesn't wake it on every platform. Waiting on the set in slices lets the thread see
+//is_running go false; returns 0 then, like a closed connection.
+static int receive(SDLNet_SocketSet socket_set, TCPsocket socket, char* data, int length) {
+    while (is_running) {
+        int ready = SDLNet_CheckSockets(socket_set, SHUTDOWN_POLL_MS);
+        if (ready < 0) {
+            return -1;
+        }
+        if (ready > 0) {
+            return SDLNet_TCP_Recv(socket, data, length);
+        }
+    }
+    return 0;
+}
+
+static int on_receive(void*) {
+    log_thread_name("recv");
+    trace_thread_name("recv");
+    ALLOC_SCOPE(ALLOC_NETWORK);
+
+    SDL_SemWait(connect_done);
+    TCPsocket socket = first_socket;
+    if (!socket) {
+        return 0;
+    }
+    set_socket(socket);
+    game->on_connected();
+
+    SDLNet_SocketSet socket_set = SDLNet_AllocSocketSet(1);
+    SDLNet_TCP_AddSocket(socket_set, socket);
+
+    char chunk[RECEIVE_CHUNK_BYTES];
+    int received;
+    MessageFramer framer;
+    size_t dropped = 0;
+    bool exiting = false;
 
-        vector<string> args;
+    string cmd;
+    vector<string> args;
 
-        while (pch != NULL) {
-            pch = strtok(NULL, ",");
+    while (is_running && !exiting) {
+        Uint64 waitStart = trace_now();
+        received = receive(socket_set, socket, chunk, sizeof(chunk));
+        Uint64 receiveStart = trace_span("recv wait", "thread", waitStart);
 
-            if (pch != NULL) {
-                args.push_back(string(pch));
+        if (received <= 0) {
+            if (!is_running) {
+                break;
             }
+
+            //Connection dropped, take the socket away from the send thread and try to get back in
+            set_socket(nullptr);
+            SDLNet_TCP_DelSocket(socket_set, socket);
+            SDLNet_TCP_Close(socket);
+            framer.reset();
+            game->on_disconnect();
+
+            Uint64 reconnectStart = trace_now();
+            socket = connect_with_retry("RECONNECT");
+            trace_span("reconnect", "net", reconnectStart);
+            if (!socket) {
+                break;
+            }
+
+            //RESUME has to be the first thing the server sees, so send it before the send thread gets the socket
+            string resume = game->on_reconnect();
+            if (!resume.empty()) {
+                LOG_DEBUG(LOG_NET, "Sending_TCP: %s", resume.c_str());
+                SDLNet_TCP_Send(socket, resume.c_str(), resume.length());
+                recorder.recordOutbound(resume);
+            }
+
+            SDLNet_TCP_AddSocket(socket_set, socket);
+            set_socket(socket);
+            continue;
         }
 
-        game->on_receive(cmd, args);
+        framer.feed(chunk, received);
 
-        if (cmd == "exit") {
-            break;
+        const char* message;
+        int length;
+        while (framer.next(message, length)) {
+            recorder.recordInbound(message, length);
+
+            if (!parse_message(message, length, cmd, args)) {
+                continue;
+            }
+
+            game->on_receive(cmd, args);
+            receiveStart = trace_span("receive", "net", receiveStart, cmd.c_str());
+
+            if (cmd == "exit") {
+                exiting = true;
+                break;
+            }
         }
 
-    } while (received > 0 && is_running);
+        if (framer.droppedMessages() != dropped) {
+            dropped = framer.droppedMessages();
+            LOG_WARN(LOG_NET, "Dropped a message over %d bytes, %d so far", static_cast<int>(MessageFramer::MAX_MESSAGE_BYTES),
+                static_cast<int>(dropped));
+        }
+    }
 
+    SDLNet_FreeSocketSet(socket_set);
     return 0;
 }
 
-static int on_send(void* socket_ptr) {
-    TCPsocket socket = (TCPsocket)socket_ptr;
+//Command a wire message carries: MOVE for "CLIENT_DATA,MOVE,1,...", JOIN_ROOM for "JOIN_ROOM,0"
+static string command_of(const string& wire) {
+    size_t start = wire.compare(0, 12, "CLIENT_DATA,") == 0 ? 12 : 0;
+    return wire.substr(start, wire.find(',', start) - start);
+}
+
+static int on_send(void*) {
+    OutboundMessage m;
+    log_thread_name("send");
+    trace_thread_name("send");
+    ALLOC_SCOPE(ALLOC_NETWORK);
 
     while (is_running) {
-        if (game->messages.size() > 0) {
-            for (auto m : game->messages) {
-                string message;
-
-                //Check if this is a special command that should be sent directly
-                if (m.substr(0, 9) == "JOIN_ROOM" ||
-                    m.substr(0, 18) == "PLAYER_CURRENT_POS" ||
-                    m.substr(0, 12) == "BUILD_CASTLE" ||
-                    m.substr(0, 15) == "BUILD_GOLD_MINE" ||
-                    m.substr(0, 14) == "BUILD_BARRACKS" ||
-                    m.substr(0, 7) == "RETREAT") {
-                    message = m;
-                }
-                else {
-                   
-                    message = "CLIENT_DATA," + m;
+        TCPsocket socket = get_socket();
+
+        //While reconnecting, hold on to queued messages until a socket is back
+        if (socket) {
+            //Highest priority lane first, so a RETREAT never waits behind bulk traffic
+            while (game->outbound.pop(m)) {
+                LOG_DEBUG(LOG_NET, "Sending_TCP: %s", m.wire.c_str());
+                Uint64 sendStart = trace_now();
+                if (SDLNet_TCP_Send(socket, m.wire.c_str(), m.wire.length()) < (int)m.wire.length()) {
+                    game->outbound.requeue(m);
+                    break;
                 }
-
-                cout << "Sending_TCP: " << message << endl;
-                SDLNet_TCP_Send(socket, message.c_str(), message.length());
+                game->latency.noteWritten(m.inputTag);
+                recorder.recordOutbound(m.wire);
+                string command = command_of(m.wire);
+                game->traffic.recordOutbound(command, m.wire);
+                trace_span("send", "net", sendStart, command.c_str());
             }
-
-            game->messages.clear();
         }
 
         SDL_Delay(1);
@@ -82,21 +292,50 @@ static int on_send(void* socket_ptr) {
     return 0;
 }
 
+static void sleep_until(Uint64 deadline) {
+    while (true) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= deadline) {
+            return;
+        }
+
+        double remainingMs = (deadline - now) * 1000.0 / SDL_GetPerformanceFrequency();
+        SDL_Delay(remainingMs > 2.0 ? static_cast<Uint32>(remainingMs - 1.0) : 0);
+    }
+}
+
+//renderer is null with --no-render, the frame is simulated but not drawn
 void loop(SDL_Renderer* renderer) {
     SDL_Event event;
 
-    Uint32 lastTime = SDL_GetTicks();
+    //Millisecond ticks are too coarse for the fixed step accumulator at high frame rates
+    Uint64 lastTime = SDL_GetPerformanceCounter();
+    double frequency = static_cast<double>(SDL_GetPerformanceFrequency());
+    Uint64 loopStart = lastTime;
+    Uint64 framePeriod = frame_rate > 0 ? SDL_GetPerformanceFrequency() / frame_rate : 0;
     float deltaTime = 0.0f;
+    double playingS = 0.0;
+    bool lobbyShown = false;
 
     while (is_running) {
-        Uint32 currentTime = SDL_GetTicks();
-        deltaTime = (currentTime - lastTime) / 1000.0f;
+        TRACE_SCOPE("frame", "frame");
+        Uint64 currentTime = SDL_GetPerformanceCounter();
+        deltaTime = static_cast<float>((currentTime - lastTime) / frequency);
+        frame_time.record(static_cast<Uint64>((currentTime - lastTime) * 1000000.0 / frequency));
         lastTime = currentTime;
 
+        playingS = game->isPlaying() ? playingS + deltaTime : 0.0;
+        alloc_frame_begin(playingS > STEADY_AFTER_S);
+
         if (deltaTime > 0.05f) {
             deltaTime = 0.05f;
         }
 
+        game->processEvents();
+        //After the pops, so it names exactly the messages this frame applied
+        recorder.recordDrain(game->appliedMessages());
+
+        Uint64 phase = trace_now();
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
                 switch (event.key.keysym.sym) {
@@ -104,12 +343,26 @@ void loop(SDL_Renderer* renderer) {
                     is_running = false;
                     break;
 
+                case SDLK_F9:
+                    if (!metrics_file.empty()) {
+                        metrics_write(metrics_file);
+                        LOG_INFO(LOG_GAME, "Metrics written to %s", metrics_file.c_str());
+                    }
+                    break;
+
+                case SDLK_F10:
+                    game->traffic.printStats();
+                    break;
+
                 default:
+                    recorder.recordKey(event.key.keysym.sym);
+                    game->input(event);
                     break;
                 }
             }
 
             if (event.type == SDL_MOUSEBUTTONDOWN) {
+                recorder.recordClick(event.button.x, event.button.y);
                 game->input(event);
             }
 
@@ -118,22 +371,45 @@ void loop(SDL_Renderer* renderer) {
             }
         }
 
-        SDL_SetRenderDrawColor(renderer, 20, 20, 30, 255);
-        SDL_RenderClear(renderer);
+        phase = trace_span("input", "frame", phase);
 
+        recorder.recordFrame(deltaTime);
         game->update(deltaTime);
+        phase = trace_span("update", "frame", phase);
 
-        game->render(renderer);
+        if (renderer) {
+            SDL_SetRenderDrawColor(renderer, 20, 20, 30, 255);
+            SDL_RenderClear(renderer);
+            game->render(renderer);
+            phase = trace_span("render", "frame", phase);
+
+            SDL_RenderPresent(renderer);
+            trace_span("present", "frame", phase);
+        }
+        game->latency.notePresent();
 
-        SDL_RenderPresent(renderer);
+        if (!lobbyShown && game->hasLobby()) {
+            lobbyShown = true;
+            startup_lobby.set(ms_since_launch());
+            LOG_INFO(LOG_GAME, "[STARTUP] Lobby on screen %lld ms after launch", ms_since_launch());
+        }
+
+        alloc_frame_end();
+
+        if (framePeriod > 0) {
+            sleep_until(currentTime + framePeriod);
+        }
+
+        if (duration_s > 0 && SDL_GetPerformanceCounter() - loopStart >= static_cast<Uint64>(duration_s) * SDL_GetPerformanceFrequency()) {
+            LOG_INFO(LOG_GAME, "Ran for %d s, stopping", duration_s);
+            is_running = false;
+        }
     }
 }
 
-int run_game() {
-    std::string windowTitle = "RTS Client - Lobby System";
-
-    SDL_Window* window = SDL_CreateWindow(
-        windowTitle.c_str(),
+static bool open_window(SDL_Window*& window, SDL_Renderer*& renderer) {
+    window = SDL_CreateWindow(
+        "RTS Client - Lobby System",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
         800, 600,
         SDL_WINDOW_SHOWN
@@ -141,67 +417,271 @@ int run_game() {
 
     if (nullptr == window) {
         std::cout << "Failed to create window" << SDL_GetError() << std::endl;
-        return -1;
+        return false;
     }
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 
     if (nullptr == renderer) {
         std::cout << "Failed to create renderer" << SDL_GetError() << std::endl;
-        return -1;
+        SDL_DestroyWindow(window);
+        return false;
     }
 
-    loop(renderer);
+    return true;
+}
 
-    return 0;
+//The window, or with --headless the off-screen surface standing in for it (nothing with --no-render)
+static bool create_window(SDL_Window*& window, SDL_Surface*& offscreen, SDL_Renderer*& renderer) {
+    if (headless) {
+        if (!render_frames) {
+            return true;
+        }
+
+        //Same size as the window, SDL's software renderer draws into it as it would the screen
+        offscreen = SDL_CreateRGBSurfaceWithFormat(0, 800, 600, 32, SDL_PIXELFORMAT_ARGB8888);
+        renderer = offscreen ? SDL_CreateSoftwareRenderer(offscreen) : nullptr;
+
+        if (nullptr == renderer) {
+            std::cout << "Failed to create off-screen renderer" << SDL_GetError() << std::endl;
+            if (offscreen) {
+                SDL_FreeSurface(offscreen);
+                offscreen = nullptr;
+            }
+            return false;
+        }
+    }
+    else if (!open_window(window, renderer)) {
+        return false;
+    }
+
+    //The background the game draws on, up before anything slow starts
+    SDL_SetRenderDrawColor(renderer, 20, 20, 30, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderPresent(renderer);
+
+    startup_first_frame.set(ms_since_launch());
+    LOG_INFO(LOG_GAME, "[STARTUP] First frame %lld ms after launch", ms_since_launch());
+    return true;
+}
+
+static void parse_options(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            replay_options.path = argv[++i];
+        }
+        else if (arg == "--replay-fast") {
+            replay_options.realtime = false;
+        }
+        else if (arg == "--tick-rate" && i + 1 < argc) {
+            tick_rate = atoi(argv[++i]);
+        }
+        else if (arg == "--lockstep") {
+            lockstep = true;
+        }
+        else if (arg == "--log-level" && i + 1 < argc) {
+            if (!log_parse_level(argv[++i], log_level)) {
+                cout << "Unknown log level: " << argv[i] << endl;
+            }
+        }
+        else if (arg == "--log-file" && i + 1 < argc) {
+            log_path = argv[++i];
+        }
+        else if (arg == "--metrics-file" && i + 1 < argc) {
+            metrics_file = argv[++i];
+        }
+        else if (arg == "--metrics-interval" && i + 1 < argc) {
+            metrics_interval = atoi(argv[++i]);
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+        }
+        else if (arg == "--alloc-assert") {
+            alloc_assert = ALLOC_ASSERT_LOG;
+        }
+        else if (arg == "--alloc-break") {
+            alloc_assert = ALLOC_ASSERT_BREAK;
+        }
+        else if (arg == "--headless") {
+            headless = true;
+        }
+        else if (arg == "--no-render") {
+            headless = true;
+            render_frames = false;
+        }
+        else if (arg == "--frame-rate" && i + 1 < argc) {
+            frame_rate = atoi(argv[++i]);
+        }
+        else if (arg == "--duration" && i + 1 < argc) {
+            duration_s = atoi(argv[++i]);
+        }
+        else {
+            cout << "Unknown option: " << arg << endl;
+        }
+    }
+}
+
+static void finish_trace() {
+    if (!trace_file.empty() && !trace_stop(trace_file)) {
+        LOG_ERROR(LOG_GAME, "Failed to write trace %s", trace_file.c_str());
+    }
+}
+
+//Flushes what the background threads hold, last thing before returning from main
+static void stop_services() {
+    finish_trace();
+    metrics_stop();
+    log_stop();
 }
 
 int main(int argc, char** argv) {
+    launch_time = SDL_GetPerformanceCounter();
+
+    parse_options(argc, argv);
+
+    log_set_level(log_level);
+    if (!log_start(log_path)) {
+        cout << "Failed to open log file " << log_path << ", logging to the console" << endl;
+    }
+    log_thread_name("main");
+    alloc_set_assert(alloc_assert);
+
+    if (!trace_file.empty()) {
+        trace_start();
+        trace_thread_name("main");
+    }
+
+    if (!metrics_file.empty()) {
+        metrics_start(metrics_file, metrics_interval);
+    }
 
     std::cout << "==================================" << std::endl;
     std::cout << "Starting RTS Client - Lobby System" << std::endl;
     std::cout << "==================================" << std::endl;
 
+    //The dummy driver gives video, events and timers with no window system, so SDL_Init works without a display
+    if (headless) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) == -1) {
         printf("SDL_Init: %s\n", SDL_GetError());
-        exit(1);
+        stop_services();
+        return 1;
     }
 
     if (SDLNet_Init() == -1) {
         printf("SDLNet_Init: %s\n", SDLNet_GetError());
-        exit(2);
+        SDL_Quit();
+        stop_services();
+        return 2;
+    }
+
+    SDL_Window* window = nullptr;
+    SDL_Surface* offscreen = nullptr;
+    SDL_Renderer* renderer = nullptr;
+
+    if (!create_window(window, offscreen, renderer)) {
+        SDLNet_Quit();
+        SDL_Quit();
+        stop_services();
+        return 3;
+    }
+
+    bool online = replay_options.path.empty();
+
+    //Resolving and connecting can take seconds on a bad network, they run alongside the game setup
+    SDL_Thread* connect_thread = nullptr;
+    SDL_Thread* receive_thread = nullptr;
+    SDL_Thread* send_thread = nullptr;
+    if (online) {
+        socket_lock = SDL_CreateMutex();
+        connect_done = SDL_CreateSemaphore(0);
+        connect_thread = SDL_CreateThread(on_connect, "ConnectThread", nullptr);
     }
 
+    Uint64 setupStart = trace_now();
     game = new MyGame(1);  // Player number will be assigned by server
 
+    game->setTickRate(tick_rate);
+    game->setLockstep(lockstep);
     game->initialize();
+    trace_span("game setup", "startup", setupStart);
 
-    IPaddress ip;
+    if (online) {
+        if (!record_path.empty()) {
+            if (recorder.open(record_path)) {
+                cout << "Recording session to " << record_path << endl;
+            }
+            else {
+                cout << "Failed to open recording " << record_path << endl;
+            }
+        }
 
-    if (SDLNet_ResolveHost(&ip, IP_NAME, PORT) == -1) {
-        printf("SDLNet_ResolveHost: %s\n", SDLNet_GetError());
-        exit(3);
-    }
+        //Shows the connecting screen until the receive thread has a socket
+        game->on_connecting();
 
-    TCPsocket socket = SDLNet_TCP_Open(&ip);
+        receive_thread = SDL_CreateThread(on_receive, "ConnectionReceiveThread", nullptr);
+        send_thread = SDL_CreateThread(on_send, "ConnectionSendThread", nullptr);
 
-    if (!socket) {
-        printf("SDLNet_TCP_Open: %s\n", SDLNet_GetError());
-        exit(4);
+        loop(renderer);
+
+        //Every network thread checks is_running at least every SHUTDOWN_POLL_MS, so none of them
+        //touches the game, the socket or the recorder once they're joined
+        is_running = false;
+        SDL_WaitThread(connect_thread, nullptr);
+        SDL_WaitThread(receive_thread, nullptr);
+        SDL_WaitThread(send_thread, nullptr);
+    }
+    else {
+        ReplayStats stats;
+        if (run_replay(*game, replay_options, renderer, stats)) {
+            print_replay_stats(stats);
+        }
     }
 
-    SDL_CreateThread(on_receive, "ConnectionReceiveThread", (void*)socket);
-    SDL_CreateThread(on_send, "ConnectionSendThread", (void*)socket);
+    stop_services();
 
-    run_game();
+    if (online) {
+        game->outbound.printStats();
+        game->inbound.printStats();
+        game->traffic.printStats();
+        game->latency.printStats();
+        game->getHistory().printStats();
+        alloc_print_stats();
+    }
+    else {
+        //What the recorded server sent, the replay sends nothing
+        game->traffic.printStats();
+    }
 
     delete game;
 
-    SDLNet_TCP_Close(socket);
+    if (online) {
+        SDLNet_TCP_Close(get_socket());
+        recorder.close();
+        SDL_DestroySemaphore(connect_done);
+        SDL_DestroyMutex(socket_lock);
+    }
+
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (offscreen) {
+        SDL_FreeSurface(offscreen);
+    }
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
 
     SDLNet_Quit();
 
     SDL_Quit();
 
     return 0;
-}
\ No newline at end of file
+}
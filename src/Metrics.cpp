@@ -0,0 +1,281 @@
+#include "Metrics.h"
+
+#include <vector>
+
+//Every published metric. Updates never take the lock, only publishing, unpublishing and export do.
+class MetricsRegistry {
+
+private:
+    SDL_mutex* lock;
+    std::vector<Metric*> metrics;
+
+public:
+    MetricsRegistry() : lock(SDL_CreateMutex()) {}
+
+    void add(Metric* metric) {
+        SDL_LockMutex(lock);
+        metrics.push_back(metric);
+        SDL_UnlockMutex(lock);
+    }
+
+    void remove(Metric* metric) {
+        SDL_LockMutex(lock);
+        for (size_t i = 0; i < metrics.size(); i++) {
+            if (metrics[i] == metric) {
+                metrics.erase(metrics.begin() + i);
+                break;
+            }
+        }
+        SDL_UnlockMutex(lock);
+    }
+
+    //Grouped by name, each name's HELP and TYPE once ahead of all its label sets
+    void write(FILE* out) {
+        SDL_LockMutex(lock);
+        std::vector<bool> written(metrics.size(), false);
+        for (size_t i = 0; i < metrics.size(); i++) {
+            if (written[i]) {
+                continue;
+            }
+            fprintf(out, "# HELP %s %s\n", metrics[i]->name().c_str(), metrics[i]->help().c_str());
+            fprintf(out, "# TYPE %s %s\n", metrics[i]->name().c_str(), metrics[i]->type());
+            for (size_t j = i; j < metrics.size(); j++) {
+                if (!written[j] && metrics[j]->name() == metrics[i]->name()) {
+                    metrics[j]->write(out);
+                    written[j] = true;
+                }
+            }
+        }
+        SDL_UnlockMutex(lock);
+    }
+};
+
+//Built on first use, so metrics in other files' statics can publish during static init
+static MetricsRegistry& registry() {
+    static MetricsRegistry instance;
+    return instance;
+}
+
+Metric::Metric() : published(false) {
+}
+
+Metric::~Metric() {
+    if (published) {
+        registry().remove(this);
+    }
+}
+
+void Metric::publish(const std::string& name, const std::string& help, const std::string& labels) {
+    metricName = name;
+    metricHelp = help;
+    metricLabels = labels;
+    if (!published) {
+        published = true;
+        registry().add(this);
+    }
+}
+
+//name{labels}, with extra appended inside the braces
+static void write_series(FILE* out, const Metric& metric, const char* suffix, const std::string& extra) {
+    std::string labels = metric.labels();
+    if (!extra.empty()) {
+        labels += labels.empty() ? extra : "," + extra;
+    }
+
+    if (labels.empty()) {
+        fprintf(out, "%s%s ", metric.name().c_str(), suffix);
+    }
+    else {
+        fprintf(out, "%s%s{%s} ", metric.name().c_str(), suffix, labels.c_str());
+    }
+}
+
+void Counter::write(FILE* out) const {
+    write_series(out, *this, "", "");
+    fprintf(out, "%llu\n", static_cast<unsigned long long>(get()));
+}
+
+void Gauge::write(FILE* out) const {
+    write_series(out, *this, "", "");
+    fprintf(out, "%lld\n", get());
+}
+
+Histogram::Histogram() {
+    reset();
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, const std::string& labels) {
+    reset();
+    publish(name, help, labels);
+}
+
+void Histogram::reset() {
+    for (int i = 0; i < BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sumValue.store(0, std::memory_order_relaxed);
+    maxValue.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::bucketOf(Uint64 value) {
+    if (value < static_cast<Uint64>(SUB_BUCKETS)) {
+        return static_cast<int>(value);
+    }
+
+    int exponent = SUB_BITS;
+    while (exponent < 63 && (value >> (exponent + 1)) != 0) {
+        exponent++;
+    }
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+
+    int sub = static_cast<int>(value >> (exponent - SUB_BITS)) - SUB_BUCKETS;
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+Uint64 Histogram::bucketLow(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return static_cast<Uint64>(bucket);
+    }
+    int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    int sub = bucket % SUB_BUCKETS;
+    return static_cast<Uint64>(SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+}
+
+Uint64 Histogram::bucketHigh(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return static_cast<Uint64>(bucket) + 1;
+    }
+    int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    return bucketLow(bucket) + (static_cast<Uint64>(1) << (exponent - SUB_BITS));
+}
+
+void Histogram::record(Uint64 value) {
+    buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sumValue.fetch_add(value, std::memory_order_relaxed);
+
+    Uint64 seen = maxValue.load(std::memory_order_relaxed);
+    while (value > seen && !maxValue.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+Uint64 Histogram::mean() const {
+    Uint64 n = count();
+    return n ? sum() / n : 0;
+}
+
+Uint64 Histogram::percentile(double p) const {
+    Uint64 n = count();
+    if (n == 0) {
+        return 0;
+    }
+
+    Uint64 target = static_cast<Uint64>(p * n);
+    Uint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > target) {
+            return bucketHigh(i);
+        }
+    }
+    return max() + 1;
+}
+
+//Cumulative buckets at le = 2^k - 1, which fall on bucket edges, up to the one holding the max
+void Histogram::write(FILE* out) const {
+    Uint64 cumulative = 0;
+    int bucket = 0;
+    Uint64 top = max();
+
+    for (int k = 0; k <= MAX_EXPONENT + 1; k++) {
+        Uint64 edge = static_cast<Uint64>(1) << k;
+        while (bucket < BUCKETS && bucketHigh(bucket) <= edge) {
+            cumulative += buckets[bucket].load(std::memory_order_relaxed);
+            bucket++;
+        }
+
+        write_series(out, *this, "_bucket", "le=\"" + std::to_string(edge - 1) + "\"");
+        fprintf(out, "%llu\n", static_cast<unsigned long long>(cumulative));
+
+        if (edge > top) {
+            break;
+        }
+    }
+
+    write_series(out, *this, "_bucket", "le=\"+Inf\"");
+    fprintf(out, "%llu\n", static_cast<unsigned long long>(count()));
+    write_series(out, *this, "_sum", "");
+    fprintf(out, "%llu\n", static_cast<unsigned long long>(sum()));
+    write_series(out, *this, "_count", "");
+    fprintf(out, "%llu\n", static_cast<unsigned long long>(count()));
+}
+
+bool metrics_write(const std::string& path) {
+    std::string temporary = path + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    registry().write(out);
+    fclose(out);
+
+    //Windows won't rename over an existing file
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        return rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    return true;
+}
+
+static std::string exportPath;
+static int exportIntervalMs = 0;
+static SDL_Thread* exporter = nullptr;
+static SDL_atomic_t exporting;
+
+static int exporter_main(void*) {
+    Uint32 lastWrite = SDL_GetTicks();
+    while (SDL_AtomicGet(&exporting)) {
+        SDL_Delay(50);
+        if (SDL_GetTicks() - lastWrite >= static_cast<Uint32>(exportIntervalMs)) {
+            metrics_write(exportPath);
+            lastWrite = SDL_GetTicks();
+        }
+    }
+    return 0;
+}
+
+bool metrics_start(const std::string& path, int intervalSeconds) {
+    if (exporter || path.empty()) {
+        return false;
+    }
+
+    exportPath = path;
+    exportIntervalMs = (intervalSeconds > 0 ? intervalSeconds : 10) * 1000;
+    SDL_AtomicSet(&exporting, 1);
+    exporter = SDL_CreateThread(exporter_main, "MetricsExportThread", nullptr);
+    return exporter != nullptr;
+}
+
+void metrics_stop() {
+    if (!exporter) {
+        return;
+    }
+
+    SDL_AtomicSet(&exporting, 0);
+    SDL_WaitThread(exporter, nullptr);
+    exporter = nullptr;
+    metrics_write(exportPath);
+}
+
+const std::string& metrics_path() {
+    return exportPath;
+}
+
+Uint64 metrics_elapsed_us(Uint64 since) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    return now > since ? (now - since) * 1000000 / SDL_GetPerformanceFrequency() : 0;
+}
@@ -0,0 +1,134 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+
+#include "SDL.h"
+
+//Counters, gauges and histograms any thread can update with a relaxed atomic, and a registry
+//that writes every published metric to a file in the Prometheus text format for the
+//playtest dashboards to scrape.
+//
+//Metrics are plain objects owned by whatever updates them. publish() (or the naming
+//constructor) adds one to the export as name{labels}, the destructor takes it out again.
+
+class Metric {
+
+private:
+    std::string metricName;
+    std::string metricHelp;
+    std::string metricLabels;
+    bool published;
+
+    Metric(const Metric&);
+    Metric& operator=(const Metric&);
+
+protected:
+    Metric();
+
+public:
+    virtual ~Metric();
+
+    //labels are already formatted, e.g. priority="critical"
+    void publish(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    const std::string& name() const { return metricName; }
+    const std::string& help() const { return metricHelp; }
+    const std::string& labels() const { return metricLabels; }
+
+    virtual const char* type() const = 0;
+    virtual void write(FILE* out) const = 0;
+};
+
+class Counter : public Metric {
+
+private:
+    std::atomic<Uint64> value;
+
+public:
+    Counter() : value(0) {}
+    Counter(const std::string& name, const std::string& help, const std::string& labels = "") : value(0) {
+        publish(name, help, labels);
+    }
+
+    void add(Uint64 n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    Uint64 get() const { return value.load(std::memory_order_relaxed); }
+
+    const char* type() const { return "counter"; }
+    void write(FILE* out) const;
+};
+
+class Gauge : public Metric {
+
+private:
+    std::atomic<long long> value;
+
+public:
+    Gauge() : value(0) {}
+    Gauge(const std::string& name, const std::string& help, const std::string& labels = "") : value(0) {
+        publish(name, help, labels);
+    }
+
+    void set(long long v) { value.store(v, std::memory_order_relaxed); }
+    void add(long long n) { value.fetch_add(n, std::memory_order_relaxed); }
+    long long get() const { return value.load(std::memory_order_relaxed); }
+
+    const char* type() const { return "gauge"; }
+    void write(FILE* out) const;
+};
+
+//HDR-style: values below 16 get a bucket each, above that every power of two is split into
+//16 linear buckets, so any recorded value is known to within 1/16 (6%) up to 2^40.
+class Histogram : public Metric {
+
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXPONENT = 40;
+    static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+private:
+    std::atomic<Uint64> buckets[BUCKETS];
+    std::atomic<Uint64> total;
+    std::atomic<Uint64> sumValue;
+    std::atomic<Uint64> maxValue;
+
+    void reset();
+
+public:
+    Histogram();
+    Histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    void record(Uint64 value);
+
+    Uint64 count() const { return total.load(std::memory_order_relaxed); }
+    Uint64 sum() const { return sumValue.load(std::memory_order_relaxed); }
+    Uint64 max() const { return maxValue.load(std::memory_order_relaxed); }
+    Uint64 mean() const;
+    //Upper bound (exclusive) of the bucket holding the p-th percentile, p from 0 to 1
+    Uint64 percentile(double p) const;
+
+    static int bucketOf(Uint64 value);
+    static Uint64 bucketLow(int bucket);
+    static Uint64 bucketHigh(int bucket);
+
+    const char* type() const { return "histogram"; }
+    void write(FILE* out) const;
+};
+
+//Write every published metric to path, through a temporary file so a scraper never sees half of it
+bool metrics_write(const std::string& path);
+
+//Also write them every intervalSeconds from a background thread, and once more on metrics_stop
+bool metrics_start(const std::string& path, int intervalSeconds);
+void metrics_stop();
+
+//Path metrics_start was given, empty if metrics aren't being exported
+const std::string& metrics_path();
+
+//Microseconds since a performance counter reading
+Uint64 metrics_elapsed_us(Uint64 since);
+
+#endif
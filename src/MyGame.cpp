@@ -2,473 +2,688 @@
 
 GameData game_data;
 
-Site::Site(int x, int y) : center(x, y), hasCastle(false), hasGoldMine(false), hasBarracks(false) {
-    neutralColor = {
-        static_cast<Uint8>(100 + (x % 155)),
-        static_cast<Uint8>(100 + (y % 155)),
-        static_cast<Uint8>(100 + ((x + y) % 155)),
-        255
-    };
+//Process-wide metrics, exported with everything else published (see Metrics.h)
+static Histogram parse_time("message_parse_us", "Time to decode a server message on the receive thread");
+static Histogram request_rtt("request_rtt_us", "Time from queueing JOIN_ROOM, BUILD_* or RETREAT to the server's answer");
+static Histogram corrections("reconciliation_correction_px", "Distance a player snapped when the server corrected it");
+static Histogram recovery_time("reconnect_recovery_ms", "Time from losing the connection to being resynced");
+static Counter desync_total("lockstep_desyncs_total", "State hash mismatches with other lockstep clients");
+static Gauge inbound_depth("inbound_queue_depth", "Server messages waiting to be applied at the start of the frame");
+static Gauge outbound_size("outbound_queue_size", "Messages waiting to be sent at the start of the frame");
+static Gauge sim_tick("simulation_tick", "Simulation ticks since the game started");
+
+//Colours per player number: the marker, the ring on owned sites, the territory fill and the
+//score panel. Players 1 and 2 keep the blue and red from the two player game.
+struct PlayerColors {
+    SDL_Color body, ring, territory, panel;
+};
+
+static const PlayerColors PLAYER_COLORS[MAX_PLAYERS] = {
+    { { 0, 100, 255, 255 },  { 0, 0, 255, 255 },     { 100, 100, 255, 180 }, { 50, 50, 150, 255 } },
+    { { 255, 50, 50, 255 },  { 255, 0, 0, 255 },     { 255, 100, 100, 180 }, { 150, 50, 50, 255 } },
+    { { 40, 180, 60, 255 },  { 0, 160, 0, 255 },     { 100, 220, 100, 180 }, { 40, 120, 40, 255 } },
+    { { 240, 200, 0, 255 },  { 220, 180, 0, 255 },   { 250, 230, 100, 180 }, { 140, 120, 20, 255 } },
+    { { 160, 60, 220, 255 }, { 130, 0, 200, 255 },   { 190, 120, 240, 180 }, { 90, 40, 130, 255 } },
+    { { 255, 140, 0, 255 },  { 230, 110, 0, 255 },   { 255, 180, 100, 180 }, { 150, 80, 20, 255 } },
+    { { 0, 200, 200, 255 },  { 0, 170, 170, 255 },   { 100, 230, 230, 180 }, { 20, 110, 110, 255 } },
+    { { 240, 80, 180, 255 }, { 220, 0, 150, 255 },   { 250, 140, 210, 180 }, { 140, 40, 100, 255 } }
+};
+
+static void setDrawColor(SDL_Renderer* renderer, const SDL_Color& color) {
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
 }
 
-float MyGame::distance(int x1, int y1, int x2, int y2) {
-    int dx = x2 - x1;
-    int dy = y2 - y1;
-    return std::sqrt(dx * dx + dy * dy);
+//The grid is rebuilt lazily on the main thread the first time it is used after SITE_POSITIONS
+const SpatialIndex& MyGame::siteIndex() {
+    if (siteGridVersion != game_data.siteVersion) {
+        siteGrid.build(game_data.sites);
+        siteGridVersion = game_data.siteVersion;
+    }
+    return siteGrid;
 }
 
 int MyGame::findClosestSite(int x, int y) {
-    if (game_data.sites.size() != 8) {
-        return 0;
-    }
-
-    int closest = 0;
-    float minDist = std::numeric_limits<float>::max();
-
-    for (int i = 0; i < 8; i++) {
-        float dist = distance(x, y, game_data.sites[i].center.x, game_data.sites[i].center.y);
-        if (dist < minDist) {
-            minDist = dist;
-            closest = i;
-        }
-    }
-
-    return closest;
+    return siteIndex().nearest(x, y);
 }
 
 SDL_Color MyGame::getSiteColor(int siteIndex) {
-    if (game_data.isPlayer1Owner(siteIndex)) {
-        return { 100, 100, 255, 180 };
-    }
-    else if (game_data.isPlayer2Owner(siteIndex)) {
-        return { 255, 100, 100, 180 };
+    int owner = game_data.ownerOf(siteIndex);
+    if (owner > 0) {
+        return PLAYER_COLORS[owner - 1].territory;
     }
     else {
-        SDL_Color neutralColor = game_data.sites[siteIndex].neutralColor;
+        SDL_Color neutralColor = game_data.sites.neutralColor[siteIndex];
         neutralColor.a = 180;
         return neutralColor;
     }
 }
 
 void MyGame::initialize() {
-    deltaTime = 0.016f;
+    accumulatorUs = 0;
+    interpolation = 0.0f;
     gameState = LOBBY;
     selectedRoom = -1;
 
-    std::cout << "========================================" << std::endl;
-    std::cout << "CLIENT INITIALIZATION" << std::endl;
-    std::cout << "This client is Player: " << myPlayerNumber << std::endl;
-    std::cout << "========================================" << std::endl;
+    LOG_INFO(LOG_GAME, "========================================");
+    LOG_INFO(LOG_GAME, "CLIENT INITIALIZATION");
+    LOG_INFO(LOG_GAME, "This client is Player: %d", myPlayerNumber);
+    LOG_INFO(LOG_GAME, "========================================");
 
     game_data.sites.clear();
-    game_data.player1Ownership = 0;
-    game_data.player2Ownership = 0;
-
-    game_data.player1Gold = 0;
-    game_data.player1Levies = 0;
-    game_data.player2Gold = 0;
-    game_data.player2Levies = 0;
+    game_data.siteVersion++;
+    game_data.fitBitsetsToSites();
+    game_data.playerCount = 2;
+
+    game_data.castles.clear();
+    game_data.goldMines.clear();
+    game_data.barracks.clear();
+
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        game_data.ownership[i].clear();
+        game_data.scores[i] = 0;
+        game_data.gold[i] = 0;
+        game_data.levies[i] = 0;
+        game_data.players[i] = Player(i + 1);
+        game_data.players[i].placeAt(Point(0, 0));
+        game_data.players[i].targetPosition = Point(0, 0);
+    }
 
     game_data.inCombat = false;
     game_data.combatSite = -1;
-    game_data.combatTimer = 0.0f;
+    game_data.combatTimeUs = 0;
     game_data.canRetreat = false;
 
-    game_data.player1.position = Point(0, 0);
-    game_data.player1.targetPosition = Point(0, 0);
-    game_data.player2.position = Point(0, 0);
-    game_data.player2.targetPosition = Point(0, 0);
-
     game_data.gameOver = false;
     game_data.winner = 0;
 
-    std::cout << "Waiting for lobby information from server......" << std::endl;
+    game_data.tick = 0;
+    for (int i = 0; i < HASH_HISTORY; i++) {
+        hashTicks[i] = 0;
+        hashes[i] = 0;
+    }
+
+    resetHistory();
+
+    for (int i = 0; i < REQUEST_KINDS; i++) {
+        requestSentAt[i] = 0;
+    }
+
+    LOG_INFO(LOG_GAME, "Waiting for lobby information from server......");
 }
 
 
-void MyGame::on_receive(std::string cmd, std::vector<std::string>& args) {
-    std::cout << "CLIENT RECEIVED: " << cmd << " with " << args.size() << " args" << std::endl;
-
-    if (cmd == "LOBBY_INFO") {
-        if (args.size() == 3) {
-            roomPlayerCounts[0] = stoi(args.at(0));
-            roomPlayerCounts[1] = stoi(args.at(1));
-            roomPlayerCounts[2] = stoi(args.at(2));
-            std::cout << "=== Received Lobby Info ===" << std::endl;
-            std::cout << "Room 1: " << roomPlayerCounts[0] << "/2 players" << std::endl;
-            std::cout << "Room 2: " << roomPlayerCounts[1] << "/2 players" << std::endl;
-            std::cout << "Room 3: " << roomPlayerCounts[2] << "/2 players" << std::endl;
-        }
+//Copies a decoded per-site bitset into target sized to the current map, in target's own storage
+static void fitToSites(SiteBitset& target, const SiteBitset& decoded) {
+    target = decoded;
+    if (!game_data.sites.empty()) {
+        target.resize(static_cast<int>(game_data.sites.size()));
     }
-    else if (cmd == "JOINED_ROOM") {
-        if (args.size() >= 2) {
-            int roomIndex = stoi(args.at(0));
-            myPlayerNumber = stoi(args.at(1));
-            gameState = WAITING;
-            std::cout << "=== Joined Room " << (roomIndex + 1) << " as Player " << myPlayerNumber << " ===" << std::endl;
-            std::cout << "Game state set to WAITING" << std::endl;
-            std::cout << "Waiting for opponent..." << std::endl;
-        }
+}
+
+//COMBAT_STATE flags: bit 3 in combat, bit 4 can retreat. The site is an explicit argument
+//when the server sends one (maps bigger than 8 sites), otherwise it is packed in bits 0-2.
+static void applyCombatState(int flags, int siteArg) {
+    game_data.inCombat = (flags & (1 << 3)) != 0;
+    if (game_data.inCombat) {
+        game_data.combatSite = siteArg >= 0 ? siteArg : (flags & 0x07);
+        game_data.canRetreat = (flags & (1 << 4)) != 0;
     }
-    else if (cmd == "ROOM_FULL") {
-        if (args.size() >= 1) {
-            int roomIndex = stoi(args.at(0));
-            std::cout << "Room " << (roomIndex + 1) << " is full!" << std::endl;
-            gameState = LOBBY;
-        }
+    else {
+        game_data.combatSite = -1;
+        game_data.canRetreat = false;
     }
-    else if (cmd == "GAME_START") {
-        gameState = PLAYING;
-        std::cout << "=== GAME STARTING ===" << std::endl;
-        std::cout << "Game state set to PLAYING" << std::endl;
+}
+
+//Moving and capturing masks have bit i set for player i + 1
+static void applyPlayerStates(int moving, int capturing, int inCombat) {
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        game_data.players[i].isMoving = (moving & (1 << i)) != 0;
+        game_data.players[i].isCapturing = (capturing & (1 << i)) != 0;
+    }
+    game_data.inCombat = inCombat != 0;
+}
+
+static void applyOwnership(const InboundEvent& event) {
+    game_data.notePlayers(event.players);
+    for (int i = 0; i < event.players; i++) {
+        fitToSites(game_data.ownership[i], event.payload->ownership[i]);
     }
-    else if (cmd == "SITE_POSITIONS") {
-        if (args.size() == 16) {
-            std::cout << "=== Receiving Site Positions from Server ===" << std::endl;
+}
 
-            game_data.sites.clear();
+static void applyResources(const InboundEvent& event) {
+    game_data.notePlayers(event.players);
+    for (int i = 0; i < event.players; i++) {
+        game_data.gold[i] = event.gold[i];
+        game_data.levies[i] = event.levies[i];
+    }
+}
 
-            for (int i = 0; i < 8; i++) {
-                int x = stoi(args.at(i * 2));
-                int y = stoi(args.at(i * 2 + 1));
-                game_data.sites.push_back(Site(x, y));
-                std::cout << "Site " << i << ": (" << x << ", " << y << ")" << std::endl;
-            }
+static void applyScores(const InboundEvent& event) {
+    game_data.notePlayers(event.players);
+    for (int i = 0; i < event.players; i++) {
+        game_data.scores[i] = event.scores[i];
+    }
+}
 
-            game_data.player1.position = game_data.sites[0].center;
-            game_data.player1.targetPosition = game_data.sites[0].center;
-            game_data.player2.position = game_data.sites[7].center;
-            game_data.player2.targetPosition = game_data.sites[7].center;
+static void applyBuildings(const InboundEvent& event) {
+    const SiteBitset* buildings = event.payload->buildings;
+    fitToSites(game_data.castles, buildings[BUILDING_CASTLE]);
+    fitToSites(game_data.goldMines, buildings[BUILDING_GOLD_MINE]);
+    fitToSites(game_data.barracks, buildings[BUILDING_BARRACKS]);
+}
 
-            std::cout << "Site positions synchronized with server" << std::endl;
-        }
+//"P<n>" or "Neutral"
+static std::string ownerName(int owner) {
+    return owner > 0 ? "P" + std::to_string(owner) : "Neutral";
+}
+
+//Runs on the receive thread. Messages are only decoded here, the game state is changed
+//by processEvents on the main thread at the start of the next frame.
+void MyGame::on_receive(std::string cmd, std::vector<std::string>& args) {
+    ALLOC_SCOPE(ALLOC_NETWORK);
+    LOG_DEBUG(LOG_NET, "CLIENT RECEIVED: %s with %d args", cmd.c_str(), static_cast<int>(args.size()));
+
+    Uint32 sequence = ++messagesReceived;
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 bytes = cmd.size();
+    for (size_t i = 0; i < args.size(); i++) {
+        bytes += args[i].size() + 1;
     }
-    else if (cmd == "OWNERSHIP") {
-        if (args.size() >= 2) {
-            try {
-                uint8_t oldP1 = game_data.player1Ownership;
-                uint8_t oldP2 = game_data.player2Ownership;
-
-                game_data.player1Ownership = static_cast<uint8_t>(std::stoi(args.at(0)));
-                game_data.player2Ownership = static_cast<uint8_t>(std::stoi(args.at(1)));
-
-                if (oldP1 != game_data.player1Ownership || oldP2 != game_data.player2Ownership) {
-                    std::cout << "=== OWNERSHIP UPDATE ===" << std::endl;
-                    std::cout << "Player 1 ownership: " << std::bitset<8>(game_data.player1Ownership) << std::endl;
-                    std::cout << "Player 2 ownership: " << std::bitset<8>(game_data.player2Ownership) << std::endl;
-
-                    for (int i = 0; i < 8; i++) {
-                        bool wasP1 = (oldP1 & (1 << i)) != 0;
-                        bool wasP2 = (oldP2 & (1 << i)) != 0;
-                        bool isP1 = game_data.isPlayer1Owner(i);
-                        bool isP2 = game_data.isPlayer2Owner(i);
-
-                        if (wasP1 != isP1 || wasP2 != isP2) {
-                            std::cout << "Site " << i << " changed: ";
-                            if (wasP1) std::cout << "P1";
-                            else if (wasP2) std::cout << "P2";
-                            else std::cout << "Neutral";
-                            std::cout << " -> ";
-                            if (isP1) std::cout << "P1";
-                            else if (isP2) std::cout << "P2";
-                            else std::cout << "Neutral";
-                            std::cout << std::endl;
-                        }
-                    }
-                    std::cout << "=======================" << std::endl;
-                }
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing OWNERSHIP: " << e.what() << std::endl;
-            }
+
+    InboundEvent* event = inbound.acquire(EVENT_GAME_START, message_has_payload(cmd));
+
+    //Any malformed argument (non-numeric, out of range) drops the message instead of taking the client down
+    try {
+        if (!decode_message(cmd, args, *event)) {
+            traffic.recordInbound("unknown", bytes, args);
+            inbound.release(event);
+            return;
         }
     }
-    else if (cmd == "SCORES") {
-        if (args.size() == 2) {
-            game_data.player1Score = stoi(args.at(0));
-            game_data.player2Score = stoi(args.at(1));
-        }
+    catch (const std::exception& e) {
+        LOG_WARN(LOG_NET, "ERROR parsing %s: %s", cmd.c_str(), e.what());
+        traffic.recordInbound("unknown", bytes, args);
+        inbound.release(event);
+        return;
     }
-    else if (cmd == "RESOURCES") {
-        if (args.size() >= 4) {
-            game_data.player1Gold = stoi(args.at(0));
-            game_data.player1Levies = stoi(args.at(1));
-            game_data.player2Gold = stoi(args.at(2));
-            game_data.player2Levies = stoi(args.at(3));
-        }
+
+    parse_time.record(metrics_elapsed_us(start));
+    traffic.recordInbound(cmd, bytes, args);
+
+    event->message = sequence;
+    trackSession(*event);
+    inbound.push(event);
+}
+
+//Keeps the resume state current on the receive thread, so on_reconnect never reads main thread state
+void MyGame::trackSession(InboundEvent& event) {
+    switch (event.type) {
+    case EVENT_JOINED_ROOM:
+        currentRoom = event.values[0];
+        sessionPlayer = event.values[1];
+        sessionToken = event.payload->token;
+        lastSnapshotId = -1;
+        break;
+
+    case EVENT_SNAPSHOT:
+        //Marks the end of a server tick, everything up to this id is in the queue
+        lastSnapshotId = event.values[0];
+        break;
+
+    case EVENT_RESUMED:
+        currentRoom = event.values[0];
+        sessionPlayer = event.values[1];
+        event.values[2] = lastSnapshotId;
+        break;
+
+    case EVENT_RESUME_FAILED:
+        sessionToken.clear();
+        currentRoom = -1;
+        lastSnapshotId = -1;
+        break;
+
+    default:
+        break;
     }
-    else if (cmd == "PLAYER_POS") {
-        if (args.size() >= 3) {
-            int playerNum = stoi(args.at(0));
-            int x = stoi(args.at(1));
-            int y = stoi(args.at(2));
-
-            //Only update opponent's target, let client interpolate smoothly
-            if (playerNum != myPlayerNumber) {
-                if (playerNum == 1) {
-                    game_data.player1.targetPosition.x = x;
-                    game_data.player1.targetPosition.y = y;
-                    game_data.player1.isMoving = true;
-                }
-                else if (playerNum == 2) {
-                    game_data.player2.targetPosition.x = x;
-                    game_data.player2.targetPosition.y = y;
-                    game_data.player2.isMoving = true;
-                }
-            }
-            //For our own player, update target when server confirms (reconciliation)
-            else {
-                if (playerNum == 1) {
-                    //Server says we've arrived, which snaps to exact position (might need to tweek later)
-                    game_data.player1.position.x = x;
-                    game_data.player1.position.y = y;
-                    game_data.player1.targetPosition.x = x;
-                    game_data.player1.targetPosition.y = y;
-                    game_data.player1.isMoving = false;
-                }
-                else if (playerNum == 2) {
-                    game_data.player2.position.x = x;
-                    game_data.player2.position.y = y;
-                    game_data.player2.targetPosition.x = x;
-                    game_data.player2.targetPosition.y = y;
-                    game_data.player2.isMoving = false;
-                }
-            }
+}
+
+//Applies everything the receive thread queued since the last call, in arrival order.
+//Called once at the start of each frame, so input, update and render all see the same state.
+void MyGame::processEvents() {
+    TRACE_SCOPE("processEvents", "frame");
+    ALLOC_SCOPE(ALLOC_APPLY);
+    int drained = 0;
+    InboundEvent* event;
+
+    inbound_depth.set(inbound.depth());
+    outbound_size.set(static_cast<long long>(outbound.size()));
+    sim_tick.set(static_cast<long long>(game_data.tick));
+
+    while ((event = inbound.pop()) != nullptr) {
+        inbound.recordAge(event->receivedAt);
+        Uint64 applyStart = trace_now();
+        applyEvent(*event);
+        trace_span("apply", "net", applyStart, event_type_name(event->type));
+        if (event->message != 0) {
+            messagesApplied = event->message;
         }
+        inbound.release(event);
+        drained++;
     }
-    else if (cmd == "BUILDINGS") {
-        if (args.size() >= 3) {
-            try {
-                uint8_t castles = static_cast<uint8_t>(std::stoi(args.at(0)));
-                uint8_t goldMines = static_cast<uint8_t>(std::stoi(args.at(1)));
-                uint8_t barracks = static_cast<uint8_t>(std::stoi(args.at(2)));
-
-                std::cout << "=== BUILDINGS UPDATE ===" << std::endl;
-                for (int i = 0; i < 8; i++) {
-                    game_data.sites[i].hasCastle = (castles & (1 << i)) != 0;
-                    game_data.sites[i].hasGoldMine = (goldMines & (1 << i)) != 0;
-                    game_data.sites[i].hasBarracks = (barracks & (1 << i)) != 0;
-
-                    if (game_data.sites[i].hasCastle || game_data.sites[i].hasGoldMine || game_data.sites[i].hasBarracks) {
-                        std::cout << "Site " << i << ": ";
-                        if (game_data.sites[i].hasCastle) std::cout << "Castle ";
-                        if (game_data.sites[i].hasGoldMine) std::cout << "GoldMine ";
-                        if (game_data.sites[i].hasBarracks) std::cout << "Barracks";
-                        std::cout << std::endl;
-                    }
-                }
-                std::cout << "========================" << std::endl;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing BUILDINGS: " << e.what() << std::endl;
+
+    inbound.recordDrain(drained);
+}
+
+void MyGame::applyEvent(const InboundEvent& event) {
+    const int* v = event.values;
+
+    switch (event.type) {
+    case EVENT_LOBBY_INFO:
+        LOG_INFO(LOG_GAME, "=== Received Lobby Info ===");
+        for (int i = 0; i < 3; i++) {
+            roomPlayerCounts[i] = v[i];
+            roomCapacities[i] = v[3 + i];
+            LOG_INFO(LOG_GAME, "Room %d: %d/%d players", i + 1, roomPlayerCounts[i], roomCapacities[i]);
+        }
+        lobbyReceived = true;
+        break;
+
+    case EVENT_JOINED_ROOM:
+        myPlayerNumber = v[1];
+        appliedSnapshotId = -1;
+        if (v[2] > 0) {
+            game_data.playerCount = v[2];
+        }
+        game_data.notePlayers(myPlayerNumber);
+        gameState = WAITING;
+        noteResponse(REQUEST_JOIN);
+        latency.noteAnswered(ACTION_JOIN, event.receivedAt);
+        LOG_INFO(LOG_GAME, "=== Joined Room %d as Player %d ===", v[0] + 1, myPlayerNumber);
+        LOG_INFO(LOG_GAME, "Game state set to WAITING");
+        LOG_INFO(LOG_GAME, "Waiting for opponents...");
+        break;
+
+    case EVENT_ROOM_FULL:
+        LOG_INFO(LOG_GAME, "Room %d is full!", v[0] + 1);
+        noteResponse(REQUEST_JOIN);
+        latency.noteAnswered(ACTION_JOIN, event.receivedAt);
+        gameState = LOBBY;
+        break;
+
+    case EVENT_SNAPSHOT:
+        appliedSnapshotId = v[0];
+        if (awaitingResync) {
+            finishRecovery();
+        }
+        break;
+
+    case EVENT_RESUMED:
+        myPlayerNumber = v[1];
+        game_data.notePlayers(myPlayerNumber);
+        connectionLost = false;
+        LOG_INFO(LOG_SYNC, "=== Session resumed in Room %d as Player %d from snapshot %d ===", v[0] + 1, myPlayerNumber, v[2]);
+        break;
+
+    case EVENT_RESUME_FAILED:
+        //Server no longer knows our session, fall back to a cold lobby start
+        LOG_WARN(LOG_SYNC, "=== Session resume rejected, returning to lobby ===");
+        appliedSnapshotId = -1;
+        connectionLost = false;
+        awaitingResync = false;
+        selectedRoom = -1;
+        gameState = LOBBY;
+        break;
+
+    case EVENT_GAME_START:
+        if (v[0] > 0) {
+            game_data.playerCount = v[0];
+        }
+        //Every client counts ticks from here, lockstep hashes are matched by tick
+        game_data.tick = 0;
+        resetHistory();
+        gameState = PLAYING;
+        LOG_INFO(LOG_GAME, "=== GAME STARTING ===");
+        LOG_INFO(LOG_GAME, "Game state set to PLAYING with %d players", game_data.playerCount);
+        break;
+
+    case EVENT_SITE_POSITIONS: {
+        const std::vector<int>& coords = event.payload->coords;
+        int siteCount = static_cast<int>(coords.size() / 2);
+        LOG_INFO(LOG_STATE, "=== Receiving %d Site Positions from Server ===", siteCount);
+
+        game_data.sites.clear();
+        game_data.sites.reserve(siteCount);
+        for (int i = 0; i < siteCount; i++) {
+            int x = coords[i * 2];
+            int y = coords[i * 2 + 1];
+            game_data.sites.add(x, y);
+            if (siteCount <= 8) {
+                LOG_DEBUG(LOG_STATE, "Site %d: (%d, %d)", i, x, y);
             }
         }
-    }
-    else if (cmd == "PLAYER_STATES") {
-        if (args.size() >= 1) {
-            try {
-                uint8_t states = static_cast<uint8_t>(std::stoi(args.at(0)));
 
-                game_data.player1.isMoving = (states & (1 << 0)) != 0;
-                game_data.player2.isMoving = (states & (1 << 1)) != 0;
-                game_data.player1.isCapturing = (states & (1 << 2)) != 0;
-                game_data.player2.isCapturing = (states & (1 << 3)) != 0;
-                game_data.inCombat = (states & (1 << 4)) != 0;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing PLAYER_STATES: " << e.what() << std::endl;
-            }
+        game_data.siteVersion++;
+        game_data.fitBitsetsToSites();
+
+        //Snapshots index the old site list, a replay of them would read past the new one
+        resetHistory();
+
+        //Players start spread evenly along the site list, first and last site for two players
+        int lastPlayer = std::max(1, game_data.playerCount - 1);
+        for (int i = 0; i < game_data.playerCount; i++) {
+            int site = static_cast<int>(static_cast<long long>(siteCount - 1) * i / lastPlayer);
+            Point start(game_data.sites.x[site], game_data.sites.y[site]);
+            game_data.players[i].placeAt(start);
+            game_data.players[i].targetPosition = start;
         }
+
+        LOG_INFO(LOG_STATE, "Site positions synchronized with server");
+        break;
     }
-    else if (cmd == "COMBAT_STATE") {
-        if (args.size() >= 2) {
-            try {
-                uint8_t state = static_cast<uint8_t>(std::stoi(args.at(0)));
-                game_data.combatTimer = std::stof(args.at(1));
 
-                game_data.inCombat = (state & (1 << 3)) != 0;
-                if (game_data.inCombat) {
-                    game_data.combatSite = state & 0x07;  //Extract bits 0-2
-                    game_data.canRetreat = (state & (1 << 4)) != 0;
-                }
-                else {
-                    game_data.combatSite = -1;
-                    game_data.canRetreat = false;
-                }
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing COMBAT_STATE: " << e.what() << std::endl;
-            }
+    case EVENT_OWNERSHIP: {
+        SiteBitset* old = ownershipBefore;
+        for (int i = 0; i < event.players; i++) {
+            old[i] = game_data.ownership[i];
         }
-    }
-    else if (cmd == "FULL_STATE") {
-        if (args.size() >= 18) {
-            try {
-                //Ownership (indices 0-1)
-                game_data.player1Ownership = static_cast<uint8_t>(std::stoi(args.at(0)));
-                game_data.player2Ownership = static_cast<uint8_t>(std::stoi(args.at(1)));
-
-                //Buildings (indices 2-4)
-                uint8_t castles = static_cast<uint8_t>(std::stoi(args.at(2)));
-                uint8_t goldMines = static_cast<uint8_t>(std::stoi(args.at(3)));
-                uint8_t barracks = static_cast<uint8_t>(std::stoi(args.at(4)));
-
-                for (int i = 0; i < 8; i++) {
-                    game_data.sites[i].hasCastle = (castles & (1 << i)) != 0;
-                    game_data.sites[i].hasGoldMine = (goldMines & (1 << i)) != 0;
-                    game_data.sites[i].hasBarracks = (barracks & (1 << i)) != 0;
-                }
 
-                //Player states (index 5)
-                uint8_t states = static_cast<uint8_t>(std::stoi(args.at(5)));
-                game_data.player1.isMoving = (states & (1 << 0)) != 0;
-                game_data.player2.isMoving = (states & (1 << 1)) != 0;
-                game_data.player1.isCapturing = (states & (1 << 2)) != 0;
-                game_data.player2.isCapturing = (states & (1 << 3)) != 0;
-                game_data.inCombat = (states & (1 << 4)) != 0;
-
-                //Scores (indices 6-7)
-                game_data.player1Score = stoi(args.at(6));
-                game_data.player2Score = stoi(args.at(7));
-
-                //Resources (indices 8-11)
-                game_data.player1Gold = stoi(args.at(8));
-                game_data.player1Levies = stoi(args.at(9));
-                game_data.player2Gold = stoi(args.at(10));
-                game_data.player2Levies = stoi(args.at(11));
-
-                //Positions (indices 12-15)
-                game_data.player1.targetPosition.x = stoi(args.at(12));
-                game_data.player1.targetPosition.y = stoi(args.at(13));
-                game_data.player2.targetPosition.x = stoi(args.at(14));
-                game_data.player2.targetPosition.y = stoi(args.at(15));
-
-                //Combat state (indices 16-17)
-                uint8_t combatState = static_cast<uint8_t>(std::stoi(args.at(16)));
-                game_data.combatTimer = std::stof(args.at(17));
-
-                game_data.inCombat = (combatState & (1 << 3)) != 0;
-                if (game_data.inCombat) {
-                    game_data.combatSite = combatState & 0x07;
-                    game_data.canRetreat = (combatState & (1 << 4)) != 0;
-                }
+        applyOwnership(event);
 
-                std::cout << "=== FULL STATE RECEIVED ===" << std::endl;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing FULL_STATE: " << e.what() << std::endl;
+        //Only walk the sites whose owner actually changed
+        SiteBitset& changed = ownershipChanged;
+        changed.clear();
+        for (int i = 0; i < event.players; i++) {
+            changed.orDifference(old[i], game_data.ownership[i]);
+        }
+
+        if (changed.any()) {
+            char owned[128] = "";
+            int used = 0;
+            for (int i = 0; i < game_data.playerCount && used < static_cast<int>(sizeof(owned)); i++) {
+                used += snprintf(owned + used, sizeof(owned) - used, "P%d %d, ", i + 1, game_data.ownership[i].count());
             }
+            LOG_INFO(LOG_STATE, "=== OWNERSHIP UPDATE === sites owned: %s%d neutral", owned, game_data.neutralSiteCount());
+
+            changed.forEachSet([&](int site) {
+                int was = 0;
+                for (int i = 0; i < event.players && was == 0; i++) {
+                    if (old[i].test(site)) {
+                        was = i + 1;
+                    }
+                }
+
+                LOG_DEBUG(LOG_STATE, "Site %d changed: %s -> %s", site, ownerName(was).c_str(), ownerName(game_data.ownerOf(site)).c_str());
+            });
         }
+        break;
     }
-    else if (cmd == "GAME_OVER") {
-        if (args.size() >= 1) {
-            game_data.gameOver = true;
-            game_data.winner = stoi(args.at(0));
-            std::cout << "=== GAME OVER - Player " << game_data.winner << " wins ===" << std::endl;
+
+    case EVENT_SCORES:
+        applyScores(event);
+        break;
+
+    case EVENT_RESOURCES:
+        applyResources(event);
+        break;
+
+    case EVENT_PLAYER_POS: {
+        int playerNum = v[0];
+        Player* player = &game_data.player(playerNum);
+
+        player->targetPosition = Point(v[1], v[2]);
+
+        //Only update opponent's target, let client interpolate smoothly
+        if (playerNum != myPlayerNumber) {
+            player->isMoving = true;
         }
+        //For our own player the server confirms we've arrived, which snaps to exact position (might need to tweek later)
+        else {
+            player->placeAt(player->targetPosition);
+            player->isMoving = false;
+            latency.noteAnswered(ACTION_MOVE, event.receivedAt);
+        }
+        break;
     }
-    else if (cmd == "COMBAT_START") {
-        if (args.size() >= 1) {
-            try {
-                game_data.combatSite = std::stoi(args.at(0));
-                game_data.inCombat = true;
-                game_data.combatTimer = 0.0f;
-                game_data.canRetreat = false;
-                std::cout << "=== COMBAT STARTED at site " << game_data.combatSite << " ===" << std::endl;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing COMBAT_START: " << e.what() << std::endl;
-            }
+
+    case EVENT_BUILDINGS: {
+        applyBuildings(event);
+        noteResponse(REQUEST_BUILD);
+        latency.noteAnswered(ACTION_BUILD, event.receivedAt);
+
+        const SiteBitset& castles = game_data.castles;
+        const SiteBitset& goldMines = game_data.goldMines;
+        const SiteBitset& barracks = game_data.barracks;
+
+        LOG_INFO(LOG_STATE, "=== BUILDINGS UPDATE === Castles: %d, Gold mines: %d, Barracks: %d",
+            castles.count(), goldMines.count(), barracks.count());
+
+        if (game_data.sites.size() <= 8 && log_enabled(LOG_LEVEL_DEBUG)) {
+            SiteBitset built = castles;
+            built.orWith(goldMines);
+            built.orWith(barracks);
+
+            built.forEachSet([&](int i) {
+                LOG_DEBUG(LOG_STATE, "Site %d: %s%s%s", i, castles.test(i) ? "Castle " : "",
+                    goldMines.test(i) ? "GoldMine " : "", barracks.test(i) ? "Barracks" : "");
+            });
         }
+        break;
     }
-    else if (cmd == "COMBAT_INTERRUPT") {
+
+    case EVENT_PLAYER_STATES:
+        applyPlayerStates(v[0], v[1], v[2]);
+        break;
+
+    case EVENT_COMBAT_STATE:
+        game_data.combatTimeUs = seconds_to_us(event.timer);
+        applyCombatState(v[0], v[1]);
+        break;
+
+    case EVENT_FULL_STATE:
+        applyOwnership(event);
+        applyBuildings(event);
+        applyPlayerStates(v[0], v[1], v[2]);
+        applyScores(event);
+        applyResources(event);
+
+        for (int i = 0; i < event.players; i++) {
+            game_data.players[i].targetPosition = Point(event.x[i], event.y[i]);
+        }
+
+        game_data.combatTimeUs = seconds_to_us(event.timer);
+        applyCombatState(v[3], v[4]);
+
+        LOG_INFO(LOG_STATE, "=== FULL STATE RECEIVED ===");
+
+        if (awaitingResync) {
+            finishRecovery();
+        }
+        break;
+
+    case EVENT_GAME_OVER:
+        game_data.gameOver = true;
+        game_data.winner = v[0];
+        LOG_INFO(LOG_GAME, "=== GAME OVER - Player %d wins ===", game_data.winner);
+        break;
+
+    case EVENT_COMBAT_START:
+        game_data.combatSite = v[0];
+        game_data.inCombat = true;
+        game_data.combatTimeUs = 0;
+        game_data.canRetreat = false;
+        combatStartTick = game_data.tick;
+        LOG_INFO(LOG_GAME, "=== COMBAT STARTED at site %d ===", game_data.combatSite);
+        break;
+
+    case EVENT_COMBAT_INTERRUPT:
+        noteCombatEnd();
         game_data.inCombat = false;
         game_data.combatSite = -1;
-        game_data.combatTimer = 0.0f;
+        game_data.combatTimeUs = 0;
         game_data.canRetreat = false;
-        std::cout << "=== COMBAT INTERRUPTED ===" << std::endl;
-    }
-    else if (cmd == "COMBAT_END") {
-        if (args.size() >= 1) {
-            try {
-                int winner = std::stoi(args.at(0));
-                game_data.inCombat = false;
-                game_data.combatSite = -1;
-                game_data.combatTimer = 0.0f;
-                game_data.canRetreat = false;
-                std::cout << "=== COMBAT ENDED - Player " << winner << " victorious ===" << std::endl;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing COMBAT_END: " << e.what() << std::endl;
-            }
+        LOG_INFO(LOG_GAME, "=== COMBAT INTERRUPTED ===");
+        break;
+
+    case EVENT_COMBAT_END:
+        noteCombatEnd();
+        game_data.inCombat = false;
+        game_data.combatSite = -1;
+        game_data.combatTimeUs = 0;
+        game_data.canRetreat = false;
+        LOG_INFO(LOG_GAME, "=== COMBAT ENDED - Player %d victorious ===", v[0]);
+        break;
+
+    case EVENT_RETREAT:
+        if (v[0] == myPlayerNumber) {
+            noteResponse(REQUEST_RETREAT);
+            latency.noteAnswered(ACTION_RETREAT, event.receivedAt);
         }
-    }
-    else if (cmd == "RETREAT") {
-        if (args.size() >= 2) {
-            try {
-                int playerNum = std::stoi(args.at(0));
-                int retreatSite = std::stoi(args.at(1));
-                std::cout << "=== Player " << playerNum << " retreated to site " << retreatSite << " ===" << std::endl;
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing RETREAT: " << e.what() << std::endl;
-            }
+        LOG_INFO(LOG_GAME, "=== Player %d retreated to site %d ===", v[0], v[1]);
+        break;
+
+    case EVENT_POSITIONS:
+        game_data.notePlayers(event.players);
+        for (int i = 0; i < event.players; i++) {
+            reconcilePosition(game_data.players[i], Point(event.x[i], event.y[i]), myPlayerNumber == i + 1);
+        }
+        break;
+
+    case EVENT_STATE_HASH:
+        checkStateHash(v[0], event.tick, event.hash);
+        break;
+
+    case EVENT_CONNECTION_LOST:
+        if (!connectionLost) {
+            connectionLost = true;
+            awaitingResync = false;
+            disconnectTime = event.receivedAt;
+            LOG_WARN(LOG_NET, "=== CONNECTION LOST, reconnecting... ===");
         }
+        break;
+
+    case EVENT_RESYNC_STARTED:
+        awaitingResync = true;
+        break;
+
+    case EVENT_SESSION_RESET:
+        connectionLost = false;
+        gameState = LOBBY;
+        selectedRoom = -1;
+        break;
+
+    case EVENT_CONNECTING:
+        connecting = true;
+        break;
+
+    case EVENT_CONNECTED:
+        connecting = false;
+        break;
     }
-    else if (cmd == "POSITIONS") {
-        if (args.size() >= 4) {
-            try {
-                int serverP1X = std::stoi(args.at(0));
-                int serverP1Y = std::stoi(args.at(1));
-                int serverP2X = std::stoi(args.at(2));
-                int serverP2Y = std::stoi(args.at(3));
-
-                //Server reconciliation, only correct if significantly off and not moving
-                const float Reconciliation_Threshold = 50.0f; 
-
-                //Only reconcile Player 1 if we're not the one controlling them or if really far off
-                if (myPlayerNumber != 1 || !game_data.player1.isMoving) {
-                    float p1Diff = distance(game_data.player1.position.x, game_data.player1.position.y,
-                        serverP1X, serverP1Y);
-                    if (p1Diff > Reconciliation_Threshold) {
-                        game_data.player1.position.x = serverP1X;
-                        game_data.player1.position.y = serverP1Y;
-                        std::cout << "[RECONCILIATION] P1 position corrected by server (diff: " << p1Diff << ")" << std::endl;
-                    }
-                }
+}
 
-                //Same thing but for player 2
-                if (myPlayerNumber != 2 || !game_data.player2.isMoving) {
-                    float p2Diff = distance(game_data.player2.position.x, game_data.player2.position.y,
-                        serverP2X, serverP2Y);
-                    if (p2Diff > Reconciliation_Threshold) {
-                        game_data.player2.position.x = serverP2X;
-                        game_data.player2.position.y = serverP2Y;
-                        std::cout << "[RECONCILIATION] P2 position corrected by server (diff: " << p2Diff << ")" << std::endl;
-                    }
-                }
-            }
-            catch (const std::exception& e) {
-                std::cout << "ERROR parsing POSITIONS: " << e.what() << std::endl;
-            }
-        }
+//Server reconciliation, only correct if significantly off and not a move we are predicting ourselves
+void MyGame::reconcilePosition(Player& player, Point serverPosition, bool controlled) {
+    if (controlled && player.isMoving) {
+        return;
+    }
+
+    double diff = pixel_distance(player.position, SubPoint::fromPixels(serverPosition));
+    if (diff > RECONCILIATION_THRESHOLD) {
+        player.placeAt(serverPosition);
+        corrections.record(static_cast<Uint64>(diff));
+        LOG_DEBUG(LOG_SYNC, "[RECONCILIATION] P%d position corrected by server (diff: %.1f)", player.playerNumber, diff);
     }
 }
 
-void MyGame::send(std::string message) {
-    messages.push_back(message);
+//Counts against the caller's subsystem: clicks are off the steady frame budget, the lockstep
+//hash sent from step() is not, so queueing a message must not allocate
+void MyGame::send(const std::string& message) {
+    int inputTag = latency.noteEnqueued(message);
+    if (!outbound.push(message, inputTag)) {
+        LOG_WARN(LOG_NET, "Outbound queue full, dropped: %s", message.c_str());
+        return;
+    }
+
+    int request = -1;
+    if (message.compare(0, 9, "JOIN_ROOM") == 0) {
+        request = REQUEST_JOIN;
+    }
+    else if (message.compare(0, 6, "BUILD_") == 0) {
+        request = REQUEST_BUILD;
+    }
+    else if (message.compare(0, 7, "RETREAT") == 0) {
+        request = REQUEST_RETREAT;
+    }
+
+    if (request >= 0 && requestSentAt[request] == 0) {
+        requestSentAt[request] = SDL_GetPerformanceCounter();
+    }
 }
 
-bool MyGame::isPlayerOnSite(int siteIndex) {
-    if (myPlayerNumber == 1) {
-        return game_data.player1.currentSite == siteIndex;
+void MyGame::noteResponse(Request request) {
+    if (requestSentAt[request] != 0) {
+        request_rtt.record(metrics_elapsed_us(requestSentAt[request]));
+        requestSentAt[request] = 0;
     }
-    else {
-        return game_data.player2.currentSite == siteIndex;
+}
+
+//Called on the main thread before the network threads start, while the first connection is being made
+void MyGame::on_connecting() {
+    inbound.push(EVENT_CONNECTING);
+}
+
+//Called on the receive thread once it has the first connection
+void MyGame::on_connected() {
+    inbound.push(EVENT_CONNECTED);
+}
+
+//Called on the receive thread when the socket drops
+void MyGame::on_disconnect() {
+    inbound.push(EVENT_CONNECTION_LOST);
+}
+
+//Called on the receive thread once a new socket is open. Returns the RESUME request to present,
+//or an empty string if we never got a session (still in the lobby) and the server should treat us as a new client
+std::string MyGame::on_reconnect() {
+    if (sessionToken.empty() || currentRoom < 0) {
+        inbound.push(EVENT_SESSION_RESET);
+        return "";
+    }
+
+    inbound.push(EVENT_RESYNC_STARTED);
+    return "RESUME," + sessionToken + "," + std::to_string(currentRoom) + "," +
+        std::to_string(sessionPlayer) + "," + std::to_string(lastSnapshotId);
+}
+
+void MyGame::finishRecovery() {
+    awaitingResync = false;
+    connectionLost = false;
+
+    double recoveryMs = (SDL_GetPerformanceCounter() - disconnectTime) * 1000.0 / SDL_GetPerformanceFrequency();
+    recovery_time.record(static_cast<Uint64>(recoveryMs));
+    LOG_INFO(LOG_SYNC, "[RECONNECT] Recovered in %.1f ms (resynced to snapshot %d)", recoveryMs, appliedSnapshotId);
+
+    if (recoveryMs > RECOVERY_BUDGET_MS) {
+        LOG_WARN(LOG_SYNC, "[RECONNECT] recovery exceeded %.0f ms budget", RECOVERY_BUDGET_MS);
     }
 }
 
+Player& MyGame::myPlayer() {
+    return game_data.player(myPlayerNumber);
+}
+
+bool MyGame::isPlayerOnSite(int siteIndex) {
+    return myPlayer().currentSite == siteIndex;
+}
+
 void MyGame::input(SDL_Event& event) {
+    ALLOC_SCOPE(ALLOC_INPUT);
+    InputLatencyScope latencyScope(latency, event);
+    if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r && gameState == PLAYING) {
+        startInstantReplay();
+        return;
+    }
+
     if (event.type == SDL_MOUSEBUTTONDOWN) {
         int mouseX = event.button.x;
         int mouseY = event.button.y;
@@ -484,14 +699,14 @@ void MyGame::input(SDL_Event& event) {
                 if (mouseX >= btnX && mouseX <= btnX + btnW &&
                     mouseY >= btnY && mouseY <= btnY + btnH) {
 
-                    if (roomPlayerCounts[i] < 2) {
+                    if (roomPlayerCounts[i] < roomCapacities[i]) {
                         std::string msg = "JOIN_ROOM," + std::to_string(i);
                         send(msg);
                         selectedRoom = i;
-                        std::cout << "Requesting to join Room " << (i + 1) << std::endl;
+                        LOG_INFO(LOG_INPUT, "Requesting to join Room %d", i + 1);
                     }
                     else {
-                        std::cout << "Room " << (i + 1) << " is full!" << std::endl;
+                        LOG_INFO(LOG_INPUT, "Room %d is full!", i + 1);
                     }
                     return;
                 }
@@ -503,11 +718,11 @@ void MyGame::input(SDL_Event& event) {
             return;
         }
 
-        if (game_data.sites.size() != 8) {
+        if (game_data.sites.empty()) {
             return;
         }
 
-        Player& myPlayer = (myPlayerNumber == 1) ? game_data.player1 : game_data.player2;
+        Player& me = myPlayer();
 
         if (game_data.inCombat && game_data.canRetreat) {
             int btnW = 200;
@@ -522,31 +737,30 @@ void MyGame::input(SDL_Event& event) {
 
                 std::string msg = "RETREAT," + std::to_string(myPlayerNumber);
                 send(msg);
-                std::cout << "Requested retreat from combat" << std::endl;
+                LOG_INFO(LOG_INPUT, "Requested retreat from combat");
                 return;
             }
         }
 
         //Don't allow normal actions during combat
         if (game_data.inCombat) {
-            std::cout << "Cannot perform actions during combat" << std::endl;
+            LOG_INFO(LOG_INPUT, "Cannot perform actions during combat");
             return;
         }
 
         //Check if clicking on build menu buttons
-        if (myPlayer.currentSite >= 0 && myPlayer.currentSite < 8) {
-            Site& site = game_data.sites[myPlayer.currentSite];
-            int menuX = site.center.x - 120;
-            int menuY = site.center.y + 30;
+        if (me.currentSite >= 0 && me.currentSite < static_cast<int>(game_data.sites.size())) {
+            int menuX = game_data.sites.x[me.currentSite] - 120;
+            int menuY = game_data.sites.y[me.currentSite] + 30;
 
             //Castle button
             if (mouseX >= menuX && mouseX < menuX + 75 &&
                 mouseY >= menuY && mouseY < menuY + 25) {
 
                 std::string msg = "BUILD_CASTLE," + std::to_string(myPlayerNumber) + "," +
-                    std::to_string(myPlayer.currentSite);
+                    std::to_string(me.currentSite);
                 send(msg);
-                std::cout << "Requested to build castle on site " << myPlayer.currentSite << std::endl;
+                LOG_INFO(LOG_INPUT, "Requested to build castle on site %d", me.currentSite);
                 return;
             }
 
@@ -555,9 +769,9 @@ void MyGame::input(SDL_Event& event) {
                 mouseY >= menuY && mouseY < menuY + 25) {
 
                 std::string msg = "BUILD_GOLD_MINE," + std::to_string(myPlayerNumber) + "," +
-                    std::to_string(myPlayer.currentSite);
+                    std::to_string(me.currentSite);
                 send(msg);
-                std::cout << "Requested to build gold mine on site " << myPlayer.currentSite << std::endl;
+                LOG_INFO(LOG_INPUT, "Requested to build gold mine on site %d", me.currentSite);
                 return;
             }
 
@@ -566,9 +780,9 @@ void MyGame::input(SDL_Event& event) {
                 mouseY >= menuY && mouseY < menuY + 25) {
 
                 std::string msg = "BUILD_BARRACKS," + std::to_string(myPlayerNumber) + "," +
-                    std::to_string(myPlayer.currentSite);
+                    std::to_string(me.currentSite);
                 send(msg);
-                std::cout << "Requested to build barracks on site " << myPlayer.currentSite << std::endl;
+                LOG_INFO(LOG_INPUT, "Requested to build barracks on site %d", me.currentSite);
                 return;
             }
         }
@@ -576,160 +790,173 @@ void MyGame::input(SDL_Event& event) {
         //Client side preditcion, only for movement
         int siteIndex = findClosestSite(mouseX, mouseY);
 
-        if (siteIndex >= 0 && siteIndex < 8) {
-            Point target = game_data.sites[siteIndex].center;
+        if (siteIndex >= 0) {
+            Point target(game_data.sites.x[siteIndex], game_data.sites.y[siteIndex]);
 
             std::string msg = "MOVE," + std::to_string(myPlayerNumber) + "," +
                 std::to_string(target.x) + "," + std::to_string(target.y) + "," +
-                std::to_string(deltaTime);
+                std::to_string(static_cast<double>(sim.stepUs) / US_PER_SECOND);
             send(msg);
 
             //Client-Side Prediction: Immediately start moving our player locally
             //This provides instant visual feedback while we wait for server confirmation
-            if (myPlayerNumber == 1) {
-                game_data.player1.targetPosition = target;
-                game_data.player1.isMoving = true;
-                std::cout << "[CLIENT PREDICTION] Player 1 immediately moving to site " << siteIndex << std::endl;
-            }
-            else {
-                game_data.player2.targetPosition = target;
-                game_data.player2.isMoving = true;
-                std::cout << "[CLIENT PREDICTION] Player 2 immediately moving to site " << siteIndex << std::endl;
-            }
+            me.targetPosition = target;
+            me.isMoving = true;
+            LOG_DEBUG(LOG_INPUT, "[CLIENT PREDICTION] Player %d immediately moving to site %d", myPlayerNumber, siteIndex);
         }
     }
 }
 
-void MyGame::update(float dt) {
-    deltaTime = dt;
+void MyGame::setTickRate(int hz) {
+    if (hz > 0) {
+        sim = SimParams(hz);
+        history.configure(HISTORY_SECONDS, sim.tickRate);
+    }
+}
+
+void MyGame::setLockstep(bool enabled) {
+    lockstep = enabled;
+}
 
+//Runs the simulation in fixed steps of sim.stepUs. Frame time that doesn't make a whole step
+//carries over to the next frame and sets how far render blends towards the latest step.
+void MyGame::update(float dt) {
+    ALLOC_SCOPE(ALLOC_UPDATE);
     if (gameState != PLAYING) {
+        accumulatorUs = 0;
+        interpolation = 0.0f;
         return;
     }
 
-    //Update combat timer locally to save on amount of messages being sent
-    if (game_data.inCombat) {
-        game_data.combatTimer += dt;
-        if (game_data.combatTimer >= 5.0f) {
-            game_data.canRetreat = true;
-        }
-    }
-    //For simulating movement 
-    const float MOVEMENT_SPEED = 300.0f;
-
+    accumulatorUs += seconds_to_us(dt);
 
-    if (game_data.player1.isMoving) {
-        float dist = distance(game_data.player1.position.x, game_data.player1.position.y,
-            game_data.player1.targetPosition.x, game_data.player1.targetPosition.y);
-
-        if (dist < 5.0f) {
- 
-            game_data.player1.position = game_data.player1.targetPosition;
-            game_data.player1.isMoving = false;
-        }
-        else {
-
-            int dx = game_data.player1.targetPosition.x - game_data.player1.position.x;
-            int dy = game_data.player1.targetPosition.y - game_data.player1.position.y;
-
-            float moveX = (dx / dist) * MOVEMENT_SPEED * deltaTime;
-            float moveY = (dy / dist) * MOVEMENT_SPEED * deltaTime;
-
-            game_data.player1.position.x += static_cast<int>(moveX);
-            game_data.player1.position.y += static_cast<int>(moveY);
+    int steps = 0;
+    while (accumulatorUs >= sim.stepUs) {
+        if (steps == MAX_STEPS_PER_FRAME) {
+            accumulatorUs = 0;
+            break;
         }
+        step();
+        accumulatorUs -= sim.stepUs;
+        steps++;
     }
 
+    interpolation = static_cast<float>(accumulatorUs) / sim.stepUs;
 
-    if (game_data.player2.isMoving) {
-        float dist = distance(game_data.player2.position.x, game_data.player2.position.y,
-            game_data.player2.targetPosition.x, game_data.player2.targetPosition.y);
-
-        if (dist < 5.0f) {
-
-            game_data.player2.position = game_data.player2.targetPosition;
-            game_data.player2.isMoving = false;
-        }
-        else {
-
-            int dx = game_data.player2.targetPosition.x - game_data.player2.position.x;
-            int dy = game_data.player2.targetPosition.y - game_data.player2.position.y;
-
-            float moveX = (dx / dist) * MOVEMENT_SPEED * deltaTime;
-            float moveY = (dy / dist) * MOVEMENT_SPEED * deltaTime;
-
-            game_data.player2.position.x += static_cast<int>(moveX);
-            game_data.player2.position.y += static_cast<int>(moveY);
-        }
+    if (replaying) {
+        advanceReplay(steps);
     }
+}
 
-    if (game_data.sites.size() == 8) {
-        if (!game_data.player1.isMoving) {
-            int closestSite = findClosestSite(game_data.player1.position.x, game_data.player1.position.y);
-            float distToSite = distance(game_data.player1.position.x, game_data.player1.position.y,
-                game_data.sites[closestSite].center.x, game_data.sites[closestSite].center.y);
+//One simulation tick, then remember its hash for desync checks
+void MyGame::step() {
+    TRACE_SCOPE("step", "sim");
+    sim_step(game_data, siteIndex(), sim);
+    history.record(game_data);
+
+    Uint64 tick = game_data.tick;
+    Uint64 hash = sim_hash(game_data);
+    hashTicks[tick % HASH_HISTORY] = tick;
+    hashes[tick % HASH_HISTORY] = hash;
+
+    if (lockstep && tick % HASH_INTERVAL == 0) {
+        char message[OUTBOUND_MESSAGE_BYTES];
+        snprintf(message, sizeof(message), "STATE_HASH,%d,%llu,%016llx", myPlayerNumber,
+            static_cast<unsigned long long>(tick), static_cast<unsigned long long>(hash));
+        hashMessage.assign(message);
+        send(hashMessage);
+    }
+}
 
-            if (distToSite < 50.0f) {
-                game_data.player1.currentSite = closestSite;
-            }
-            else {
-                game_data.player1.currentSite = -1;
-            }
-        }
-        else {
+//Another client's hash for a tick. Ticks we no longer (or don't yet) remember can't be checked.
+void MyGame::checkStateHash(int player, Uint64 tick, Uint64 hash) {
+    int slot = static_cast<int>(tick % HASH_HISTORY);
+    if (player == myPlayerNumber || tick == 0 || hashTicks[slot] != tick) {
+        return;
+    }
 
-            game_data.player1.currentSite = -1;
-        }
+    if (hashes[slot] != hash) {
+        desyncs++;
+        desync_total.add();
+        LOG_WARN(LOG_SYNC, "[DESYNC] tick %llu: P%d has %llx, we have %llx", static_cast<unsigned long long>(tick), player,
+            static_cast<unsigned long long>(hash), static_cast<unsigned long long>(hashes[slot]));
+    }
+}
 
-        if (!game_data.player2.isMoving) {
-            int closestSite = findClosestSite(game_data.player2.position.x, game_data.player2.position.y);
-            float distToSite = distance(game_data.player2.position.x, game_data.player2.position.y,
-                game_data.sites[closestSite].center.x, game_data.sites[closestSite].center.y);
+//Combat that ran while we were recording, remembered for instant replay
+void MyGame::noteCombatEnd() {
+    if (game_data.inCombat) {
+        lastCombatStart = combatStartTick;
+        lastCombatEnd = game_data.tick;
+    }
+}
 
-            if (distToSite < 50.0f) {
-                game_data.player2.currentSite = closestSite;
-            }
-            else {
-                game_data.player2.currentSite = -1;
-            }
-        }
-        else {
+//Forgets the recorded ticks and stops any replay of them
+void MyGame::resetHistory() {
+    history.clear();
+    combatStartTick = lastCombatStart = lastCombatEnd = 0;
+    replaying = false;
+}
 
-            game_data.player2.currentSite = -1;
-        }
+//Plays back the last combat, or the last few seconds if there hasn't been one.
+//Copying the game is the only allocation, after that each tick restores into the copy in place.
+void MyGame::startInstantReplay() {
+    if (history.empty()) {
+        return;
     }
 
-    //Update capture progress locally
-    if (game_data.player1.isCapturing) {
-        game_data.player1.captureProgress += dt / 10.0f;
-        if (game_data.player1.captureProgress >= 1.0f) {
-            game_data.player1.captureProgress = 1.0f;
-        }
+    Uint64 margin = static_cast<Uint64>(REPLAY_MARGIN_US / sim.stepUs);
+    Uint64 from, to;
+    if (game_data.inCombat) {
+        from = combatStartTick;
+        to = history.newestTick();
+    }
+    else if (lastCombatEnd > 0) {
+        from = lastCombatStart;
+        to = lastCombatEnd + margin;
     }
     else {
-        game_data.player1.captureProgress = 0.0f;
+        from = history.newestTick() > 5 * margin ? history.newestTick() - 5 * margin : 0;
+        to = history.newestTick();
     }
 
-    if (game_data.player2.isCapturing) {
-        game_data.player2.captureProgress += dt / 10.0f;
-        if (game_data.player2.captureProgress >= 1.0f) {
-            game_data.player2.captureProgress = 1.0f;
-        }
+    from = from > margin ? from - margin : 0;
+    replayTick = std::max(from, history.oldestTick());
+    replayEnd = std::min(to, history.newestTick());
+    if (replayTick > replayEnd) {
+        LOG_INFO(LOG_GAME, "Nothing left in the history to replay");
+        return;
     }
-    else {
-        game_data.player2.captureProgress = 0.0f;
+
+    replayView = game_data;
+    replaying = history.restore(replayTick, replayView);
+    LOG_INFO(LOG_GAME, "=== INSTANT REPLAY of ticks %llu to %llu ===", static_cast<unsigned long long>(replayTick),
+        static_cast<unsigned long long>(replayEnd));
+}
+
+//Replay runs at the same pace as the game, one recorded tick per step
+void MyGame::advanceReplay(int steps) {
+    replayTick += steps;
+    if (replayTick > replayEnd || !history.restore(replayTick, replayView)) {
+        replaying = false;
+        LOG_INFO(LOG_GAME, "=== INSTANT REPLAY FINISHED ===");
     }
 }
 
-void MyGame::renderPlayer(SDL_Renderer* renderer, Player& player) {
+//Where to draw a player between simulation steps
+Point MyGame::renderPosition(const Player& player) const {
+    const SubPoint& from = player.previousPosition;
+    const SubPoint& to = player.position;
+    SubPoint blended(from.x + std::llround((to.x - from.x) * static_cast<double>(interpolation)),
+        from.y + std::llround((to.y - from.y) * static_cast<double>(interpolation)));
+    return blended.toPixels();
+}
+
+void MyGame::renderPlayer(SDL_Renderer* renderer, const Player& player) {
     int radius = 15;
+    Point at = renderPosition(player);
 
-    if (player.playerNumber == 1) {
-        SDL_SetRenderDrawColor(renderer, 0, 100, 255, 255);
-    }
-    else {
-        SDL_SetRenderDrawColor(renderer, 255, 50, 50, 255);
-    }
+    setDrawColor(renderer, PLAYER_COLORS[player.playerNumber - 1].body);
 
     for (int w = 0; w < radius * 2; w++) {
         for (int h = 0; h < radius * 2; h++) {
@@ -737,8 +964,8 @@ void MyGame::renderPlayer(SDL_Renderer* renderer, Player& player) {
             int dy = radius - h;
             if ((dx * dx + dy * dy) <= (radius * radius)) {
                 SDL_RenderDrawPoint(renderer,
-                    player.position.x + dx,
-                    player.position.y + dy);
+                    at.x + dx,
+                    at.y + dy);
             }
         }
     }
@@ -752,8 +979,8 @@ void MyGame::renderPlayer(SDL_Renderer* renderer, Player& player) {
             int distSq = dx * dx + dy * dy;
             if (distSq <= (radius * radius) && distSq >= ((radius - 3) * (radius - 3))) {
                 SDL_RenderDrawPoint(renderer,
-                    player.position.x + dx,
-                    player.position.y + dy);
+                    at.x + dx,
+                    at.y + dy);
             }
         }
     }
@@ -763,14 +990,14 @@ void MyGame::renderPlayer(SDL_Renderer* renderer, Player& player) {
         for (int h = -2; h <= 2; h++) {
             if (w * w + h * h <= 4) {
                 SDL_RenderDrawPoint(renderer,
-                    player.position.x + w,
-                    player.position.y + h);
+                    at.x + w,
+                    at.y + h);
             }
         }
     }
 }
 
-void MyGame::renderText(SDL_Renderer* renderer, const std::string& text, int x, int y, int size) {
+void MyGame::renderText(SDL_Renderer* renderer, const char* text, int x, int y, int size) {
     static const bool digitPatterns[13][7][5] = {
         {{0,1,1,1,0}, {1,0,0,0,1}, {1,0,0,0,1}, {1,0,0,0,1}, {1,0,0,0,1}, {1,0,0,0,1}, {0,1,1,1,0}},
         {{0,0,1,0,0}, {0,1,1,0,0}, {0,0,1,0,0}, {0,0,1,0,0}, {0,0,1,0,0}, {0,0,1,0,0}, {0,1,1,1,0}},
@@ -788,7 +1015,8 @@ void MyGame::renderText(SDL_Renderer* renderer, const std::string& text, int x,
     };
 
     int cursorX = x;
-    for (char c : text) {
+    for (const char* p = text; *p; p++) {
+        char c = *p;
         int patternIdx = -1;
 
         if (c >= '0' && c <= '9') {
@@ -829,10 +1057,10 @@ void MyGame::renderLobby(SDL_Renderer* renderer) {
         int btnW = 300;
         int btnH = 60;
 
-        if (roomPlayerCounts[i] >= 2) {
+        if (roomPlayerCounts[i] >= roomCapacities[i]) {
             SDL_SetRenderDrawColor(renderer, 100, 100, 100, 255);
         }
-        else if (roomPlayerCounts[i] == 1) {
+        else if (roomPlayerCounts[i] > 0) {
             SDL_SetRenderDrawColor(renderer, 200, 200, 50, 255);
         }
         else {
@@ -845,11 +1073,13 @@ void MyGame::renderLobby(SDL_Renderer* renderer) {
         SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
         SDL_RenderDrawRect(renderer, &btnRect);
 
-        std::string roomText = "ROOM " + std::to_string(i + 1);
+        char roomText[32];
+        snprintf(roomText, sizeof(roomText), "ROOM %d", i + 1);
         SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
         renderText(renderer, roomText, btnX + 20, btnY + 10, 3);
 
-        std::string playerText = std::to_string(roomPlayerCounts[i]) + "2 PLAYERS";
+        char playerText[32];
+        snprintf(playerText, sizeof(playerText), "%d%d PLAYERS", roomPlayerCounts[i], roomCapacities[i]);
         renderText(renderer, playerText, btnX + 80, btnY + 35, 2);
     }
 }
@@ -857,17 +1087,16 @@ void MyGame::renderLobby(SDL_Renderer* renderer) {
 void MyGame::renderWaiting(SDL_Renderer* renderer) {
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     renderText(renderer, "WAITING FOR", SCREEN_WIDTH / 2 - 100, 250, 4);
-    renderText(renderer, "OPPONENT", SCREEN_WIDTH / 2 - 70, 300, 4);
+    renderText(renderer, "OPPONENTS", SCREEN_WIDTH / 2 - 80, 300, 4);
 
-    std::string playerText = "YOU ARE PLAYER " + std::to_string(myPlayerNumber);
+    char playerText[32];
+    snprintf(playerText, sizeof(playerText), "YOU ARE PLAYER %d", myPlayerNumber);
     renderText(renderer, playerText, SCREEN_WIDTH / 2 - 140, 380, 3);
 }
 
 void MyGame::renderBuildMenu(SDL_Renderer* renderer, int siteIndex) {
-    Site& site = game_data.sites[siteIndex];
-
-    int menuX = site.center.x - 120;  
-    int menuY = site.center.y + 30;
+    int menuX = game_data.sites.x[siteIndex] - 120;  
+    int menuY = game_data.sites.y[siteIndex] + 30;
 
     SDL_SetRenderDrawColor(renderer, 40, 40, 40, 230);
     SDL_Rect bgRect = { menuX - 5, menuY - 5, 245, 35 };  
@@ -898,86 +1127,73 @@ void MyGame::renderBuildMenu(SDL_Renderer* renderer, int siteIndex) {
     renderText(renderer, "750", menuX + 170, menuY + 5, 2);
 }
 
-void MyGame::renderCaptureBar(SDL_Renderer* renderer, Player& player) {
+void MyGame::renderCaptureBar(SDL_Renderer* renderer, const Player& player) {
     if (!player.isCapturing) return;
 
     int barWidth = 60;
     int barHeight = 8;
-    int barX = player.position.x - barWidth / 2;
-    int barY = player.position.y - 30;
+    Point at = renderPosition(player);
+    int barX = at.x - barWidth / 2;
+    int barY = at.y - 30;
 
     SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
     SDL_Rect bgRect = { barX, barY, barWidth, barHeight };
     SDL_RenderFillRect(renderer, &bgRect);
 
     SDL_SetRenderDrawColor(renderer, 255, 200, 50, 255);
-    SDL_Rect progressRect = { barX, barY, static_cast<int>(barWidth * player.captureProgress), barHeight };
+    SDL_Rect progressRect = { barX, barY, static_cast<int>(barWidth * player.captureProgress()), barHeight };
     SDL_RenderFillRect(renderer, &progressRect);
 
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     SDL_RenderDrawRect(renderer, &bgRect);
 }
 
+//One column per player across the top: score, then gold, then levies. Two players get the
+//old left and right corners, more players share the width evenly.
 void MyGame::renderUI(SDL_Renderer* renderer) {
-    SDL_SetRenderDrawColor(renderer, 50, 50, 150, 255);
-    SDL_Rect p1Rect = { 10, 10, 80, 40 };
-    SDL_RenderFillRect(renderer, &p1Rect);
-
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    std::string p1Text = "P1: " + std::to_string(game_data.player1Score);
-    renderText(renderer, p1Text, 20, 20, 3);
+    int count = game_data.playerCount;
+    int width = std::min(100, (SCREEN_WIDTH - 20) / count - 5);
+    int spacing = count > 1 ? (SCREEN_WIDTH - 20 - width) / (count - 1) : 0;
+    int textSize = count <= 2 ? 3 : 2;
 
-    SDL_SetRenderDrawColor(renderer, 150, 50, 50, 255);
-    SDL_Rect p2Rect = { SCREEN_WIDTH - 90, 10, 80, 40 };
-    SDL_RenderFillRect(renderer, &p2Rect);
+    for (int i = 0; i < count; i++) {
+        int x = 10 + i * spacing;
 
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    std::string p2Text = "P2: " + std::to_string(game_data.player2Score);
-    renderText(renderer, p2Text, SCREEN_WIDTH - 80, 20, 3);
-
-    SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
-    SDL_Rect p1GoldRect = { 10, 55, 100, 25 };
-    SDL_RenderFillRect(renderer, &p1GoldRect);
-
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    std::string p1GoldText = std::to_string(game_data.player1Gold);
-    renderText(renderer, p1GoldText, 20, 60, 2);
-
-    SDL_SetRenderDrawColor(renderer, 192, 192, 192, 255);
-    SDL_Rect p1LevyRect = { 10, 85, 100, 25 };
-    SDL_RenderFillRect(renderer, &p1LevyRect);
-
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    std::string p1LevyText = std::to_string(game_data.player1Levies);
-    renderText(renderer, p1LevyText, 20, 90, 2);
+        setDrawColor(renderer, PLAYER_COLORS[i].panel);
+        SDL_Rect scoreRect = { x, 10, width * 4 / 5, 40 };
+        SDL_RenderFillRect(renderer, &scoreRect);
 
-    SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
-    SDL_Rect p2GoldRect = { SCREEN_WIDTH - 110, 55, 100, 25 };
-    SDL_RenderFillRect(renderer, &p2GoldRect);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        //Labels are formatted on the stack, a PLAYING frame allocates nothing
+        char scoreText[32];
+        snprintf(scoreText, sizeof(scoreText), "P%d: %d", i + 1, game_data.scores[i]);
+        renderText(renderer, scoreText, x + 10, 20, textSize);
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    std::string p2GoldText = std::to_string(game_data.player2Gold);
-    renderText(renderer, p2GoldText, SCREEN_WIDTH - 100, 60, 2);
+        SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
+        SDL_Rect goldRect = { x, 55, width, 25 };
+        SDL_RenderFillRect(renderer, &goldRect);
 
-    SDL_SetRenderDrawColor(renderer, 192, 192, 192, 255);
-    SDL_Rect p2LevyRect = { SCREEN_WIDTH - 110, 85, 100, 25 };
-    SDL_RenderFillRect(renderer, &p2LevyRect);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        char amount[32];
+        snprintf(amount, sizeof(amount), "%d", game_data.gold[i]);
+        renderText(renderer, amount, x + 10, 60, 2);
 
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    std::string p2LevyText = std::to_string(game_data.player2Levies);
-    renderText(renderer, p2LevyText, SCREEN_WIDTH - 100, 90, 2);
+        SDL_SetRenderDrawColor(renderer, 192, 192, 192, 255);
+        SDL_Rect levyRect = { x, 85, width, 25 };
+        SDL_RenderFillRect(renderer, &levyRect);
 
-    if (myPlayerNumber == 1) {
-        SDL_SetRenderDrawColor(renderer, 0, 100, 255, 255);
-    }
-    else {
-        SDL_SetRenderDrawColor(renderer, 255, 50, 50, 255);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        snprintf(amount, sizeof(amount), "%d", game_data.levies[i]);
+        renderText(renderer, amount, x + 10, 90, 2);
     }
+
+    setDrawColor(renderer, PLAYER_COLORS[myPlayerNumber - 1].body);
     SDL_Rect indicatorRect = { SCREEN_WIDTH / 2 - 60, SCREEN_HEIGHT - 50, 120, 40 };
     SDL_RenderFillRect(renderer, &indicatorRect);
 
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    std::string indicatorText = "P" + std::to_string(myPlayerNumber) + ": YOU";
+    char indicatorText[32];
+    snprintf(indicatorText, sizeof(indicatorText), "P%d: YOU", myPlayerNumber);
     renderText(renderer, indicatorText, SCREEN_WIDTH / 2 - 40, SCREEN_HEIGHT - 40, 3);
 }
 
@@ -1015,11 +1231,12 @@ void MyGame::renderCombatUI(SDL_Renderer* renderer) {
     }
 
         // Show countdown timer ABOVE the button (smaller, no text)
-        int remaining = static_cast<int>(5.0f - game_data.combatTimer);
+        int remaining = static_cast<int>((RETREAT_DELAY_US - game_data.combatTimeUs) / US_PER_SECOND);
         if (remaining < 0) remaining = 0;
 
         SDL_SetRenderDrawColor(renderer, 255, 100, 100, 255);
-        std::string countdownText = std::to_string(remaining);
+        char countdownText[32];
+        snprintf(countdownText, sizeof(countdownText), "%d", remaining);
         int countdownX = btnX + 90;
         int countdownY = btnY - 30;  // Above the button
         renderText(renderer, countdownText, countdownX, countdownY, 3);  // Smaller size
@@ -1054,7 +1271,8 @@ void MyGame::renderGameOver(SDL_Renderer* renderer) {
     SDL_Rect borderRect = { boxX, boxY, boxWidth, boxHeight };
     SDL_RenderDrawRect(renderer, &borderRect);
 
-    std::string winnerText = "P" + std::to_string(winner);
+    char winnerText[32];
+    snprintf(winnerText, sizeof(winnerText), "P%d", winner);
     int textSize = 10;
     int textX = 340;
     int textY = 265;
@@ -1063,7 +1281,87 @@ void MyGame::renderGameOver(SDL_Renderer* renderer) {
     renderText(renderer, winnerText, textX, textY, textSize);
 }
 
+//The closest site for each TERRITORY_STEP cell only changes when the map does, so it is
+//worked out once per map and stored as horizontal runs of cells sharing a site
+void MyGame::rebuildTerritory() {
+    territory.clear();
+    territoryVersion = game_data.siteVersion;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y += TERRITORY_STEP) {
+        TerritoryRun run = { 0, y, 0, -1 };
+
+        for (int x = 0; x < SCREEN_WIDTH; x += TERRITORY_STEP) {
+            int siteIndex = findClosestSite(x, y);
+
+            if (siteIndex != run.site) {
+                if (run.width > 0) {
+                    territory.push_back(run);
+                }
+                run.x = x;
+                run.width = 0;
+                run.site = siteIndex;
+            }
+            run.width += TERRITORY_STEP;
+        }
+
+        if (run.width > 0) {
+            territory.push_back(run);
+        }
+    }
+}
+
+//Ring of dots with one lit going round, until the server answers for the first time
+void MyGame::renderConnecting(SDL_Renderer* renderer) {
+    static const int DOTS = 12;
+    int lit = static_cast<int>(SDL_GetTicks() / 80) % DOTS;
+
+    for (int i = 0; i < DOTS; i++) {
+        float angle = i * 2.0f * static_cast<float>(M_PI) / DOTS;
+        int x = SCREEN_WIDTH / 2 + static_cast<int>(40 * std::cos(angle));
+        int y = SCREEN_HEIGHT / 2 + static_cast<int>(40 * std::sin(angle));
+
+        Uint8 shade = static_cast<Uint8>(i == lit ? 255 : 80);
+        SDL_SetRenderDrawColor(renderer, shade, shade, shade, 255);
+        SDL_Rect dot = { x - 4, y - 4, 8, 8 };
+        SDL_RenderFillRect(renderer, &dot);
+    }
+}
+
+void MyGame::renderReconnecting(SDL_Renderer* renderer) {
+    //Pulsing amber bar across the top of the screen while the link is down
+    Uint8 pulse = static_cast<Uint8>(155 + 100 * std::abs(std::sin(SDL_GetTicks() / 300.0f)));
+
+    SDL_SetRenderDrawColor(renderer, pulse, pulse / 2, 0, 255);
+    SDL_Rect bar = { SCREEN_WIDTH / 2 - 150, 0, 300, 8 };
+    SDL_RenderFillRect(renderer, &bar);
+}
+
+//Red strip along the bottom, the bar shrinks as the replay runs out (100 pixels a second)
+void MyGame::renderReplayBanner(SDL_Renderer* renderer) {
+    SDL_SetRenderDrawColor(renderer, 120, 0, 0, 255);
+    SDL_Rect banner = { 0, SCREEN_HEIGHT - 24, SCREEN_WIDTH, 24 };
+    SDL_RenderFillRect(renderer, &banner);
+
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    renderText(renderer, "REPLAY", 10, SCREEN_HEIGHT - 18, 2);
+
+    Uint64 remaining = replayEnd - replayTick;
+    int width = static_cast<int>(std::min<Uint64>(remaining * sim.stepUs / 10000, SCREEN_WIDTH - 110));
+    SDL_Rect progress = { 100, SCREEN_HEIGHT - 14, width, 4 };
+    SDL_RenderFillRect(renderer, &progress);
+}
+
 void MyGame::render(SDL_Renderer* renderer) {
+    ALLOC_SCOPE(ALLOC_RENDER);
+    if (connecting) {
+        renderConnecting(renderer);
+        return;
+    }
+
+    if (connectionLost) {
+        renderReconnecting(renderer);
+    }
+
     if (gameState == LOBBY) {
         renderLobby(renderer);
         return;
@@ -1079,25 +1377,39 @@ void MyGame::render(SDL_Renderer* renderer) {
         return;
     }
 
-    if (game_data.sites.size() != 8) {
+    if (game_data.sites.empty()) {
         return;
     }
 
-    int step = 2;
+    Uint64 phase = trace_now();
 
-    for (int y = 0; y < SCREEN_HEIGHT; y += step) {
-        for (int x = 0; x < SCREEN_WIDTH; x += step) {
-            int siteIndex = findClosestSite(x, y);
-            SDL_Color color = getSiteColor(siteIndex);
+    if (territoryVersion != game_data.siteVersion) {
+        rebuildTerritory();
+    }
 
-            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-            SDL_Rect rect = { x, y, step, step };
-            SDL_RenderFillRect(renderer, &rect);
-        }
+    for (size_t r = 0; r < territory.size(); r++) {
+        const TerritoryRun& run = territory[r];
+        SDL_Color color = getSiteColor(run.site);
+
+        SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+        SDL_Rect rect = { run.x, run.y, run.width, TERRITORY_STEP };
+        SDL_RenderFillRect(renderer, &rect);
     }
 
-    for (int i = 0; i < 8; i++) {
-        Site& site = game_data.sites[i];
+    phase = trace_span("territory", "render", phase);
+
+    //During an instant replay ownership, buildings, combat and players come from the history,
+    //territory and the build menu stay live
+    const GameData& shown = replaying ? replayView : game_data;
+
+    //Each pass only reads the columns it needs: coordinates and ownership for the markers,
+    //then coordinates for just the sites that have a given building
+    const SiteArrays& sites = game_data.sites;
+    int siteCount = static_cast<int>(sites.size());
+
+    for (int i = 0; i < siteCount; i++) {
+        int siteX = sites.x[i];
+        int siteY = sites.y[i];
 
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         int radius = 8;
@@ -1107,17 +1419,15 @@ void MyGame::render(SDL_Renderer* renderer) {
                 int dy = radius - h;
                 if ((dx * dx + dy * dy) <= (radius * radius)) {
                     SDL_RenderDrawPoint(renderer,
-                        site.center.x + dx,
-                        site.center.y + dy);
+                        siteX + dx,
+                        siteY + dy);
                 }
             }
         }
 
-        if (game_data.isPlayer1Owner(i)) {
-            SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-        }
-        else if (game_data.isPlayer2Owner(i)) {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+        int owner = shown.ownerOf(i);
+        if (owner > 0) {
+            setDrawColor(renderer, PLAYER_COLORS[owner - 1].ring);
         }
         else {
             SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
@@ -1131,92 +1441,117 @@ void MyGame::render(SDL_Renderer* renderer) {
                 int distSq = dx * dx + dy * dy;
                 if (distSq <= (radius * radius) && distSq >= ((radius - 2) * (radius - 2))) {
                     SDL_RenderDrawPoint(renderer,
-                        site.center.x + dx,
-                        site.center.y + dy);
+                        siteX + dx,
+                        siteY + dy);
                 }
             }
         }
+    }
 
-        if (site.hasCastle) {
-            SDL_SetRenderDrawColor(renderer, 150, 100, 50, 255);
-            SDL_Rect castleRect = { site.center.x - 26, site.center.y - 6, 12, 12 };
-            SDL_RenderFillRect(renderer, &castleRect);
+    phase = trace_span("sites", "render", phase);
 
-            for (int b = 0; b < 3; b++) {
-                SDL_Rect battlement = { site.center.x - 6 + (b * 5), site.center.y - 18, 3, 3 };
-                SDL_RenderFillRect(renderer, &battlement);
-            }
-        }
+    SDL_SetRenderDrawColor(renderer, 150, 100, 50, 255);
+    shown.castles.forEachSet([&](int i) {
+        int siteX = sites.x[i];
+        int siteY = sites.y[i];
 
-        if (site.hasGoldMine) {
-            SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
-            int gmRadius = 7;
-            for (int w = 0; w < gmRadius * 2; w++) {
-                for (int h = 0; h < gmRadius * 2; h++) {
-                    int dx = gmRadius - w;
-                    int dy = gmRadius - h;
-                    if ((dx * dx + dy * dy) <= (gmRadius * gmRadius)) {
-                        SDL_RenderDrawPoint(renderer,
-                            site.center.x + dx,
-                            site.center.y + 15 + dy);
-                    }
+        SDL_Rect castleRect = { siteX - 26, siteY - 6, 12, 12 };
+        SDL_RenderFillRect(renderer, &castleRect);
+
+        for (int b = 0; b < 3; b++) {
+            SDL_Rect battlement = { siteX - 6 + (b * 5), siteY - 18, 3, 3 };
+            SDL_RenderFillRect(renderer, &battlement);
+        }
+    });
+
+    shown.goldMines.forEachSet([&](int i) {
+        int siteX = sites.x[i];
+        int siteY = sites.y[i];
+
+        SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
+        int gmRadius = 7;
+        for (int w = 0; w < gmRadius * 2; w++) {
+            for (int h = 0; h < gmRadius * 2; h++) {
+                int dx = gmRadius - w;
+                int dy = gmRadius - h;
+                if ((dx * dx + dy * dy) <= (gmRadius * gmRadius)) {
+                    SDL_RenderDrawPoint(renderer,
+                        siteX + dx,
+                        siteY + 15 + dy);
                 }
             }
+        }
 
-            SDL_SetRenderDrawColor(renderer, 255, 255, 200, 255);
-            for (int w = -2; w <= 2; w++) {
-                for (int h = -2; h <= 2; h++) {
-                    if (w * w + h * h <= 4) {
-                        SDL_RenderDrawPoint(renderer,
-                            site.center.x + w,
-                            site.center.y + 15 + h);
-                    }
+        SDL_SetRenderDrawColor(renderer, 255, 255, 200, 255);
+        for (int w = -2; w <= 2; w++) {
+            for (int h = -2; h <= 2; h++) {
+                if (w * w + h * h <= 4) {
+                    SDL_RenderDrawPoint(renderer,
+                        siteX + w,
+                        siteY + 15 + h);
                 }
             }
-
-            SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
-            SDL_Rect goldRect = { site.center.x - 3, site.center.y + 20, 6, 6 };
-            SDL_RenderFillRect(renderer, &goldRect);
         }
 
-        if (site.hasBarracks) {
-            SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+        SDL_SetRenderDrawColor(renderer, 255, 215, 0, 255);
+        SDL_Rect goldRect = { siteX - 3, siteY + 20, 6, 6 };
+        SDL_RenderFillRect(renderer, &goldRect);
+    });
 
-            SDL_Rect barracksRect = { site.center.x - 8, site.center.y - 25, 16, 10 };
-            SDL_RenderFillRect(renderer, &barracksRect);
+    shown.barracks.forEachSet([&](int i) {
+        int siteX = sites.x[i];
+        int siteY = sites.y[i];
 
+        SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
 
-            SDL_SetRenderDrawColor(renderer, 64, 64, 64, 255);
-            SDL_Rect doorRect = { site.center.x - 2, site.center.y - 18, 4, 6 };
-            SDL_RenderFillRect(renderer, &doorRect);
-        }
+        SDL_Rect barracksRect = { siteX - 8, siteY - 25, 16, 10 };
+        SDL_RenderFillRect(renderer, &barracksRect);
 
-        if (game_data.inCombat && i == game_data.combatSite) {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-            int highlightRadius = 25;
-            for (int angle = 0; angle < 360; angle += 3) {
-                float rad = angle * 3.14159f / 180.0f;
-                int x1 = site.center.x + static_cast<int>(highlightRadius * cos(rad));
-                int y1 = site.center.y + static_cast<int>(highlightRadius * sin(rad));
-                for (int thick = 0; thick < 3; thick++) {
-                    SDL_RenderDrawPoint(renderer, x1 + thick, y1);
-                    SDL_RenderDrawPoint(renderer, x1, y1 + thick);
-                }
+
+        SDL_SetRenderDrawColor(renderer, 64, 64, 64, 255);
+        SDL_Rect doorRect = { siteX - 2, siteY - 18, 4, 6 };
+        SDL_RenderFillRect(renderer, &doorRect);
+    });
+
+    phase = trace_span("buildings", "render", phase);
+
+    if (shown.inCombat && shown.combatSite >= 0 && shown.combatSite < siteCount) {
+        int siteX = sites.x[shown.combatSite];
+        int siteY = sites.y[shown.combatSite];
+
+        SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+        int highlightRadius = 25;
+        for (int angle = 0; angle < 360; angle += 3) {
+            float rad = angle * 3.14159f / 180.0f;
+            int x1 = siteX + static_cast<int>(highlightRadius * cos(rad));
+            int y1 = siteY + static_cast<int>(highlightRadius * sin(rad));
+            for (int thick = 0; thick < 3; thick++) {
+                SDL_RenderDrawPoint(renderer, x1 + thick, y1);
+                SDL_RenderDrawPoint(renderer, x1, y1 + thick);
             }
         }
     }
 
-    renderPlayer(renderer, game_data.player1);
-    renderPlayer(renderer, game_data.player2);
+    for (int i = 0; i < shown.playerCount; i++) {
+        renderPlayer(renderer, shown.players[i]);
+    }
+
+    for (int i = 0; i < shown.playerCount; i++) {
+        renderCaptureBar(renderer, shown.players[i]);
+    }
 
-    renderCaptureBar(renderer, game_data.player1);
-    renderCaptureBar(renderer, game_data.player2);
+    phase = trace_span("players", "render", phase);
+
+    if (replaying) {
+        renderReplayBanner(renderer);
+    }
 
-    Player& myPlayer = (myPlayerNumber == 1) ? game_data.player1 : game_data.player2;
-    if (myPlayer.currentSite >= 0 && myPlayer.currentSite < 8 && !game_data.inCombat) {
-        renderBuildMenu(renderer, myPlayer.currentSite);
+    Player& me = myPlayer();
+    if (me.currentSite >= 0 && me.currentSite < siteCount && !game_data.inCombat) {
+        renderBuildMenu(renderer, me.currentSite);
     }
 
     renderUI(renderer);
     renderCombatUI(renderer);
+    trace_span("ui", "render", phase);
 }
\ No newline at end of file
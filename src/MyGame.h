@@ -1,116 +1,195 @@
 #ifndef __MY_GAME_H__
 #define __MY_GAME_H__
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <cmath>
 #include <limits>
-#include <bitset>
+#include <stdexcept>
 
 #include "SDL.h"
+#include "AllocTracker.h"
+#include "OutboundQueue.h"
+#include "SiteArrays.h"
+#include "SiteBitset.h"
+#include "SpatialIndex.h"
+#include "InboundQueue.h"
+#include "InputLatency.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Protocol.h"
+#include "Simulation.h"
+#include "StateHistory.h"
+#include "Trace.h"
+#include "Traffic.h"
 
 struct Point {
     int x, y;
     Point(int x = 0, int y = 0) : x(x), y(y) {}
 };
 
-struct Site {
-    Point center;
-    SDL_Color neutralColor;
-    bool hasCastle;
-    bool hasGoldMine;
-    bool hasBarracks;
+//A position in 1/256ths of a pixel. Per-step movement is a few pixels at most, so whole
+//pixels would truncate it away at high tick rates; we only round when drawing or looking up sites.
+struct SubPoint {
+    static const int SHIFT = 8;
+    static const int ONE = 1 << SHIFT;
 
-    Site(int x, int y);
+    long long x, y;
+
+    SubPoint(long long x = 0, long long y = 0) : x(x), y(y) {}
+
+    static SubPoint fromPixels(Point p) {
+        return SubPoint(static_cast<long long>(p.x) * ONE, static_cast<long long>(p.y) * ONE);
+    }
+
+    //Nearest whole pixel, halves round up
+    Point toPixels() const {
+        return Point(static_cast<int>((x + ONE / 2) >> SHIFT), static_cast<int>((y + ONE / 2) >> SHIFT));
+    }
 };
 
+//Distance in pixels, kept at sub-pixel precision
+inline double pixel_distance(const SubPoint& a, const SubPoint& b) {
+    double dx = static_cast<double>(b.x - a.x) / SubPoint::ONE;
+    double dy = static_cast<double>(b.y - a.y) / SubPoint::ONE;
+    return std::sqrt(dx * dx + dy * dy);
+}
+
 struct Player {
-    Point position;
+    SubPoint position;
+    SubPoint previousPosition;  //position before the last simulation step, rendering blends from it
     Point targetPosition;
     int playerNumber;
     bool isMoving;
     int currentSite;
     bool isCapturing;
-    float captureProgress;
+    long long captureUs;        //time spent capturing the current site, up to CAPTURE_TIME_US
 
-    Player(int num = 1) : position(400, 300), targetPosition(400, 300),
+    Player(int num = 1) : position(SubPoint::fromPixels(Point(400, 300))), previousPosition(position), targetPosition(400, 300),
         playerNumber(num), isMoving(false), currentSite(-1),
-        isCapturing(false), captureProgress(0.0f) {
+        isCapturing(false), captureUs(0) {
     }
-};
-
-struct GameData {
-    std::vector<Site> sites;
 
-    uint8_t player1Ownership;
-    uint8_t player2Ownership;
+    //Jumps straight to p, render doesn't blend from the old position
+    void placeAt(Point p) {
+        position = SubPoint::fromPixels(p);
+        previousPosition = position;
+    }
 
-    int player1Score;
-    int player2Score;
+    Point pixelPosition() const {
+        return position.toPixels();
+    }
 
-    int player1Gold;
-    int player1Levies;
-    int player2Gold;
-    int player2Levies;
+    //0 to 1, for drawing
+    float captureProgress() const {
+        return static_cast<float>(captureUs) / CAPTURE_TIME_US;
+    }
+};
 
-    Player player1;
-    Player player2;
+struct GameData {
+    SiteArrays sites;
+    int siteVersion;    //bumped whenever the site list changes, so cached per-site data can be rebuilt
+
+    //Everything per player is indexed by player number - 1. Only the first playerCount
+    //entries are in play, the rest stay zeroed so a room can grow without reallocating.
+    int playerCount;
+    Player players[MAX_PLAYERS];
+    SiteBitset ownership[MAX_PLAYERS];
+    int scores[MAX_PLAYERS];
+    int gold[MAX_PLAYERS];
+    int levies[MAX_PLAYERS];
+
+    SiteBitset castles;
+    SiteBitset goldMines;
+    SiteBitset barracks;
 
     bool inCombat;
     int combatSite;
-    float combatTimer;
+    long long combatTimeUs;
     bool canRetreat;
 
     bool gameOver;      
     int winner;
 
-    GameData() : player1Ownership(0), player2Ownership(0),
-        player1Score(0), player2Score(0),
-        player1Gold(0), player1Levies(0),
-        player2Gold(0), player2Levies(0),
-        player1(1), player2(2),
-        inCombat(false), combatSite(-1), combatTimer(0.0f), canRetreat(false) {
-    }
+    Uint64 tick;            //simulation steps since the game started
 
-    bool isPlayer1Owner(int siteIndex) const {
-        return (player1Ownership & (1 << siteIndex)) != 0;
+    GameData() : siteVersion(0), playerCount(2),
+        inCombat(false), combatSite(-1), combatTimeUs(0), canRetreat(false),
+        gameOver(false), winner(0), tick(0) {
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            players[i] = Player(i + 1);
+            scores[i] = gold[i] = levies[i] = 0;
+        }
     }
 
-    bool isPlayer2Owner(int siteIndex) const {
-        return (player2Ownership & (1 << siteIndex)) != 0;
+    static bool isValidPlayer(int number) {
+        return number >= 1 && number <= MAX_PLAYERS;
     }
 
-    bool isNeutral(int siteIndex) const {
-        return !isPlayer1Owner(siteIndex) && !isPlayer2Owner(siteIndex);
+    //number must be valid, the decoder rejects anything else
+    Player& player(int number) {
+        return players[number - 1];
     }
 
-    void setPlayer1Owner(int siteIndex, bool owned) {
-        if (owned) {
-            player1Ownership |= (1 << siteIndex);
-            player2Ownership &= ~(1 << siteIndex);
+    //Rooms only ever grow mid-game, so a message covering more players than we knew about extends the count
+    void notePlayers(int count) {
+        if (count > playerCount && count <= MAX_PLAYERS) {
+            playerCount = count;
         }
-        else {
-            player1Ownership &= ~(1 << siteIndex);
+    }
+
+    //Sizes every per-site bitset to the current site list, keeping bits that still fit
+    void fitBitsetsToSites() {
+        int count = static_cast<int>(sites.size());
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            ownership[i].resize(count);
         }
+        castles.resize(count);
+        goldMines.resize(count);
+        barracks.resize(count);
+    }
+
+    bool isOwner(int player, int siteIndex) const {
+        return ownership[player - 1].test(siteIndex);
     }
 
-    void setPlayer2Owner(int siteIndex, bool owned) {
-        if (owned) {
-            player2Ownership |= (1 << siteIndex);
-            player1Ownership &= ~(1 << siteIndex);
+    //Player number owning the site, 0 if neutral
+    int ownerOf(int siteIndex) const {
+        for (int i = 0; i < playerCount; i++) {
+            if (ownership[i].test(siteIndex)) {
+                return i + 1;
+            }
         }
-        else {
-            player2Ownership &= ~(1 << siteIndex);
+        return 0;
+    }
+
+    bool isNeutral(int siteIndex) const {
+        return ownerOf(siteIndex) == 0;
+    }
+
+    //player 0 makes the site neutral
+    void setOwner(int siteIndex, int player) {
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            ownership[i].assign(siteIndex, i + 1 == player);
         }
     }
 
     void setNeutral(int siteIndex) {
-        player1Ownership &= ~(1 << siteIndex);
-        player2Ownership &= ~(1 << siteIndex);
+        setOwner(siteIndex, 0);
+    }
+
+    int neutralSiteCount() const {
+        int owned = 0;
+        for (int i = 0; i < playerCount; i++) {
+            owned += ownership[i].count();
+        }
+        return static_cast<int>(sites.size()) - owned;
     }
 };
 
+//Only touched on the main thread, the receive thread hands changes over as InboundEvents
 extern GameData game_data;
 
 enum GameState {
@@ -124,45 +203,179 @@ class MyGame {
 private:
     const int SCREEN_WIDTH = 800;
     const int SCREEN_HEIGHT = 600;
+    const double RECOVERY_BUDGET_MS = 1000.0;
+    static const int TERRITORY_STEP = 2;
+    //Server positions further than this from our prediction snap the player
+    const float RECONCILIATION_THRESHOLD = 50.0f;
+
+    //The simulation advances in fixed steps matching the server tick, whatever the frame rate.
+    //update() banks frame time in the accumulator and runs as many whole steps as it covers.
+    //More steps than MAX_STEPS_PER_FRAME in one frame and we drop the backlog rather than fall further behind.
+    static const int MAX_STEPS_PER_FRAME = 8;
+    SimParams sim;
+    long long accumulatorUs;
+    float interpolation;    //fraction of a step the accumulator holds, how far render is past the last step
+
+    //Lockstep games swap state hashes every HASH_INTERVAL ticks to catch desyncs. We remember the last HASH_HISTORY ticks to compare against.
+    static const int HASH_INTERVAL = 30;
+    static const int HASH_HISTORY = 256;
+    bool lockstep;
+    Uint64 hashTicks[HASH_HISTORY];
+    Uint64 hashes[HASH_HISTORY];
+    int desyncs;
+    std::string hashMessage;    //our STATE_HASH, formatted in place so sending it doesn't allocate
+
+    //Round trip for the requests the server answers directly, stamped when queued (there is no ping).
+    //Only the first of several identical requests in flight is timed.
+    enum Request {
+        REQUEST_JOIN,       //JOIN_ROOM -> JOINED_ROOM or ROOM_FULL
+        REQUEST_BUILD,      //BUILD_* -> BUILDINGS
+        REQUEST_RETREAT,    //RETREAT -> RETREAT for us
+        REQUEST_KINDS
+    };
+    Uint64 requestSentAt[REQUEST_KINDS];
+    void noteResponse(Request request);
+
+    //Every tick of the last HISTORY_SECONDS is kept. R replays the last combat from it, with
+    //REPLAY_MARGIN_US either side, into replayView while the live game carries on underneath.
+    static const int HISTORY_SECONDS = 20;
+    const long long REPLAY_MARGIN_US = US_PER_SECOND;
+    StateHistory history;
+    Uint64 combatStartTick;
+    Uint64 lastCombatStart;
+    Uint64 lastCombatEnd;
+    bool replaying;
+    Uint64 replayTick;
+    Uint64 replayEnd;
+    GameData replayView;
 
-    float deltaTime;
     int myPlayerNumber;
     GameState gameState;
     int selectedRoom;
     int roomPlayerCounts[3];
-
-    float distance(int x1, int y1, int x2, int y2);
+    int roomCapacities[3];
+
+    //Session resume state, lets a dropped connection rejoin the same room and seat.
+    //Kept by the receive thread as it decodes, it is what on_reconnect presents.
+    std::string sessionToken;
+    int currentRoom;
+    int sessionPlayer;
+    int lastSnapshotId;
+
+    //Main thread's side of the connection and of a reconnect
+    bool connecting;
+    bool lobbyReceived;
+    bool connectionLost;
+    bool awaitingResync;
+    Uint64 disconnectTime;
+    int appliedSnapshotId;
+
+    //Server messages handed to on_receive (receive thread), and the last of them applied (main thread)
+    Uint32 messagesReceived;
+    Uint32 messagesApplied;
+
+    //Closest-site runs for the territory pass, rebuilt only when the site list changes
+    struct TerritoryRun {
+        int x, y, width;
+        int site;
+    };
+    std::vector<TerritoryRun> territory;
+    int territoryVersion;
+
+    SpatialIndex siteGrid;
+    int siteGridVersion;
+
+    //Scratch for finding which sites an OWNERSHIP changed, kept so applying one doesn't allocate
+    SiteBitset ownershipBefore[MAX_PLAYERS];
+    SiteBitset ownershipChanged;
+
+    void trackSession(InboundEvent& event);
+    void applyEvent(const InboundEvent& event);
+    void reconcilePosition(Player& player, Point serverPosition, bool controlled);
+    void step();
+    void checkStateHash(int player, Uint64 tick, Uint64 hash);
+    void noteCombatEnd();
+    void resetHistory();
+    void startInstantReplay();
+    void advanceReplay(int steps);
+    Point renderPosition(const Player& player) const;
+    const SpatialIndex& siteIndex();
     int findClosestSite(int x, int y);
-    void renderPlayer(SDL_Renderer* renderer, Player& player);
+    void renderPlayer(SDL_Renderer* renderer, const Player& player);
     void renderUI(SDL_Renderer* renderer);
-    void renderText(SDL_Renderer* renderer, const std::string& text, int x, int y, int size);
+    void renderText(SDL_Renderer* renderer, const char* text, int x, int y, int size);
     void renderLobby(SDL_Renderer* renderer);
     void renderWaiting(SDL_Renderer* renderer);
     //void sendSitePositions(); left over from when host initilized site positions (report). 
     void renderBuildMenu(SDL_Renderer* renderer, int siteIndex);
-    void renderCaptureBar(SDL_Renderer* renderer, Player& player);
+    void renderCaptureBar(SDL_Renderer* renderer, const Player& player);
     void renderCombatUI(SDL_Renderer* renderer);
     void renderGameOver(SDL_Renderer* renderer);
+    void renderConnecting(SDL_Renderer* renderer);
+    void renderReconnecting(SDL_Renderer* renderer);
+    void renderReplayBanner(SDL_Renderer* renderer);
+    void finishRecovery();
+    void rebuildTerritory();
     bool isPlayerOnSite(int siteIndex);
+    Player& myPlayer();
 
     SDL_Color getSiteColor(int siteIndex);
 
-public:
-    std::vector<std::string> messages;
+    //Times the private passes directly, see bench/GameBench.cpp
+    friend class GameBench;
 
-    MyGame(int playerNum = 1) : myPlayerNumber(playerNum), gameState(LOBBY), selectedRoom(-1) {
-        roomPlayerCounts[0] = 0;
-        roomPlayerCounts[1] = 0;
-        roomPlayerCounts[2] = 0;
+public:
+    OutboundQueue outbound;
+    InboundQueue inbound;
+    TrafficStats traffic;
+    InputLatency latency;
+
+    MyGame(int playerNum = 1) : accumulatorUs(0), interpolation(0.0f), lockstep(false), desyncs(0),
+        history(HISTORY_SECONDS, 60), combatStartTick(0), lastCombatStart(0), lastCombatEnd(0),
+        replaying(false), replayTick(0), replayEnd(0),
+        myPlayerNumber(playerNum), gameState(LOBBY), selectedRoom(-1),
+        currentRoom(-1), sessionPlayer(-1), lastSnapshotId(-1), connecting(false), lobbyReceived(false), connectionLost(false), awaitingResync(false),
+        disconnectTime(0), appliedSnapshotId(-1), messagesReceived(0), messagesApplied(0),
+        territoryVersion(-1), siteGridVersion(-1) {
+        for (int i = 0; i < 3; i++) {
+            roomPlayerCounts[i] = 0;
+            roomCapacities[i] = 2;
+        }
+        for (int i = 0; i < HASH_HISTORY; i++) {
+            hashTicks[i] = 0;
+            hashes[i] = 0;
+        }
+        hashMessage.reserve(OUTBOUND_MESSAGE_BYTES);
+        for (int i = 0; i < REQUEST_KINDS; i++) {
+            requestSentAt[i] = 0;
+        }
     }
 
     void initialize();
     void on_receive(std::string cmd, std::vector<std::string>& args);
-    void send(std::string message);
+    void send(const std::string& message);
+    void processEvents();
+    //Sequence numbers of server messages, counted from 1 in the order on_receive got them.
+    //A recording notes appliedMessages() at each drain so a replay applies exactly the same ones.
+    Uint32 receivedMessages() const { return messagesReceived; }
+    Uint32 appliedMessages() const { return messagesApplied; }
+    void on_connecting();
+    void on_connected();
+    void on_disconnect();
+    std::string on_reconnect();
     void input(SDL_Event& event);
     void update(float dt);
+    //Simulation steps per second, should match the server's tick
+    void setTickRate(int hz);
+    void setLockstep(bool enabled);
+    int getDesyncCount() const { return desyncs; }
+    StateHistory& getHistory() { return history; }
     void render(SDL_Renderer* renderer);
     int getPlayerNumber() const { return myPlayerNumber; }
+    //The server's room list has been applied, what time-to-lobby waits for
+    bool hasLobby() const { return lobbyReceived; }
+    //In a game and connected, the state the allocation budget applies to
+    bool isPlaying() const { return gameState == PLAYING && !game_data.gameOver && !connectionLost; }
 };
 
 #endif
\ No newline at end of file
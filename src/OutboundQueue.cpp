@@ -0,0 +1,216 @@
+#include "OutboundQueue.h"
+
+#include <cstring>
+#include <iostream>
+
+static const char* PRIORITY_NAMES[PRIORITY_COUNT] = { "CRITICAL", "NORMAL", "BULK" };
+static const char* PRIORITY_LABELS[PRIORITY_COUNT] = { "priority=\"critical\"", "priority=\"normal\"", "priority=\"bulk\"" };
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+SendPriority classify_message(const std::string& message) {
+    if (starts_with(message, "RETREAT") || starts_with(message, "MOVE") || starts_with(message, "RESUME")) {
+        return PRIORITY_CRITICAL;
+    }
+    if (starts_with(message, "JOIN_ROOM") || starts_with(message, "BUILD_")) {
+        return PRIORITY_NORMAL;
+    }
+    return PRIORITY_BULK;
+}
+
+//Only these go on the wire as-is, everything else is wrapped as CLIENT_DATA
+static void wire_format(const std::string& message, std::string& wire) {
+    if (starts_with(message, "JOIN_ROOM") ||
+        starts_with(message, "PLAYER_CURRENT_POS") ||
+        starts_with(message, "BUILD_CASTLE") ||
+        starts_with(message, "BUILD_GOLD_MINE") ||
+        starts_with(message, "BUILD_BARRACKS") ||
+        starts_with(message, "RETREAT") ||
+        starts_with(message, "RESUME") ||
+        starts_with(message, "STATE_HASH")) {
+        wire.assign(message);
+        return;
+    }
+    wire.assign("CLIENT_DATA,");
+    wire.append(message);
+}
+
+//Commands where only the latest pending one matters, keyed by command and player number.
+//Length of the key at the start of message, 0 if a newer message never replaces this one.
+static size_t supersede_key_length(const std::string& message) {
+    if (!starts_with(message, "MOVE,") && !starts_with(message, "PLAYER_CURRENT_POS,")) {
+        return 0;
+    }
+
+    size_t firstComma = message.find(',');
+    size_t secondComma = message.find(',', firstComma + 1);
+    return secondComma == std::string::npos ? message.size() : secondComma;
+}
+
+OutboundQueue::OutboundQueue(size_t capacity) : queued(0), capacity(capacity) {
+    lock = SDL_CreateMutex();
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        //Any one lane can hold everything, plus a message the send thread puts back
+        lanes[p].slots.resize(capacity + 1);
+        for (size_t i = 0; i < lanes[p].slots.size(); i++) {
+            lanes[p].slots[i].wire.reserve(OUTBOUND_MESSAGE_BYTES);
+        }
+        delays[p].publish("outbound_queue_delay_us", "Time outbound messages wait to be sent", PRIORITY_LABELS[p]);
+        superseded[p].publish("outbound_superseded_total", "Outbound messages replaced by a newer one before sending", PRIORITY_LABELS[p]);
+        dropped[p].publish("outbound_dropped_total", "Outbound messages dropped because the queue was full", PRIORITY_LABELS[p]);
+    }
+}
+
+OutboundQueue::~OutboundQueue() {
+    SDL_DestroyMutex(lock);
+}
+
+static void fill(OutboundMessage& entry, const std::string& message, size_t keyLength, SendPriority priority, int inputTag) {
+    wire_format(message, entry.wire);
+    entry.supersedeKey.assign(message, 0, keyLength);
+    entry.priority = priority;
+    entry.enqueuedAt = SDL_GetPerformanceCounter();
+    entry.inputTag = inputTag;
+    entry.requeued = false;
+}
+
+bool OutboundQueue::push(const std::string& message, int inputTag) {
+    SendPriority priority = classify_message(message);
+    size_t keyLength = supersede_key_length(message);
+
+    SDL_LockMutex(lock);
+
+    OutboundLane& lane = lanes[priority];
+
+    //A newer intent takes the place of the stale one, so it goes out no later than that would have
+    if (keyLength > 0) {
+        for (size_t i = 0; i < lane.count; i++) {
+            const std::string& key = lane.at(i).supersedeKey;
+            if (key.size() == keyLength && message.compare(0, keyLength, key) == 0) {
+                fill(lane.at(i), message, keyLength, priority, inputTag);
+                superseded[priority].add();
+                SDL_UnlockMutex(lock);
+                return true;
+            }
+        }
+    }
+
+    if (queued >= capacity) {
+        //Make room by evicting the oldest message of the lowest class below this one
+        int victim = -1;
+        for (int p = PRIORITY_COUNT - 1; p > priority; p--) {
+            if (lanes[p].count > 0) {
+                victim = p;
+                break;
+            }
+        }
+
+        if (victim < 0) {
+            dropped[priority].add();
+            SDL_UnlockMutex(lock);
+            return false;
+        }
+
+        lanes[victim].popFront();
+        dropped[victim].add();
+        queued--;
+    }
+
+    fill(lane.pushBack(), message, keyLength, priority, inputTag);
+    queued++;
+
+    SDL_UnlockMutex(lock);
+    return true;
+}
+
+bool OutboundQueue::pop(OutboundMessage& out) {
+    SDL_LockMutex(lock);
+
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        if (lanes[p].count > 0) {
+            out = lanes[p].at(0);
+            lanes[p].popFront();
+            queued--;
+
+            if (!out.requeued) {
+                delays[p].record(metrics_elapsed_us(out.enqueuedAt));
+            }
+
+            SDL_UnlockMutex(lock);
+            return true;
+        }
+    }
+
+    SDL_UnlockMutex(lock);
+    return false;
+}
+
+void OutboundQueue::requeue(const OutboundMessage& message) {
+    SDL_LockMutex(lock);
+
+    OutboundLane& lane = lanes[message.priority];
+
+    //Anything still in the lane was queued after this message was popped, so it is the newer intent
+    if (!message.supersedeKey.empty()) {
+        for (size_t i = 0; i < lane.count; i++) {
+            if (lane.at(i).supersedeKey == message.supersedeKey) {
+                superseded[message.priority].add();
+                SDL_UnlockMutex(lock);
+                return;
+            }
+        }
+    }
+
+    //The spare slot is for this, but only one message is ever out with the send thread
+    if (lane.full()) {
+        dropped[message.priority].add();
+        SDL_UnlockMutex(lock);
+        return;
+    }
+
+    //Over capacity for a moment is fine, this message was already accounted for
+    OutboundMessage& entry = lane.pushFront();
+    entry = message;
+    entry.requeued = true;
+    queued++;
+
+    SDL_UnlockMutex(lock);
+}
+
+void OutboundQueue::clear() {
+    SDL_LockMutex(lock);
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        lanes[p].first = 0;
+        lanes[p].count = 0;
+    }
+    queued = 0;
+    SDL_UnlockMutex(lock);
+}
+
+size_t OutboundQueue::size() {
+    SDL_LockMutex(lock);
+    size_t total = queued;
+    SDL_UnlockMutex(lock);
+    return total;
+}
+
+void OutboundQueue::printStats() {
+    SDL_LockMutex(lock);
+
+    std::cout << "=== OUTBOUND QUEUE DELAY (us) ===" << std::endl;
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        const Histogram& d = delays[p];
+        std::cout << PRIORITY_NAMES[p] << ": " << d.count() << " sent, " << superseded[p].get() << " superseded, "
+            << dropped[p].get() << " dropped";
+        if (d.count() > 0) {
+            std::cout << ", mean " << d.mean() << ", p50 <" << d.percentile(0.50)
+                << ", p99 <" << d.percentile(0.99) << ", max " << d.max();
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "=================================" << std::endl;
+
+    SDL_UnlockMutex(lock);
+}
@@ -0,0 +1,98 @@
+#ifndef __OUTBOUND_QUEUE_H__
+#define __OUTBOUND_QUEUE_H__
+
+#include <string>
+#include <vector>
+
+#include "SDL.h"
+#include "Metrics.h"
+
+//Outbound priority classes, lower value is sent first
+enum SendPriority {
+    PRIORITY_CRITICAL,  //RETREAT, MOVE, RESUME - has to land inside the combat/movement window
+    PRIORITY_NORMAL,    //JOIN_ROOM, BUILD_*
+    PRIORITY_BULK,      //PLAYER_CURRENT_POS, CLIENT_DATA
+    PRIORITY_COUNT
+};
+
+SendPriority classify_message(const std::string& message);
+
+//Most messages that can be waiting to go out at once, across all lanes
+const size_t OUTBOUND_CAPACITY = 64;
+
+//Reserved for each queued message up front, longer than anything sent during play
+const size_t OUTBOUND_MESSAGE_BYTES = 64;
+
+struct OutboundMessage {
+    std::string wire;       //what goes on the socket, CLIENT_DATA prefix already applied
+    std::string supersedeKey; //"MOVE,<player>" etc, empty if a newer message never replaces this one
+    SendPriority priority;
+    Uint64 enqueuedAt;
+    int inputTag;           //InputLatency tag of the click that sent it, -1 if none
+    bool requeued;          //put back after a failed write, its queue delay is already recorded
+};
+
+//FIFO ring of preallocated messages. Slots are overwritten in place, so their strings keep
+//their capacity and queueing a message copies into storage that is already there.
+struct OutboundLane {
+    std::vector<OutboundMessage> slots;
+    size_t first;
+    size_t count;
+
+    OutboundLane() : first(0), count(0) {}
+
+    bool full() const { return count == slots.size(); }
+    OutboundMessage& at(size_t i) { return slots[(first + i) % slots.size()]; }
+
+    OutboundMessage& pushBack() {
+        count++;
+        return at(count - 1);
+    }
+
+    OutboundMessage& pushFront() {
+        first = (first + slots.size() - 1) % slots.size();
+        count++;
+        return slots[first];
+    }
+
+    void popFront() {
+        first = (first + 1) % slots.size();
+        count--;
+    }
+};
+
+//Thread-safe, bounded outbound queue with one FIFO lane per priority class. The game
+//thread pushes, the send thread pops the highest priority message available.
+//MOVE and PLAYER_CURRENT_POS replace their pending predecessor in place. When full, the
+//oldest message of a lower class is evicted, otherwise the new message is dropped.
+//Pushing allocates nothing once a slot's strings have grown to the message.
+class OutboundQueue {
+
+private:
+    SDL_mutex* lock;
+    OutboundLane lanes[PRIORITY_COUNT];
+    size_t queued;
+    size_t capacity;
+
+    //Published as outbound_queue_delay_us, outbound_superseded_total and outbound_dropped_total
+    Histogram delays[PRIORITY_COUNT];   //microseconds from push to pop
+    Counter superseded[PRIORITY_COUNT];
+    Counter dropped[PRIORITY_COUNT];
+
+public:
+    OutboundQueue(size_t capacity = OUTBOUND_CAPACITY);
+    ~OutboundQueue();
+
+    //Returns false if the message had to be dropped because the queue is full
+    bool push(const std::string& message, int inputTag = -1);
+    bool pop(OutboundMessage& out);
+    //Puts back a message that could not be written, it goes out first once the socket is back.
+    //Dropped instead if a newer message with the same supersede key was queued in the meantime.
+    void requeue(const OutboundMessage& message);
+    void clear();
+    size_t size();
+
+    void printStats();
+};
+
+#endif
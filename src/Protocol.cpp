@@ -0,0 +1,378 @@
+#include "Protocol.h"
+
+#include <cmath>
+#include <stdexcept>
+
+bool parse_message(const char* message, int length, std::string& cmd, std::vector<std::string>& args) {
+    cmd.clear();
+    args.clear();
+
+    int start = 0;
+    bool haveCmd = false;
+
+    for (int i = 0; i <= length; i++) {
+        if (i < length && message[i] != ',' && message[i] != '\0') {
+            continue;
+        }
+
+        if (i > start) {
+            if (!haveCmd) {
+                cmd.assign(message + start, i - start);
+                haveCmd = true;
+            }
+            else {
+                args.push_back(std::string(message + start, i - start));
+            }
+        }
+
+        start = i + 1;
+
+        if (i < length && message[i] == '\0') {
+            break;
+        }
+    }
+
+    return haveCmd;
+}
+
+MessageFramer::MessageFramer() : start(0), scanned(0), skipping(false), dropped(0) {
+    buffer.reserve(64 * 1024);
+}
+
+void MessageFramer::feed(const char* data, int length) {
+    //Only ever a partial message left in front, so this moves little
+    if (start > 0) {
+        buffer.erase(0, start);
+        scanned -= start;
+        start = 0;
+    }
+    buffer.append(data, length);
+}
+
+bool MessageFramer::next(const char*& message, int& length) {
+    for (size_t i = scanned; i < buffer.size(); i++) {
+        if (buffer[i] != '\n' && buffer[i] != '\0') {
+            continue;
+        }
+
+        size_t begin = start;
+        size_t end = i;
+        start = scanned = i + 1;
+
+        if (skipping) {
+            skipping = false;
+            continue;
+        }
+        if (end > begin && buffer[end - 1] == '\r') {
+            end--;
+        }
+        //Blank line, or a '\0' straight after a '\n'
+        if (end == begin) {
+            continue;
+        }
+
+        message = buffer.data() + begin;
+        length = static_cast<int>(end - begin);
+        return true;
+    }
+
+    scanned = buffer.size();
+    if (scanned - start > MAX_MESSAGE_BYTES) {
+        if (!skipping) {
+            dropped++;
+            skipping = true;
+        }
+        start = scanned;
+    }
+    return false;
+}
+
+void MessageFramer::reset() {
+    buffer.clear();
+    start = scanned = 0;
+    skipping = false;
+}
+
+//Rejects nan/inf so a malformed timer can't poison the countdown maths
+static float parse_timer(const std::string& arg) {
+    float value = std::stof(arg);
+    if (!std::isfinite(value)) {
+        throw std::invalid_argument("non-finite timer");
+    }
+    return value;
+}
+
+static void parse_ints(const std::vector<std::string>& args, size_t first, int count, int* out) {
+    for (int i = 0; i < count; i++) {
+        out[i] = std::stoi(args.at(first + i));
+    }
+}
+
+static int parse_player(const std::string& arg) {
+    int player = std::stoi(arg);
+    if (player < 1 || player > MAX_PLAYERS) {
+        throw std::out_of_range("player number");
+    }
+    return player;
+}
+
+static int parse_player_count(const std::string& arg) {
+    int count = std::stoi(arg);
+    if (count < 2 || count > MAX_PLAYERS) {
+        throw std::out_of_range("player count");
+    }
+    return count;
+}
+
+//Per-player flags, bit i is player i + 1
+static int parse_player_mask(const std::string& arg) {
+    return std::stoi(arg) & ((1 << MAX_PLAYERS) - 1);
+}
+
+//Two player servers pack everything into one byte: bits 0-1 moving, bits 2-3 capturing, bit 4 in combat
+static void unpack_player_states(int packed, int* out) {
+    packed &= 0xFF;
+    out[0] = packed & 0x03;
+    out[1] = (packed >> 2) & 0x03;
+    out[2] = (packed >> 4) & 0x01;
+}
+
+static InboundPayload& payload_of(InboundEvent& event) {
+    if (!event.payload) {
+        throw std::invalid_argument("event has no payload");
+    }
+    return *event.payload;
+}
+
+//Pairs of (a, b) per player starting at args[first]
+static void parse_pairs(const std::vector<std::string>& args, size_t first, int players, int* a, int* b) {
+    for (int i = 0; i < players; i++) {
+        a[i] = std::stoi(args.at(first + i * 2));
+        b[i] = std::stoi(args.at(first + i * 2 + 1));
+    }
+}
+
+//FULL_STATE from a two player server:
+//  ownership p1, p2, castles, gold mines, barracks, player states, scores x2,
+//  gold/levies x2, target positions x2, combat flags, combat timer[, combat site]
+static bool decode_legacy_full_state(const std::vector<std::string>& args, InboundEvent& event) {
+    if (args.size() < 18) return false;
+
+    InboundPayload& payload = payload_of(event);
+    event.players = 2;
+    payload.ownership[0].decode(args.at(0));
+    payload.ownership[1].decode(args.at(1));
+    for (int i = 0; i < BUILDING_KINDS; i++) {
+        payload.buildings[i].decode(args.at(2 + i));
+    }
+    unpack_player_states(std::stoi(args.at(5)), event.values);
+    parse_ints(args, 6, 2, event.scores);
+    parse_pairs(args, 8, 2, event.gold, event.levies);
+    parse_pairs(args, 12, 2, event.x, event.y);
+    event.values[3] = static_cast<uint8_t>(std::stoi(args.at(16)));
+    event.timer = parse_timer(args.at(17));
+    event.values[4] = args.size() >= 19 ? std::stoi(args.at(18)) : -1;
+    return true;
+}
+
+//FULL_STATE for any room size, tagged with the player count as "P<n>":
+//  P<n>, ownership x n, castles, gold mines, barracks, moving mask, capturing mask, in combat,
+//  scores x n, gold/levies x n, target positions x n, combat flags, combat timer, combat site
+static bool decode_full_state(const std::vector<std::string>& args, InboundEvent& event) {
+    int n = parse_player_count(args.at(0).substr(1));
+    size_t expected = 10 + 6 * static_cast<size_t>(n);
+    if (args.size() < expected) return false;
+
+    InboundPayload& payload = payload_of(event);
+    event.players = n;
+    size_t a = 1;
+    for (int i = 0; i < n; i++) {
+        payload.ownership[i].decode(args.at(a++));
+    }
+    for (int i = 0; i < BUILDING_KINDS; i++) {
+        payload.buildings[i].decode(args.at(a++));
+    }
+    event.values[0] = parse_player_mask(args.at(a++));
+    event.values[1] = parse_player_mask(args.at(a++));
+    event.values[2] = std::stoi(args.at(a++)) != 0;
+    parse_ints(args, a, n, event.scores);
+    a += n;
+    parse_pairs(args, a, n, event.gold, event.levies);
+    a += 2 * n;
+    parse_pairs(args, a, n, event.x, event.y);
+    a += 2 * n;
+    event.values[3] = static_cast<uint8_t>(std::stoi(args.at(a++)));
+    event.timer = parse_timer(args.at(a++));
+    event.values[4] = std::stoi(args.at(a++));
+    return true;
+}
+
+bool decode_message(const std::string& cmd, const std::vector<std::string>& args, InboundEvent& event) {
+    int* v = event.values;
+
+    if (cmd == "LOBBY_INFO") {
+        //Player counts for rooms 1-3, optionally followed by each room's capacity (2 if absent)
+        if (args.size() != 3 && args.size() != 6) return false;
+        event.type = EVENT_LOBBY_INFO;
+        parse_ints(args, 0, 3, v);
+        for (int i = 0; i < 3; i++) {
+            v[3 + i] = args.size() == 6 ? parse_player_count(args.at(3 + i)) : 2;
+        }
+    }
+    else if (cmd == "JOINED_ROOM") {
+        if (args.size() < 2) return false;
+        event.type = EVENT_JOINED_ROOM;
+        v[0] = std::stoi(args.at(0));
+        v[1] = parse_player(args.at(1));
+        //Optional third arg is the session token used to resume after a dropped connection,
+        //optional fourth the room's player count
+        if (args.size() >= 3) {
+            payload_of(event).token = args.at(2);
+        }
+        v[2] = args.size() >= 4 ? parse_player_count(args.at(3)) : 0;
+    }
+    else if (cmd == "ROOM_FULL") {
+        if (args.size() < 1) return false;
+        event.type = EVENT_ROOM_FULL;
+        parse_ints(args, 0, 1, v);
+    }
+    else if (cmd == "SNAPSHOT") {
+        if (args.size() < 1) return false;
+        event.type = EVENT_SNAPSHOT;
+        parse_ints(args, 0, 1, v);
+    }
+    else if (cmd == "RESUMED") {
+        if (args.size() < 2) return false;
+        event.type = EVENT_RESUMED;
+        v[0] = std::stoi(args.at(0));
+        v[1] = parse_player(args.at(1));
+    }
+    else if (cmd == "RESUME_FAILED") {
+        event.type = EVENT_RESUME_FAILED;
+    }
+    else if (cmd == "GAME_START") {
+        event.type = EVENT_GAME_START;
+        v[0] = args.size() >= 1 ? parse_player_count(args.at(0)) : 0;
+    }
+    else if (cmd == "SITE_POSITIONS") {
+        //x,y pairs, one per site
+        if (args.size() < 2 || args.size() % 2 != 0 || args.size() / 2 > MAX_SITES) return false;
+        event.type = EVENT_SITE_POSITIONS;
+        std::vector<int>& coords = payload_of(event).coords;
+        coords.resize(args.size());
+        parse_ints(args, 0, static_cast<int>(args.size()), &coords[0]);
+    }
+    else if (cmd == "OWNERSHIP") {
+        //One bitset per player
+        if (args.size() < 2 || args.size() > MAX_PLAYERS) return false;
+        event.type = EVENT_OWNERSHIP;
+        event.players = static_cast<int>(args.size());
+        InboundPayload& payload = payload_of(event);
+        for (int i = 0; i < event.players; i++) {
+            payload.ownership[i].decode(args.at(i));
+        }
+    }
+    else if (cmd == "SCORES") {
+        if (args.size() < 2 || args.size() > MAX_PLAYERS) return false;
+        event.type = EVENT_SCORES;
+        event.players = static_cast<int>(args.size());
+        parse_ints(args, 0, event.players, event.scores);
+    }
+    else if (cmd == "RESOURCES") {
+        //gold,levies pairs, one per player
+        if (args.size() < 4 || args.size() % 2 != 0 || args.size() / 2 > MAX_PLAYERS) return false;
+        event.type = EVENT_RESOURCES;
+        event.players = static_cast<int>(args.size() / 2);
+        parse_pairs(args, 0, event.players, event.gold, event.levies);
+    }
+    else if (cmd == "PLAYER_POS") {
+        if (args.size() < 3) return false;
+        event.type = EVENT_PLAYER_POS;
+        v[0] = parse_player(args.at(0));
+        parse_ints(args, 1, 2, v + 1);
+    }
+    else if (cmd == "BUILDINGS") {
+        if (args.size() < BUILDING_KINDS) return false;
+        event.type = EVENT_BUILDINGS;
+        InboundPayload& payload = payload_of(event);
+        for (int i = 0; i < BUILDING_KINDS; i++) {
+            payload.buildings[i].decode(args.at(i));
+        }
+    }
+    else if (cmd == "PLAYER_STATES") {
+        //Either the two player packed byte or moving mask, capturing mask, in combat
+        if (args.size() < 1) return false;
+        event.type = EVENT_PLAYER_STATES;
+        if (args.size() >= 3) {
+            v[0] = parse_player_mask(args.at(0));
+            v[1] = parse_player_mask(args.at(1));
+            v[2] = std::stoi(args.at(2)) != 0;
+        }
+        else {
+            unpack_player_states(std::stoi(args.at(0)), v);
+        }
+    }
+    else if (cmd == "COMBAT_STATE") {
+        if (args.size() < 2) return false;
+        event.type = EVENT_COMBAT_STATE;
+        v[0] = static_cast<uint8_t>(std::stoi(args.at(0)));
+        event.timer = parse_timer(args.at(1));
+        v[1] = args.size() >= 3 ? std::stoi(args.at(2)) : -1;
+    }
+    else if (cmd == "FULL_STATE") {
+        if (args.empty()) return false;
+        event.type = EVENT_FULL_STATE;
+        bool tagged = !args.at(0).empty() && args.at(0)[0] == 'P';
+        if (!(tagged ? decode_full_state(args, event) : decode_legacy_full_state(args, event))) {
+            return false;
+        }
+    }
+    else if (cmd == "GAME_OVER") {
+        if (args.size() < 1) return false;
+        event.type = EVENT_GAME_OVER;
+        parse_ints(args, 0, 1, v);
+    }
+    else if (cmd == "COMBAT_START") {
+        if (args.size() < 1) return false;
+        event.type = EVENT_COMBAT_START;
+        parse_ints(args, 0, 1, v);
+    }
+    else if (cmd == "COMBAT_INTERRUPT") {
+        event.type = EVENT_COMBAT_INTERRUPT;
+    }
+    else if (cmd == "COMBAT_END") {
+        if (args.size() < 1) return false;
+        event.type = EVENT_COMBAT_END;
+        parse_ints(args, 0, 1, v);
+    }
+    else if (cmd == "RETREAT") {
+        if (args.size() < 2) return false;
+        event.type = EVENT_RETREAT;
+        parse_ints(args, 0, 2, v);
+    }
+    else if (cmd == "POSITIONS") {
+        //x,y pairs, one per player
+        if (args.size() < 4 || args.size() % 2 != 0 || args.size() / 2 > MAX_PLAYERS) return false;
+        event.type = EVENT_POSITIONS;
+        event.players = static_cast<int>(args.size() / 2);
+        parse_pairs(args, 0, event.players, event.x, event.y);
+    }
+    else if (cmd == "STATE_HASH") {
+        //Lockstep desync check from another client: player, tick, 64-bit hash in hex
+        if (args.size() < 3) return false;
+        event.type = EVENT_STATE_HASH;
+        v[0] = parse_player(args.at(0));
+        event.tick = std::stoull(args.at(1));
+        event.hash = std::stoull(args.at(2), nullptr, 16);
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+bool message_has_payload(const std::string& cmd) {
+    return cmd == "SITE_POSITIONS" || cmd == "OWNERSHIP" || cmd == "BUILDINGS" || cmd == "FULL_STATE" ||
+        cmd == "JOINED_ROOM";
+}
@@ -0,0 +1,57 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <string>
+#include <vector>
+
+#include "InboundQueue.h"
+
+//Upper bound on the number of sites a map can have
+const int MAX_SITES = 4096;
+
+//Splits a raw "CMD,arg,arg,..." message into its command and arguments.
+//Empty fields are skipped, matching the strtok based parsing this replaced.
+//Returns false if the message has no command.
+bool parse_message(const char* message, int length, std::string& cmd, std::vector<std::string>& args);
+
+//Cuts the TCP byte stream back into messages. The server ends every message with '\n' ('\0' is
+//accepted too). A recv can hold part of a message, a SITE_POSITIONS for a large map spans many,
+//or several messages at once. The buffer grows to the largest message seen and is then reused.
+class MessageFramer {
+
+private:
+    std::string buffer;
+    size_t start;           //first byte of the message being received
+    size_t scanned;         //bytes before this are known not to end a message
+    bool skipping;          //dropping an oversized message up to its terminator
+    size_t dropped;
+
+public:
+    //Messages longer than this are dropped rather than buffered without limit
+    static const size_t MAX_MESSAGE_BYTES = 1 << 20;
+
+    MessageFramer();
+
+    void feed(const char* data, int length);
+    //Next complete message, without its terminator. Returns false once only a partial message
+    //is left. message points into the buffer and stays valid until the next feed.
+    bool next(const char*& message, int& length);
+    //Forgets a partial message, after the connection it came on is gone
+    void reset();
+
+    size_t droppedMessages() const { return dropped; }
+};
+
+//Turns a parsed server message into a typed event. Returns false for commands the client
+//doesn't handle or with too few arguments, throws std::invalid_argument/out_of_range on
+//malformed numbers or bitsets. Bitsets keep the size of their encoding, the main thread
+//fits them to the site list when applying.
+//The event needs a payload (InboundQueue::acquire with withPayload) for the commands where
+//message_has_payload is true, decoding one without throws std::invalid_argument.
+bool decode_message(const std::string& cmd, const std::vector<std::string>& args, InboundEvent& event);
+
+//SITE_POSITIONS, OWNERSHIP, BUILDINGS, FULL_STATE and JOINED_ROOM: the commands whose events
+//carry bitsets, coordinates or a token
+bool message_has_payload(const std::string& cmd);
+
+#endif
@@ -0,0 +1,200 @@
+#include "Recorder.h"
+
+#include <cstring>
+
+static const char RECORD_MAGIC[8] = { 'R', 'T', 'S', 'R', 'E', 'C', '0', '1' };
+
+//Flush at most once a second so a crash loses little without paying for a flush per message
+static const Uint32 RECORD_FLUSH_INTERVAL_MS = 1000;
+
+//Anything bigger than this is a corrupt length, not a real message
+static const Uint64 RECORD_MAX_PAYLOAD = 1 << 20;
+
+static size_t encode_varint(Uint64 value, Uint8* out) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<Uint8>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<Uint8>(value);
+    return n;
+}
+
+static bool read_varint(FILE* file, Uint64& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            return false;
+        }
+        value |= static_cast<Uint64>(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Recorder::~Recorder() {
+    close();
+    if (lock) {
+        SDL_DestroyMutex(lock);
+    }
+}
+
+bool Recorder::open(const std::string& path) {
+    close();
+
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    fwrite(RECORD_MAGIC, 1, sizeof(RECORD_MAGIC), file);
+
+    if (!lock) {
+        lock = SDL_CreateMutex();
+    }
+    startCounter = SDL_GetPerformanceCounter();
+    lastTimeNs = 0;
+    lastFlush = SDL_GetTicks();
+    return true;
+}
+
+void Recorder::close() {
+    if (!file) {
+        return;
+    }
+
+    //The network threads may still be writing, so close under the lock and keep the mutex around
+    SDL_LockMutex(lock);
+    fclose(file);
+    file = nullptr;
+    SDL_UnlockMutex(lock);
+}
+
+void Recorder::write(int type, const void* payload, size_t length) {
+    if (!file) {
+        return;
+    }
+
+    SDL_LockMutex(lock);
+
+    if (!file) {
+        SDL_UnlockMutex(lock);
+        return;
+    }
+
+    //Taken under the lock so deltas are never negative across threads
+    Uint64 elapsed = SDL_GetPerformanceCounter() - startCounter;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 nowNs = (elapsed / freq) * 1000000000ULL + (elapsed % freq) * 1000000000ULL / freq;
+
+    Uint8 header[21];
+    size_t n = encode_varint(nowNs - lastTimeNs, header);
+    header[n++] = static_cast<Uint8>(type);
+    n += encode_varint(length, header + n);
+
+    fwrite(header, 1, n, file);
+    if (length > 0) {
+        fwrite(payload, 1, length, file);
+    }
+    lastTimeNs = nowNs;
+
+    Uint32 now = SDL_GetTicks();
+    if (now - lastFlush >= RECORD_FLUSH_INTERVAL_MS) {
+        fflush(file);
+        lastFlush = now;
+    }
+
+    SDL_UnlockMutex(lock);
+}
+
+void Recorder::recordInbound(const char* data, int length) {
+    write(RECORD_INBOUND, data, length);
+}
+
+void Recorder::recordOutbound(const std::string& message) {
+    write(RECORD_OUTBOUND, message.data(), message.length());
+}
+
+void Recorder::recordFrame(float dt) {
+    Uint8 payload[4];
+    memcpy(payload, &dt, sizeof(payload));
+    write(RECORD_FRAME, payload, sizeof(payload));
+}
+
+void Recorder::recordClick(int x, int y) {
+    Uint8 payload[4] = {
+        static_cast<Uint8>(x & 0xFF), static_cast<Uint8>((x >> 8) & 0xFF),
+        static_cast<Uint8>(y & 0xFF), static_cast<Uint8>((y >> 8) & 0xFF)
+    };
+    write(RECORD_CLICK, payload, sizeof(payload));
+}
+
+void Recorder::recordKey(int keycode) {
+    Uint8 payload[4] = {
+        static_cast<Uint8>(keycode & 0xFF), static_cast<Uint8>((keycode >> 8) & 0xFF),
+        static_cast<Uint8>((keycode >> 16) & 0xFF), static_cast<Uint8>((keycode >> 24) & 0xFF)
+    };
+    write(RECORD_KEY, payload, sizeof(payload));
+}
+
+void Recorder::recordDrain(Uint32 appliedMessages) {
+    Uint8 payload[4] = {
+        static_cast<Uint8>(appliedMessages & 0xFF), static_cast<Uint8>((appliedMessages >> 8) & 0xFF),
+        static_cast<Uint8>((appliedMessages >> 16) & 0xFF), static_cast<Uint8>((appliedMessages >> 24) & 0xFF)
+    };
+    write(RECORD_DRAIN, payload, sizeof(payload));
+}
+
+bool RecordReader::open(const std::string& path) {
+    close();
+
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char magic[sizeof(RECORD_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+        close();
+        return false;
+    }
+
+    timeNs = 0;
+    return true;
+}
+
+void RecordReader::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool RecordReader::next(Record& record) {
+    if (!file) {
+        return false;
+    }
+
+    Uint64 delta, length;
+    if (!read_varint(file, delta)) {
+        return false;
+    }
+
+    int type = fgetc(file);
+    if (type == EOF || !read_varint(file, length) || length > RECORD_MAX_PAYLOAD) {
+        return false;
+    }
+
+    record.payload.resize(static_cast<size_t>(length));
+    if (length > 0 && fread(&record.payload[0], 1, static_cast<size_t>(length), file) != length) {
+        return false;
+    }
+
+    timeNs += delta;
+    record.timeNs = timeNs;
+    record.type = type;
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <cstdio>
+#include <string>
+
+#include "SDL.h"
+
+//Wire traffic log, one file per session:
+//  header:  "RTSREC01"
+//  record:  varint timeDeltaNs, u8 type, varint payloadLength, payload
+//Times are deltas from the previous record so the common case fits in a few bytes.
+enum RecordType {
+    RECORD_INBOUND = 1,     //one server message as framed from the stream, without its terminator
+    RECORD_OUTBOUND = 2,    //message as written to the socket
+    RECORD_FRAME = 3,       //float dt handed to MyGame::update
+    RECORD_CLICK = 4,       //int16 x, int16 y of a mouse click handed to MyGame::input
+    RECORD_DRAIN = 5,       //u32 MyGame::appliedMessages() after the frame's MyGame::processEvents
+    RECORD_KEY = 6          //int32 SDL_Keycode of a key press handed to MyGame::input
+};
+
+struct Record {
+    Uint64 timeNs;
+    int type;
+    std::string payload;
+};
+
+class Recorder {
+
+private:
+    FILE* file;
+    SDL_mutex* lock;
+    Uint64 startCounter;
+    Uint64 lastTimeNs;
+    Uint32 lastFlush;
+
+    void write(int type, const void* payload, size_t length);
+
+public:
+    Recorder() : file(nullptr), lock(nullptr), startCounter(0), lastTimeNs(0), lastFlush(0) {}
+    ~Recorder();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    void recordInbound(const char* data, int length);
+    void recordOutbound(const std::string& message);
+    void recordFrame(float dt);
+    void recordClick(int x, int y);
+    void recordDrain(Uint32 appliedMessages);
+    void recordKey(int keycode);
+};
+
+class RecordReader {
+
+private:
+    FILE* file;
+    Uint64 timeNs;
+
+public:
+    RecordReader() : file(nullptr), timeNs(0) {}
+    ~RecordReader() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    //Returns false at end of log or on a truncated record
+    bool next(Record& record);
+};
+
+#endif
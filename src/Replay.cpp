@@ -0,0 +1,204 @@
+#include "Replay.h"
+#include "Recorder.h"
+#include "Protocol.h"
+
+#include <cstring>
+#include <deque>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+double process_cpu_ms() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0.0;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 10000.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#endif
+}
+
+static double elapsed_ms(Uint64 start) {
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+//Hands buffered inbound messages to on_receive in order, until the game has received message
+//`through`. Messages that don't parse never reached on_receive live either, so they don't count.
+static void receive_pending(MyGame& game, std::deque<std::string>& pending, Uint32 through, std::string& cmd,
+    std::vector<std::string>& args, ReplayStats& stats) {
+    if (pending.empty() || game.receivedMessages() >= through) {
+        return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (!pending.empty() && game.receivedMessages() < through) {
+        const std::string& message = pending.front();
+        if (parse_message(message.data(), static_cast<int>(message.size()), cmd, args)) {
+            game.on_receive(cmd, args);
+        }
+        pending.pop_front();
+    }
+    stats.receiveMs += elapsed_ms(start);
+}
+
+//Sleeps until the recorded time of the next record, returns false if the window was closed
+static bool wait_until(Uint64 replayStart, Uint64 timeNs, SDL_Renderer* renderer) {
+    while (true) {
+        if (renderer) {
+            SDL_Event event;
+            while (SDL_PollEvent(&event)) {
+                if (event.type == SDL_QUIT ||
+                    (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                    return false;
+                }
+            }
+        }
+
+        double remainingMs = timeNs / 1000000.0 - elapsed_ms(replayStart);
+        if (remainingMs <= 0.0) {
+            return true;
+        }
+
+        SDL_Delay(remainingMs > 2.0 ? static_cast<Uint32>(remainingMs - 1.0) : 0);
+    }
+}
+
+bool run_replay(MyGame& game, const ReplayOptions& options, SDL_Renderer* renderer, ReplayStats& stats) {
+    RecordReader reader;
+
+    if (!reader.open(options.path)) {
+        std::cout << "Failed to open replay " << options.path << std::endl;
+        return false;
+    }
+
+    std::cout << "=== Replaying " << options.path << (options.realtime ? " in real time" : " as fast as possible") << " ===" << std::endl;
+
+    Record record;
+    std::string cmd;
+    std::vector<std::string> args;
+
+    //Inbound messages wait here until a drain record says the live frame applied them.
+    //Logs recorded before drain records existed apply everything received at every click and frame.
+    std::deque<std::string> pending;
+    const Uint32 ALL = 0xFFFFFFFF;
+    bool drains = false;
+    Uint64 frameStart = 0;
+
+    double cpuStart = process_cpu_ms();
+    Uint64 replayStart = SDL_GetPerformanceCounter();
+
+    while (reader.next(record)) {
+        if (options.realtime && !wait_until(replayStart, record.timeNs, renderer)) {
+            break;
+        }
+
+        stats.matchMs = record.timeNs / 1000000.0;
+
+        if (record.type == RECORD_INBOUND) {
+            stats.inbound++;
+            stats.inboundBytes += record.payload.size();
+            pending.push_back(record.payload);
+        }
+        else if (record.type == RECORD_OUTBOUND) {
+            //What the live client sent, the replayed client regenerates its own from the clicks
+            stats.outbound++;
+        }
+        else if (record.type == RECORD_CLICK && record.payload.size() == 4) {
+            stats.clicks++;
+
+            const Uint8* p = reinterpret_cast<const Uint8*>(record.payload.data());
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            event.type = SDL_MOUSEBUTTONDOWN;
+            event.button.x = static_cast<Sint16>(p[0] | (p[1] << 8));
+            event.button.y = static_cast<Sint16>(p[2] | (p[3] << 8));
+            if (!drains) {
+                receive_pending(game, pending, ALL, cmd, args, stats);
+                game.processEvents();
+            }
+            game.input(event);
+        }
+        else if (record.type == RECORD_KEY && record.payload.size() == 4) {
+            stats.keys++;
+
+            const Uint8* p = reinterpret_cast<const Uint8*>(record.payload.data());
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            event.type = SDL_KEYDOWN;
+            event.key.keysym.sym = static_cast<SDL_Keycode>(p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<Uint32>(p[3]) << 24));
+            game.input(event);
+        }
+        else if (record.type == RECORD_DRAIN && record.payload.size() == 4) {
+            //Apply exactly the messages the live frame applied, however far the receive thread had got
+            drains = true;
+            const Uint8* p = reinterpret_cast<const Uint8*>(record.payload.data());
+            Uint32 applied = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<Uint32>(p[3]) << 24);
+
+            //on_receive ran on the receive thread live, so it isn't part of the frame
+            receive_pending(game, pending, applied, cmd, args, stats);
+            frameStart = SDL_GetPerformanceCounter();
+            game.processEvents();
+            stats.updateMs += elapsed_ms(frameStart);
+        }
+        else if (record.type == RECORD_FRAME && record.payload.size() == 4) {
+            stats.frames++;
+
+            float dt;
+            memcpy(&dt, record.payload.data(), sizeof(dt));
+
+            if (!drains) {
+                receive_pending(game, pending, ALL, cmd, args, stats);
+                frameStart = SDL_GetPerformanceCounter();
+            }
+            Uint64 start = SDL_GetPerformanceCounter();
+            if (!drains) {
+                game.processEvents();
+            }
+            game.update(dt);
+            stats.updateMs += elapsed_ms(start);
+
+            if (renderer) {
+                Uint64 start = SDL_GetPerformanceCounter();
+                SDL_SetRenderDrawColor(renderer, 20, 20, 30, 255);
+                SDL_RenderClear(renderer);
+                game.render(renderer);
+                SDL_RenderPresent(renderer);
+                stats.renderMs += elapsed_ms(start);
+            }
+
+            stats.frameUs.record(metrics_elapsed_us(frameStart));
+        }
+
+        //No send thread in a replay, drop whatever the game queued
+        game.outbound.clear();
+    }
+
+    stats.wallMs = elapsed_ms(replayStart);
+    stats.cpuMs = process_cpu_ms() - cpuStart;
+    return true;
+}
+
+void print_replay_stats(const ReplayStats& stats) {
+    std::cout << "=== REPLAY FINISHED ===" << std::endl;
+    std::cout << "Match length: " << stats.matchMs << " ms, replayed in " << stats.wallMs << " ms" << std::endl;
+    std::cout << "Inbound: " << stats.inbound << " messages (" << stats.inboundBytes << " bytes), outbound: "
+        << stats.outbound << ", clicks: " << stats.clicks << ", keys: " << stats.keys << ", frames: " << stats.frames << std::endl;
+    std::cout << "Client CPU per match: " << stats.cpuMs << " ms (on_receive " << stats.receiveMs
+        << " ms, update " << stats.updateMs << " ms, render " << stats.renderMs << " ms)" << std::endl;
+    std::cout << "Frame time: p50 < " << stats.frameUs.percentile(0.50) << " us, p99 < " << stats.frameUs.percentile(0.99)
+        << " us, max " << stats.frameUs.max() << " us" << std::endl;
+    std::cout << "=======================" << std::endl;
+}
@@ -0,0 +1,45 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <string>
+
+#include "SDL.h"
+#include "MyGame.h"
+#include "Metrics.h"
+
+struct ReplayOptions {
+    std::string path;
+    bool realtime;          //false plays the log back as fast as possible
+
+    ReplayOptions() : realtime(true) {}
+};
+
+struct ReplayStats {
+    Uint64 inbound;
+    Uint64 inboundBytes;
+    Uint64 outbound;
+    Uint64 frames;
+    Uint64 clicks;
+    Uint64 keys;
+
+    double matchMs;         //recorded duration of the match
+    double wallMs;
+    double cpuMs;           //process CPU time spent in the replay
+    double receiveMs;
+    double updateMs;
+    double renderMs;
+    Histogram frameUs;      //processEvents, update and render of each recorded frame
+
+    ReplayStats() : inbound(0), inboundBytes(0), outbound(0), frames(0), clicks(0), keys(0),
+        matchMs(0), wallMs(0), cpuMs(0), receiveMs(0), updateMs(0), renderMs(0) {
+    }
+};
+
+//Feeds a recorded session back through MyGame::on_receive, input and update without a server.
+//renderer may be null, in which case frames are simulated but not drawn.
+bool run_replay(MyGame& game, const ReplayOptions& options, SDL_Renderer* renderer, ReplayStats& stats);
+void print_replay_stats(const ReplayStats& stats);
+
+double process_cpu_ms();
+
+#endif
@@ -0,0 +1,171 @@
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MyGame.h"
+#include "SpatialIndex.h"
+
+SimParams::SimParams(int tickRate) : tickRate(std::min(std::max(tickRate, 1), 1000)) {
+    stepUs = US_PER_SECOND / this->tickRate;
+    stepSubpixels = static_cast<long long>(MOVEMENT_SPEED) * SubPoint::ONE * stepUs / US_PER_SECOND;
+}
+
+Uint64 isqrt64(Uint64 value) {
+    Uint64 root = 0;
+    Uint64 bit = Uint64(1) << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+long long seconds_to_us(float seconds) {
+    if (!(seconds > 0.0f)) {
+        return 0;
+    }
+    if (seconds > 1e6f) {
+        return 1000000LL * US_PER_SECOND;
+    }
+    return std::llround(static_cast<double>(seconds) * US_PER_SECOND);
+}
+
+//Length of (dx, dy) in sub-pixels. Far-off server positions are scaled down first so the
+//squares stay inside 64 bits; division truncates toward zero on every platform.
+static long long length(long long dx, long long dy) {
+    const long long LIMIT = 1LL << 30;
+    long long scale = 1;
+    while (dx / scale > LIMIT || dx / scale < -LIMIT || dy / scale > LIMIT || dy / scale < -LIMIT) {
+        scale *= 2;
+    }
+
+    long long sx = dx / scale;
+    long long sy = dy / scale;
+    return static_cast<long long>(isqrt64(static_cast<Uint64>(sx * sx + sy * sy))) * scale;
+}
+
+//Returns true once the player is on the target
+static bool move_towards(SubPoint& position, const SubPoint& target, long long stepLength) {
+    long long dx = target.x - position.x;
+    long long dy = target.y - position.y;
+    long long dist = length(dx, dy);
+
+    //Arrive rather than overshoot when the last step would carry us past the target
+    if (dist < static_cast<long long>(ARRIVE_DISTANCE) * SubPoint::ONE || dist <= stepLength) {
+        position = target;
+        return true;
+    }
+
+    position.x += dx * stepLength / dist;
+    position.y += dy * stepLength / dist;
+    return false;
+}
+
+void sim_step(GameData& data, const SpatialIndex& sites, const SimParams& params) {
+    data.tick++;
+
+    //Combat timer runs locally to save on the amount of messages being sent
+    if (data.inCombat) {
+        data.combatTimeUs += params.stepUs;
+        if (data.combatTimeUs >= RETREAT_DELAY_US) {
+            data.canRetreat = true;
+        }
+    }
+
+    bool haveSites = !data.sites.empty();
+
+    for (int i = 0; i < data.playerCount; i++) {
+        Player& player = data.players[i];
+        player.previousPosition = player.position;
+
+        if (player.isMoving && move_towards(player.position, SubPoint::fromPixels(player.targetPosition), params.stepSubpixels)) {
+            player.isMoving = false;
+        }
+
+        if (haveSites) {
+            Point at = player.pixelPosition();
+            player.currentSite = player.isMoving ? -1 : sites.nearestWithin(at.x, at.y, static_cast<float>(SITE_RADIUS));
+        }
+
+        if (player.isCapturing) {
+            player.captureUs += params.stepUs;
+            if (player.captureUs > CAPTURE_TIME_US) {
+                player.captureUs = CAPTURE_TIME_US;
+            }
+        }
+        else {
+            player.captureUs = 0;
+        }
+    }
+}
+
+//Fed byte by byte in a fixed order so the hash doesn't depend on endianness or struct padding
+class StateHasher {
+
+private:
+    Uint64 hash;
+
+public:
+    StateHasher() : hash(14695981039346656037ULL) {}
+
+    void add(Uint64 value) {
+        for (int b = 0; b < 8; b++) {
+            hash ^= (value >> (b * 8)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    void add(const SiteBitset& bits) {
+        add(static_cast<Uint64>(bits.size()));
+        for (size_t w = 0; w < bits.data().size(); w++) {
+            add(bits.data()[w]);
+        }
+    }
+
+    Uint64 value() const { return hash; }
+};
+
+Uint64 sim_hash(const GameData& data) {
+    StateHasher h;
+
+    h.add(data.tick);
+    h.add(static_cast<Uint64>(data.playerCount));
+
+    for (int i = 0; i < data.playerCount; i++) {
+        const Player& player = data.players[i];
+        h.add(static_cast<Uint64>(player.position.x));
+        h.add(static_cast<Uint64>(player.position.y));
+        h.add(static_cast<Uint64>(player.targetPosition.x));
+        h.add(static_cast<Uint64>(player.targetPosition.y));
+        h.add(static_cast<Uint64>(player.currentSite));
+        h.add((player.isMoving ? 1 : 0) | (player.isCapturing ? 2 : 0));
+        h.add(static_cast<Uint64>(player.captureUs));
+
+        h.add(data.ownership[i]);
+        h.add(static_cast<Uint64>(data.scores[i]));
+    }
+
+    h.add(data.castles);
+    h.add(data.goldMines);
+    h.add(data.barracks);
+
+    h.add((data.inCombat ? 1 : 0) | (data.canRetreat ? 2 : 0) | (data.gameOver ? 4 : 0));
+    h.add(static_cast<Uint64>(data.combatSite));
+    h.add(static_cast<Uint64>(data.combatTimeUs));
+    h.add(static_cast<Uint64>(data.winner));
+
+    return h.value();
+}
@@ -0,0 +1,46 @@
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include "SDL.h"
+
+struct GameData;
+class SpatialIndex;
+
+//Deterministic core of the game simulation, stepped once per tick by MyGame::update.
+//Positions are SubPoints and every timer is whole microseconds, so clients fed the same
+//inputs at the same tick rate stay bit-for-bit identical. Floating point only appears at
+//the edges: server timers coming in and drawing going out.
+
+const long long US_PER_SECOND = 1000000;
+
+//Game rules, these have to match the server
+const int MOVEMENT_SPEED = 300;                     //pixels per second
+const int ARRIVE_DISTANCE = 5;                      //closer than this many pixels snaps to the target
+const int SITE_RADIUS = 50;                         //how close a player has to be to a site's centre to stand on it
+const long long CAPTURE_TIME_US = 10 * US_PER_SECOND;
+const long long RETREAT_DELAY_US = 5 * US_PER_SECOND;
+
+//Gold and levies are not simulated: the income rules live on the server and RESOURCES is
+//authoritative, in lockstep games too. They are left out of sim_hash for the same reason.
+
+struct SimParams {
+    int tickRate;               //1 to 1000 ticks per second
+    long long stepUs;           //length of one tick
+    long long stepSubpixels;    //distance a moving player covers in one tick
+
+    SimParams(int tickRate = 60);
+};
+
+//Advances data by one tick. sites must be built from data.sites.
+void sim_step(GameData& data, const SpatialIndex& sites, const SimParams& params);
+
+//FNV-1a over all simulated state, compared between clients to catch desyncs
+Uint64 sim_hash(const GameData& data);
+
+//Floor of the square root, exact for every 64-bit value
+Uint64 isqrt64(Uint64 value);
+
+//Server timers arrive as float seconds, clamped to [0, 1e6] s so nonsense can't overflow
+long long seconds_to_us(float seconds);
+
+#endif
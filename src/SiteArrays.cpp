@@ -0,0 +1,49 @@
+#include "SiteArrays.h"
+#include "AllocTracker.h"
+
+#include <cstdint>
+
+//The pointer back to the underlying block is stored just before the aligned pointer.
+//The block comes from the allocation tracker, so site arrays show up in the heap figures.
+void* aligned_malloc(size_t size, size_t alignment) {
+    void* raw = alloc_tracked(size + alignment + sizeof(void*));
+    if (!raw) {
+        return nullptr;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+    uintptr_t aligned = (start + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void aligned_free(void* p) {
+    if (p) {
+        alloc_tracked_free(static_cast<void**>(p)[-1]);
+    }
+}
+
+void SiteArrays::clear() {
+    x.clear();
+    y.clear();
+    neutralColor.clear();
+}
+
+void SiteArrays::reserve(size_t count) {
+    x.reserve(count);
+    y.reserve(count);
+    neutralColor.reserve(count);
+}
+
+void SiteArrays::add(int siteX, int siteY) {
+    x.push_back(siteX);
+    y.push_back(siteY);
+
+    SDL_Color color = {
+        static_cast<Uint8>(100 + (siteX % 155)),
+        static_cast<Uint8>(100 + (siteY % 155)),
+        static_cast<Uint8>(100 + ((static_cast<long long>(siteX) + siteY) % 155)),
+        255
+    };
+    neutralColor.push_back(color);
+}
@@ -0,0 +1,63 @@
+#ifndef __SITE_ARRAYS_H__
+#define __SITE_ARRAYS_H__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "SDL.h"
+
+//Site columns start on a 32 byte boundary so they can be read with aligned 256-bit loads
+const size_t SITE_ALIGNMENT = 32;
+
+//SDL_SIMDAlloc only arrived in SDL 2.0.10, these over-allocate and align by hand
+void* aligned_malloc(size_t size, size_t alignment);
+void aligned_free(void* p);
+
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = aligned_malloc(n * sizeof(T), SITE_ALIGNMENT);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) {
+        aligned_free(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T> >;
+
+//Per-site data stored as parallel columns, site i is element i of each. Passes that only need
+//coordinates (nearest-site queries, the territory pass, site markers) never pull colours into
+//cache; buildings and ownership live in the SiteBitsets on GameData.
+struct SiteArrays {
+    AlignedVector<int> x;
+    AlignedVector<int> y;
+    AlignedVector<SDL_Color> neutralColor;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void clear();
+    void reserve(size_t count);
+    //Appends a site, its neutral colour is derived from the position
+    void add(int siteX, int siteY);
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "SiteBitset.h"
+
+#include <stdexcept>
+
+//Nothing the server sends should need more than this, it stops a bogus message sizing us to gigabytes
+static const int MAX_ENCODED_BITS = 1 << 16;
+
+void SiteBitset::resize(int newBits) {
+    if (newBits < 0) {
+        newBits = 0;
+    }
+
+    bits = newBits;
+    words.resize((bits + 63) / 64, 0);
+
+    //Clear anything past the end so count() and == only see real sites
+    if (bits & 63) {
+        words.back() &= (uint64_t(1) << (bits & 63)) - 1;
+    }
+}
+
+void SiteBitset::clear() {
+    for (size_t w = 0; w < words.size(); w++) {
+        words[w] = 0;
+    }
+}
+
+bool SiteBitset::any() const {
+    for (size_t w = 0; w < words.size(); w++) {
+        if (words[w]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int SiteBitset::count() const {
+    int total = 0;
+    for (size_t w = 0; w < words.size(); w++) {
+        total += popcount64(words[w]);
+    }
+    return total;
+}
+
+int SiteBitset::countAnd(const SiteBitset& other) const {
+    size_t n = words.size() < other.words.size() ? words.size() : other.words.size();
+    int total = 0;
+    for (size_t w = 0; w < n; w++) {
+        total += popcount64(words[w] & other.words[w]);
+    }
+    return total;
+}
+
+void SiteBitset::andNot(const SiteBitset& other) {
+    size_t n = words.size() < other.words.size() ? words.size() : other.words.size();
+    for (size_t w = 0; w < n; w++) {
+        words[w] &= ~other.words[w];
+    }
+}
+
+void SiteBitset::orWith(const SiteBitset& other) {
+    if (other.bits > bits) {
+        resize(other.bits);
+    }
+    for (size_t w = 0; w < other.words.size(); w++) {
+        words[w] |= other.words[w];
+    }
+}
+
+SiteBitset SiteBitset::difference(const SiteBitset& a, const SiteBitset& b) {
+    SiteBitset result;
+    result.orDifference(a, b);
+    return result;
+}
+
+void SiteBitset::orDifference(const SiteBitset& a, const SiteBitset& b) {
+    int widest = a.bits > b.bits ? a.bits : b.bits;
+    if (widest > bits) {
+        resize(widest);
+    }
+    for (size_t w = 0; w < words.size(); w++) {
+        uint64_t wa = w < a.words.size() ? a.words[w] : 0;
+        uint64_t wb = w < b.words.size() ? b.words[w] : 0;
+        words[w] |= wa ^ wb;
+    }
+}
+
+bool SiteBitset::operator==(const SiteBitset& other) const {
+    size_t n = words.size() > other.words.size() ? words.size() : other.words.size();
+    for (size_t w = 0; w < n; w++) {
+        uint64_t a = w < words.size() ? words[w] : 0;
+        uint64_t b = w < other.words.size() ? other.words[w] : 0;
+        if (a != b) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void SiteBitset::decode(const std::string& arg) {
+    if (arg.empty()) {
+        throw std::invalid_argument("empty bitset");
+    }
+
+    if (arg[0] != '#') {
+        //Legacy decimal mask, stoull rejects junk and values past 64 bits
+        if (arg[0] == '-') {
+            throw std::invalid_argument("negative bitset");
+        }
+        unsigned long long value = std::stoull(arg);
+        words.assign(1, static_cast<uint64_t>(value));
+        bits = 64;
+        return;
+    }
+
+    int digits = static_cast<int>(arg.length()) - 1;
+    if (digits == 0 || digits * 4 > MAX_ENCODED_BITS) {
+        throw std::invalid_argument("bad bitset length");
+    }
+
+    bits = digits * 4;
+    words.assign((bits + 63) / 64, 0);
+
+    //Walk from the least significant (last) digit up
+    for (int d = 0; d < digits; d++) {
+        int value = hex_value(arg[arg.length() - 1 - d]);
+        if (value < 0) {
+            throw std::invalid_argument("bad hex digit in bitset");
+        }
+        int bit = d * 4;
+        words[bit >> 6] |= static_cast<uint64_t>(value) << (bit & 63);
+    }
+}
+
+std::string SiteBitset::encode() const {
+    static const char HEX[] = "0123456789abcdef";
+
+    int digits = (bits + 3) / 4;
+    if (digits == 0) {
+        return "#0";
+    }
+
+    std::string out(digits + 1, '0');
+    out[0] = '#';
+    for (int d = 0; d < digits; d++) {
+        int bit = d * 4;
+        int value = static_cast<int>((words[bit >> 6] >> (bit & 63)) & 0xF);
+        out[digits - d] = HEX[value];
+    }
+    return out;
+}
@@ -0,0 +1,110 @@
+#ifndef __SITE_BITSET_H__
+#define __SITE_BITSET_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int popcount64(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+inline int lowest_bit64(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+//One bit per site, packed into 64-bit words so maps can have thousands of sites.
+//Bits past size() always read as 0.
+//
+//Wire encoding: a plain decimal number (the original 8-site format, good up to 64 sites)
+//or '#' followed by hex digits, most significant first, bit i being site i.
+class SiteBitset {
+
+private:
+    std::vector<uint64_t> words;
+    int bits;
+
+public:
+    SiteBitset() : bits(0) {}
+
+    int size() const { return bits; }
+    const std::vector<uint64_t>& data() const { return words; }
+
+    //Keeps existing bits below the new size
+    void resize(int newBits);
+    void clear();
+
+    bool test(int i) const {
+        return i >= 0 && i < bits && (words[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void set(int i) {
+        if (i >= 0 && i < bits) words[i >> 6] |= (uint64_t(1) << (i & 63));
+    }
+
+    void reset(int i) {
+        if (i >= 0 && i < bits) words[i >> 6] &= ~(uint64_t(1) << (i & 63));
+    }
+
+    void assign(int i, bool value) {
+        if (value) set(i); else reset(i);
+    }
+
+    //Whole 64-bit word w, bits past size() are dropped
+    void setWord(int w, uint64_t value) {
+        if (w < 0 || w >= static_cast<int>(words.size())) return;
+        if (w == static_cast<int>(words.size()) - 1 && (bits & 63)) {
+            value &= (uint64_t(1) << (bits & 63)) - 1;
+        }
+        words[w] = value;
+    }
+
+    bool any() const;
+    int count() const;
+    int countAnd(const SiteBitset& other) const;
+    //this &= ~other
+    void andNot(const SiteBitset& other);
+    //this |= other, growing to fit
+    void orWith(const SiteBitset& other);
+
+    //Calls fn(index) for every set bit, skipping empty words
+    template <typename Fn>
+    void forEachSet(Fn fn) const {
+        for (size_t w = 0; w < words.size(); w++) {
+            uint64_t word = words[w];
+            while (word) {
+                fn(static_cast<int>(w * 64) + lowest_bit64(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    //Sets bits that differ between a and b
+    static SiteBitset difference(const SiteBitset& a, const SiteBitset& b);
+    //Same, on top of the bits already set, growing only if a or b is bigger
+    void orDifference(const SiteBitset& a, const SiteBitset& b);
+
+    bool operator==(const SiteBitset& other) const;
+    bool operator!=(const SiteBitset& other) const { return !(*this == other); }
+
+    //Throws std::invalid_argument on anything that isn't a valid encoding,
+    //the result is sized to the number of bits the encoding can carry
+    void decode(const std::string& arg);
+    std::string encode() const;
+};
+
+#endif
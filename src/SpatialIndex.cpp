@@ -0,0 +1,196 @@
+#include "SpatialIndex.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+static long long squared_distance(long long x1, long long y1, long long x2, long long y2) {
+    long long dx = x2 - x1;
+    long long dy = y2 - y1;
+    return dx * dx + dy * dy;
+}
+
+void SpatialIndex::clear() {
+    xs.clear();
+    ys.clear();
+    cellStart.clear();
+    cellItems.clear();
+    cols = rows = 0;
+}
+
+void SpatialIndex::build(const SiteArrays& sites) {
+    clear();
+
+    int count = static_cast<int>(sites.size());
+    if (count == 0) {
+        return;
+    }
+
+    const int* siteX = sites.x.data();
+    const int* siteY = sites.y.data();
+
+    long long minX = LLONG_MAX, minY = LLONG_MAX, maxX = LLONG_MIN, maxY = LLONG_MIN;
+    for (int i = 0; i < count; i++) {
+        minX = std::min(minX, static_cast<long long>(siteX[i]));
+        minY = std::min(minY, static_cast<long long>(siteY[i]));
+        maxX = std::max(maxX, static_cast<long long>(siteX[i]));
+        maxY = std::max(maxY, static_cast<long long>(siteY[i]));
+    }
+
+    long long width = maxX - minX + 1;
+    long long height = maxY - minY + 1;
+
+    //Aim for about two sites per cell, then grow cells until the grid stays proportional to
+    //the site count even for degenerate layouts (all sites in a line, huge coordinates)
+    cellSize = std::max(1LL, static_cast<long long>(std::sqrt(static_cast<double>(width) * height * 2.0 / count)));
+    while (true) {
+        long long c = width / cellSize + 1;
+        long long r = height / cellSize + 1;
+        if (c * r <= 4LL * count + 64) {
+            cols = static_cast<int>(c);
+            rows = static_cast<int>(r);
+            break;
+        }
+        cellSize *= 2;
+    }
+
+    originX = minX;
+    originY = minY;
+
+    //Counting sort of the sites into cells
+    cellStart.assign(static_cast<size_t>(cols) * rows + 1, 0);
+    std::vector<int> cellOf(count);
+    for (int i = 0; i < count; i++) {
+        cellOf[i] = cellY(siteY[i]) * cols + cellX(siteX[i]);
+        cellStart[cellOf[i] + 1]++;
+    }
+    for (size_t c = 1; c < cellStart.size(); c++) {
+        cellStart[c] += cellStart[c - 1];
+    }
+
+    cellItems.resize(count);
+    xs.resize(count);
+    ys.resize(count);
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < count; i++) {
+        int k = fill[cellOf[i]]++;
+        cellItems[k] = i;
+        xs[k] = siteX[i];
+        ys[k] = siteY[i];
+    }
+}
+
+int SpatialIndex::cellX(long long x) const {
+    long long c = (x - originX) / cellSize;
+    if (x < originX) c = 0;
+    return static_cast<int>(std::min(c, static_cast<long long>(cols - 1)));
+}
+
+int SpatialIndex::cellY(long long y) const {
+    long long c = (y - originY) / cellSize;
+    if (y < originY) c = 0;
+    return static_cast<int>(std::min(c, static_cast<long long>(rows - 1)));
+}
+
+void SpatialIndex::scanCell(int cx, int cy, int x, int y, long long& best, int& bestIndex) const {
+    int cell = cy * cols + cx;
+    for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+        long long d = squared_distance(x, y, xs[k], ys[k]);
+        if (d < best || (d == best && cellItems[k] < bestIndex)) {
+            best = d;
+            bestIndex = cellItems[k];
+        }
+    }
+}
+
+int SpatialIndex::nearest(int x, int y) const {
+    if (xs.empty()) {
+        return -1;
+    }
+
+    int cx = cellX(x);
+    int cy = cellY(y);
+
+    long long best = LLONG_MAX;
+    int bestIndex = -1;
+    int maxRing = std::max(cols, rows);
+
+    //Search rings of cells outward from the query's cell
+    for (int r = 0; r <= maxRing; r++) {
+        for (int j = cy - r; j <= cy + r; j++) {
+            if (j < 0 || j >= rows) {
+                continue;
+            }
+
+            bool edgeRow = (j == cy - r || j == cy + r);
+            int step = edgeRow ? 1 : std::max(1, 2 * r);
+
+            for (int i = cx - r; i <= cx + r; i += step) {
+                if (i >= 0 && i < cols) {
+                    scanCell(i, j, x, y, best, bestIndex);
+                }
+            }
+        }
+
+        //Anything not visited yet lies outside the square of rings 0..r
+        if (bestIndex >= 0) {
+            long long left = x - (originX + (cx - r) * cellSize);
+            long long right = originX + (cx + r + 1) * cellSize - x;
+            long long top = y - (originY + (cy - r) * cellSize);
+            long long bottom = originY + (cy + r + 1) * cellSize - y;
+            long long edge = std::min(std::min(left, right), std::min(top, bottom));
+
+            if (edge > 0 && best < edge * edge) {
+                break;
+            }
+        }
+    }
+
+    return bestIndex;
+}
+
+int SpatialIndex::nearestWithin(int x, int y, float radius) const {
+    if (xs.empty() || radius <= 0.0f) {
+        return -1;
+    }
+
+    long long r = static_cast<long long>(std::ceil(radius));
+    int x0 = cellX(x - r), x1 = cellX(x + r);
+    int y0 = cellY(y - r), y1 = cellY(y + r);
+
+    long long best = LLONG_MAX;
+    int bestIndex = -1;
+
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            scanCell(i, j, x, y, best, bestIndex);
+        }
+    }
+
+    if (bestIndex >= 0 && static_cast<double>(best) < static_cast<double>(radius) * radius) {
+        return bestIndex;
+    }
+    return -1;
+}
+
+void SpatialIndex::queryRadius(int x, int y, float radius, std::vector<int>& out) const {
+    if (xs.empty() || radius < 0.0f) {
+        return;
+    }
+
+    long long r = static_cast<long long>(std::ceil(radius));
+    int x0 = cellX(x - r), x1 = cellX(x + r);
+    int y0 = cellY(y - r), y1 = cellY(y + r);
+    double limit = static_cast<double>(radius) * radius;
+
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            int cell = j * cols + i;
+            for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                if (static_cast<double>(squared_distance(x, y, xs[k], ys[k])) <= limit) {
+                    out.push_back(cellItems[k]);
+                }
+            }
+        }
+    }
+}
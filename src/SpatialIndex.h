@@ -0,0 +1,44 @@
+#ifndef __SPATIAL_INDEX_H__
+#define __SPATIAL_INDEX_H__
+
+#include <vector>
+
+#include "SiteArrays.h"
+
+//Uniform grid over the site centres for nearest-site and radius queries.
+//Cells are sized for roughly two sites each, so a nearest query looks at a handful of
+//cells regardless of how many sites the map has.
+class SpatialIndex {
+
+private:
+    //Sites of cell c are entries cellStart[c] .. cellStart[c + 1] of these columns: the site's
+    //index and its coordinates, stored in cell order so a cell scan reads contiguous memory
+    std::vector<int> cellStart;
+    std::vector<int> cellItems;
+    AlignedVector<int> xs;
+    AlignedVector<int> ys;
+
+    long long originX, originY;
+    long long cellSize;
+    int cols, rows;
+
+    int cellX(long long x) const;
+    int cellY(long long y) const;
+    void scanCell(int cx, int cy, int x, int y, long long& best, int& bestIndex) const;
+
+public:
+    SpatialIndex() : originX(0), originY(0), cellSize(1), cols(0), rows(0) {}
+
+    void build(const SiteArrays& sites);
+    void clear();
+    int size() const { return static_cast<int>(xs.size()); }
+
+    //Closest site to (x, y), lowest index on ties, -1 if there are no sites
+    int nearest(int x, int y) const;
+    //Closest site strictly within radius, -1 if none
+    int nearestWithin(int x, int y, float radius) const;
+    //Appends every site within radius (inclusive) to out
+    void queryRadius(int x, int y, float radius, std::vector<int>& out) const;
+};
+
+#endif
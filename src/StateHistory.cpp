@@ -0,0 +1,375 @@
+#include "StateHistory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "MyGame.h"
+
+//Row layout: header, then PLAYER_FIELDS per player, then the ownership words of each
+//player and the castle, gold mine and barracks words, (sites + 63) / 64 words each
+static const int HEADER_FIELDS = 6;
+static const int PLAYER_FIELDS = 12;
+static const int MAX_MAP_WORDS = (MAX_SITES + 63) / 64;
+static const int MAX_ROW = HEADER_FIELDS + MAX_PLAYERS * PLAYER_FIELDS + (MAX_PLAYERS + BUILDING_KINDS) * MAX_MAP_WORDS;
+//A varint is at most 10 bytes, a delta record spends one on the gap and one on the value
+static const int MAX_RECORD = 10 + MAX_ROW * 20;
+//Typical records are a few dozen bytes, this leaves room for plenty of busy ticks
+static const int ARENA_BYTES_PER_TICK = 96;
+
+static void put_varint(std::vector<Uint8>& out, Uint64 value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<Uint8>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<Uint8>(value));
+}
+
+static bool get_varint(const Uint8*& p, const Uint8* end, Uint64& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        Uint8 byte = *p++;
+        value |= static_cast<Uint64>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static Uint64 zigzag(Uint64 delta) {
+    return (delta << 1) ^ (0 - (delta >> 63));
+}
+
+static Uint64 unzigzag(Uint64 value) {
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+static int map_words(long long sites) {
+    return static_cast<int>((sites + 63) / 64);
+}
+
+static void put_words(const SiteBitset& bits, int words, std::vector<long long>& row) {
+    const std::vector<uint64_t>& data = bits.data();
+    for (int w = 0; w < words; w++) {
+        row.push_back(static_cast<long long>(w < static_cast<int>(data.size()) ? data[w] : 0));
+    }
+}
+
+static void get_words(const long long* row, int sites, SiteBitset& bits) {
+    bits.resize(sites);
+    for (int w = 0; w < map_words(sites); w++) {
+        bits.setWord(w, static_cast<uint64_t>(row[w]));
+    }
+}
+
+StateHistory::StateHistory(int seconds, int tickRate) {
+    current.reserve(MAX_ROW);
+    previous.reserve(MAX_ROW);
+    cursor.reserve(MAX_ROW);
+    encoded.reserve(MAX_RECORD);
+    configure(seconds, tickRate);
+}
+
+void StateHistory::configure(int seconds, int tickRate) {
+    this->tickRate = tickRate > 0 ? tickRate : 60;
+    //One keyframe interval extra, dropping the oldest keyframe takes its deltas with it
+    maxTicks = std::max(1, seconds) * this->tickRate + KEYFRAME_INTERVAL;
+
+    entries.assign(maxTicks + 1, Entry());
+    arena.assign(static_cast<size_t>(maxTicks) * ARENA_BYTES_PER_TICK + 4 * MAX_RECORD, 0);
+
+    recorded = keyframes = bytesWritten = 0;
+    recordTicks = maxRecordTicks = 0;
+    clear();
+}
+
+void StateHistory::clear() {
+    writePos = 0;
+    first = 0;
+    count = 0;
+    sinceKeyframe = 0;
+    previous.clear();
+    cursorValid = false;
+}
+
+void StateHistory::flatten(const GameData& data, std::vector<long long>& row) const {
+    row.clear();
+
+    long long sites = static_cast<long long>(data.sites.size());
+    int words = map_words(sites);
+
+    row.push_back(data.playerCount);
+    row.push_back(sites);
+    row.push_back((data.inCombat ? 1 : 0) | (data.canRetreat ? 2 : 0) | (data.gameOver ? 4 : 0));
+    row.push_back(data.combatSite);
+    row.push_back(data.combatTimeUs);
+    row.push_back(data.winner);
+
+    for (int i = 0; i < data.playerCount; i++) {
+        const Player& player = data.players[i];
+        row.push_back(player.position.x);
+        row.push_back(player.position.y);
+        row.push_back(player.previousPosition.x);
+        row.push_back(player.previousPosition.y);
+        row.push_back(player.targetPosition.x);
+        row.push_back(player.targetPosition.y);
+        row.push_back(player.currentSite);
+        row.push_back((player.isMoving ? 1 : 0) | (player.isCapturing ? 2 : 0));
+        row.push_back(player.captureUs);
+        row.push_back(data.scores[i]);
+        row.push_back(data.gold[i]);
+        row.push_back(data.levies[i]);
+    }
+
+    for (int i = 0; i < data.playerCount; i++) {
+        put_words(data.ownership[i], words, row);
+    }
+    put_words(data.castles, words, row);
+    put_words(data.goldMines, words, row);
+    put_words(data.barracks, words, row);
+}
+
+void StateHistory::unflatten(const std::vector<long long>& row, GameData& data) const {
+    const long long* r = row.data();
+
+    data.playerCount = static_cast<int>(r[0]);
+    int sites = static_cast<int>(r[1]);
+    int words = map_words(sites);
+
+    data.inCombat = (r[2] & 1) != 0;
+    data.canRetreat = (r[2] & 2) != 0;
+    data.gameOver = (r[2] & 4) != 0;
+    data.combatSite = static_cast<int>(r[3]);
+    data.combatTimeUs = r[4];
+    data.winner = static_cast<int>(r[5]);
+    r += HEADER_FIELDS;
+
+    for (int i = 0; i < data.playerCount; i++, r += PLAYER_FIELDS) {
+        Player& player = data.players[i];
+        player.position = SubPoint(r[0], r[1]);
+        player.previousPosition = SubPoint(r[2], r[3]);
+        player.targetPosition = Point(static_cast<int>(r[4]), static_cast<int>(r[5]));
+        player.currentSite = static_cast<int>(r[6]);
+        player.isMoving = (r[7] & 1) != 0;
+        player.isCapturing = (r[7] & 2) != 0;
+        player.captureUs = r[8];
+        data.scores[i] = static_cast<int>(r[9]);
+        data.gold[i] = static_cast<int>(r[10]);
+        data.levies[i] = static_cast<int>(r[11]);
+    }
+
+    for (int i = 0; i < data.playerCount; i++, r += words) {
+        get_words(r, sites, data.ownership[i]);
+    }
+    get_words(r, sites, data.castles);
+    get_words(r + words, sites, data.goldMines);
+    get_words(r + 2 * words, sites, data.barracks);
+}
+
+//Keyframe: row length then every field. Delta: number of changed fields, then for each the
+//gap since the last changed field and the zigzagged difference.
+void StateHistory::encode(const std::vector<long long>& row, const std::vector<long long>* base) {
+    encoded.clear();
+
+    if (!base) {
+        put_varint(encoded, row.size());
+        for (size_t i = 0; i < row.size(); i++) {
+            put_varint(encoded, zigzag(static_cast<Uint64>(row[i])));
+        }
+        return;
+    }
+
+    Uint64 changed = 0;
+    for (size_t i = 0; i < row.size(); i++) {
+        changed += row[i] != (*base)[i];
+    }
+    put_varint(encoded, changed);
+
+    size_t last = 0;
+    for (size_t i = 0; i < row.size(); i++) {
+        if (row[i] != (*base)[i]) {
+            put_varint(encoded, i - last);
+            put_varint(encoded, zigzag(static_cast<Uint64>(row[i]) - static_cast<Uint64>((*base)[i])));
+            last = i;
+        }
+    }
+}
+
+bool StateHistory::decode(const Entry& entry, std::vector<long long>& row) const {
+    const Uint8* p = &arena[entry.offset];
+    const Uint8* end = p + entry.length;
+    Uint64 n, value;
+
+    if (!get_varint(p, end, n)) {
+        return false;
+    }
+
+    if (entry.keyframe) {
+        if (n > static_cast<Uint64>(MAX_ROW)) {
+            return false;
+        }
+        row.resize(static_cast<size_t>(n));
+        for (size_t i = 0; i < row.size(); i++) {
+            if (!get_varint(p, end, value)) {
+                return false;
+            }
+            row[i] = static_cast<long long>(unzigzag(value));
+        }
+        return true;
+    }
+
+    Uint64 index = 0;
+    for (Uint64 c = 0; c < n; c++) {
+        Uint64 gap;
+        if (!get_varint(p, end, gap) || !get_varint(p, end, value)) {
+            return false;
+        }
+        index += gap;
+        if (index >= row.size()) {
+            return false;
+        }
+        row[index] = static_cast<long long>(static_cast<Uint64>(row[index]) + unzigzag(value));
+    }
+    return true;
+}
+
+//Deltas can't be read without the keyframe before them, so they go with it
+void StateHistory::dropOldest() {
+    do {
+        first = (first + 1) % entries.size();
+        count--;
+    } while (count > 0 && !entryAt(0).keyframe);
+}
+
+//Frees arena space for the encoded record and stores it. Records are never split: if one
+//doesn't fit before the end of the arena it goes at the start, behind anything older.
+void StateHistory::append(Uint64 tick, bool keyframe) {
+    size_t length = encoded.size();
+
+    if (writePos + length > arena.size()) {
+        //Everything stored past writePos is from the previous lap, so older than what's at the start
+        while (count > 0 && entryAt(0).offset >= writePos) {
+            dropOldest();
+        }
+        writePos = 0;
+    }
+
+    while (count > 0 && entryAt(0).offset < writePos + length && entryAt(0).offset + entryAt(0).length > writePos) {
+        dropOldest();
+    }
+
+    while (count >= static_cast<size_t>(maxTicks)) {
+        dropOldest();
+    }
+
+    memcpy(&arena[writePos], encoded.data(), length);
+
+    Entry& entry = entries[(first + count) % entries.size()];
+    entry.tick = tick;
+    entry.offset = writePos;
+    entry.length = length;
+    entry.keyframe = keyframe;
+    count++;
+
+    writePos += length;
+}
+
+void StateHistory::record(const GameData& data) {
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if (count > 0 && data.tick != newestTick() + 1) {
+        clear();
+    }
+
+    flatten(data, current);
+
+    bool keyframe = count == 0 || previous.size() != current.size() || sinceKeyframe + 1 >= KEYFRAME_INTERVAL;
+    encode(current, keyframe ? nullptr : &previous);
+
+    //If making room took every older tick, a delta would have nothing to apply to
+    size_t before = count;
+    append(data.tick, keyframe);
+    if (!keyframe && count == 1 && before > 0 && entryAt(0).tick == data.tick) {
+        count = 0;
+        keyframe = true;
+        encode(current, nullptr);
+        append(data.tick, true);
+    }
+
+    sinceKeyframe = keyframe ? 0 : sinceKeyframe + 1;
+    std::swap(current, previous);
+
+    if (cursorValid && cursorTick < oldestTick()) {
+        cursorValid = false;
+    }
+
+    recorded++;
+    keyframes += keyframe;
+    bytesWritten += encoded.size();
+
+    Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+    recordTicks += elapsed;
+    if (elapsed > maxRecordTicks) {
+        maxRecordTicks = elapsed;
+    }
+}
+
+bool StateHistory::restore(Uint64 tick, GameData& data) {
+    if (count == 0 || tick < oldestTick() || tick > newestTick()) {
+        return false;
+    }
+
+    size_t target = static_cast<size_t>(tick - oldestTick());
+    size_t from;
+
+    if (cursorValid && cursorTick <= tick && cursorTick >= oldestTick()) {
+        from = static_cast<size_t>(cursorTick - oldestTick()) + 1;
+    }
+    else {
+        //The oldest entry is always a keyframe, so this stops
+        from = target;
+        while (!entryAt(from).keyframe) {
+            from--;
+        }
+    }
+
+    for (size_t i = from; i <= target; i++) {
+        if (!decode(entryAt(i), cursor)) {
+            cursorValid = false;
+            return false;
+        }
+    }
+
+    cursorTick = tick;
+    cursorValid = true;
+
+    unflatten(cursor, data);
+    data.tick = tick;
+    return true;
+}
+
+size_t StateHistory::bytesUsed() const {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += entryAt(i).length;
+    }
+    return total;
+}
+
+void StateHistory::printStats() {
+    double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+
+    std::cout << "=== STATE HISTORY ===" << std::endl;
+    std::cout << recorded << " ticks recorded (" << keyframes << " keyframes), holding "
+        << static_cast<double>(count) / tickRate << " s in " << bytesUsed() / 1024.0 << " KB of "
+        << arena.size() / 1024.0 << " KB" << std::endl;
+    if (recorded > 0) {
+        double bytesPerTick = static_cast<double>(bytesWritten) / recorded;
+        std::cout << "Mean snapshot " << bytesPerTick << " bytes, " << bytesPerTick * tickRate / 1024.0
+            << " KB per second of history at " << tickRate << " Hz" << std::endl;
+        std::cout << "Snapshot cost per tick: mean " << recordTicks * 1e6 / freq / recorded << " us, max "
+            << maxRecordTicks * 1e6 / freq << " us" << std::endl;
+    }
+    std::cout << "=====================" << std::endl;
+}
@@ -0,0 +1,91 @@
+#ifndef __STATE_HISTORY_H__
+#define __STATE_HISTORY_H__
+
+#include <vector>
+
+#include "SDL.h"
+
+struct GameData;
+
+//The last few seconds of simulated state, one snapshot per tick, for instant replay and
+//as the basis for rollback.
+//
+//Each snapshot flattens GameData's simulated fields into a row of integers. Every
+//KEYFRAME_INTERVAL ticks (or when the layout changes: player count, map size) the whole row
+//is stored, otherwise only the fields that changed since the previous tick, as varint
+//(gap, zigzag delta) pairs. Records live back to back in a byte ring allocated up front;
+//recording evicts the oldest ticks and never allocates.
+class StateHistory {
+
+private:
+    static const int KEYFRAME_INTERVAL = 60;
+
+    struct Entry {
+        Uint64 tick;
+        size_t offset;
+        size_t length;
+        bool keyframe;
+    };
+
+    std::vector<Uint8> arena;
+    size_t writePos;
+
+    std::vector<Entry> entries;     //ring, oldest at first
+    size_t first;
+    size_t count;
+
+    int maxTicks;
+    int sinceKeyframe;
+
+    //Scratch rows, sized for the largest map up front
+    std::vector<long long> current;
+    std::vector<long long> previous;
+    std::vector<Uint8> encoded;
+
+    //Replay cursor: the row for cursorTick, so stepping forward decodes one record
+    std::vector<long long> cursor;
+    Uint64 cursorTick;
+    bool cursorValid;
+
+    //Stats
+    int tickRate;
+    Uint64 recorded;
+    Uint64 keyframes;
+    Uint64 bytesWritten;
+    Uint64 recordTicks;
+    Uint64 maxRecordTicks;
+
+    void flatten(const GameData& data, std::vector<long long>& row) const;
+    void unflatten(const std::vector<long long>& row, GameData& data) const;
+    void encode(const std::vector<long long>& row, const std::vector<long long>* base);
+    bool decode(const Entry& entry, std::vector<long long>& row) const;
+    const Entry& entryAt(size_t i) const { return entries[(first + i) % entries.size()]; }
+    void dropOldest();
+    void append(Uint64 tick, bool keyframe);
+
+public:
+    StateHistory(int seconds = 20, int tickRate = 60);
+
+    //Drops all history and resizes for a new length or tick rate
+    void configure(int seconds, int tickRate);
+    void clear();
+
+    //Called once per tick after the simulation step. A tick that doesn't follow the last one
+    //(a new game) starts the history over.
+    void record(const GameData& data);
+
+    bool empty() const { return count == 0; }
+    Uint64 oldestTick() const { return count ? entryAt(0).tick : 0; }
+    Uint64 newestTick() const { return count ? entryAt(count - 1).tick : 0; }
+
+    //Writes the simulated state at tick into data, leaving its sites alone. Stepping forward one
+    //tick at a time only decodes one record. False if the tick isn't held.
+    bool restore(Uint64 tick, GameData& data);
+
+    size_t bytesUsed() const;
+    size_t capacityBytes() const { return arena.size(); }
+
+    void printStats();
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <cstdio>
+
+static const int CHUNK_EVENTS = 4096;
+static const int MAX_CHUNKS = 256;      //about a million events per thread, later ones are dropped
+static const int DETAIL_LENGTH = 24;
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    Uint64 start;
+    Uint64 end;
+    char detail[DETAIL_LENGTH];
+};
+
+//Written only by its thread. count is published after the event it covers, so the writer
+//at exit can read up to it while the thread is still going.
+struct TraceBuffer {
+    TraceEvent* chunks[MAX_CHUNKS];
+    SDL_atomic_t count;
+    int dropped;
+    int id;
+    char name[16];
+    TraceBuffer* next;
+};
+
+static std::atomic<bool> enabled(false);
+static Uint64 startTime = 0;
+static void* buffers = nullptr;
+static SDL_atomic_t bufferCount;
+static thread_local TraceBuffer* threadBuffer = nullptr;
+
+//The name is filled in before the buffer is linked in, the writer never sees it change
+static TraceBuffer* buffer_for_thread(const char* name = nullptr) {
+    if (threadBuffer) {
+        return threadBuffer;
+    }
+
+    TraceBuffer* buffer = new TraceBuffer();
+    for (int i = 0; i < MAX_CHUNKS; i++) {
+        buffer->chunks[i] = nullptr;
+    }
+    SDL_AtomicSet(&buffer->count, 0);
+    buffer->dropped = 0;
+    buffer->id = SDL_AtomicAdd(&bufferCount, 1) + 1;
+    if (name) {
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    }
+    else {
+        snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->id);
+    }
+
+    void* head;
+    do {
+        head = SDL_AtomicGetPtr(&buffers);
+        buffer->next = static_cast<TraceBuffer*>(head);
+    } while (!SDL_AtomicCASPtr(&buffers, head, buffer));
+
+    threadBuffer = buffer;
+    return buffer;
+}
+
+void trace_start() {
+    startTime = SDL_GetPerformanceCounter();
+    enabled.store(true);
+}
+
+bool trace_enabled() {
+    return enabled;
+}
+
+void trace_thread_name(const char* name) {
+    if (enabled) {
+        buffer_for_thread(name);
+    }
+}
+
+Uint64 trace_now() {
+    return enabled.load(std::memory_order_relaxed) ? SDL_GetPerformanceCounter() : 0;
+}
+
+Uint64 trace_span(const char* name, const char* category, Uint64 start, const char* detail) {
+    if (!enabled.load(std::memory_order_relaxed) || start == 0) {
+        return 0;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    TraceBuffer* buffer = buffer_for_thread();
+
+    int index = SDL_AtomicGet(&buffer->count);
+    int chunk = index / CHUNK_EVENTS;
+    if (chunk >= MAX_CHUNKS) {
+        buffer->dropped++;
+        return now;
+    }
+    if (!buffer->chunks[chunk]) {
+        buffer->chunks[chunk] = new TraceEvent[CHUNK_EVENTS];
+    }
+
+    TraceEvent& event = buffer->chunks[chunk][index % CHUNK_EVENTS];
+    event.name = name;
+    event.category = category;
+    event.start = start;
+    event.end = now;
+    event.detail[0] = '\0';
+
+    //Server data, keep it to characters that can't break the JSON
+    if (detail) {
+        int i = 0;
+        for (; detail[i] && i < DETAIL_LENGTH - 1; i++) {
+            char c = detail[i];
+            bool plain = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+            event.detail[i] = plain ? c : '?';
+        }
+        event.detail[i] = '\0';
+    }
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&buffer->count, index + 1);
+    return now;
+}
+
+static double to_us(Uint64 counter, double frequency) {
+    return static_cast<double>(static_cast<long long>(counter - startTime)) * 1000000.0 / frequency;
+}
+
+bool trace_stop(const std::string& path) {
+    if (!enabled.exchange(false)) {
+        return false;
+    }
+
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    double frequency = static_cast<double>(SDL_GetPerformanceFrequency());
+    long long written = 0;
+    int dropped = 0;
+    bool first = true;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (TraceBuffer* buffer = static_cast<TraceBuffer*>(SDL_AtomicGetPtr(&buffers)); buffer; buffer = buffer->next) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", buffer->id, buffer->name);
+        first = false;
+
+        int count = SDL_AtomicGet(&buffer->count);
+        SDL_MemoryBarrierAcquire();
+
+        for (int i = 0; i < count; i++) {
+            const TraceEvent& event = buffer->chunks[i / CHUNK_EVENTS][i % CHUNK_EVENTS];
+            double start = to_us(event.start, frequency);
+            double duration = to_us(event.end, frequency) - start;
+
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                event.name, event.category, start, duration, buffer->id);
+            if (event.detail[0]) {
+                fprintf(out, ",\"args\":{\"detail\":\"%s\"}", event.detail);
+            }
+            fputc('}', out);
+        }
+
+        written += count;
+        dropped += buffer->dropped;
+    }
+
+    fprintf(out, "\n]}\n");
+    bool ok = !ferror(out);
+    fclose(out);
+
+    printf("Trace written to %s: %lld events", path.c_str(), written);
+    if (dropped > 0) {
+        printf(", %d dropped after the buffers filled", dropped);
+    }
+    printf("\n");
+    return ok;
+}
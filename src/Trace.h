@@ -0,0 +1,55 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+
+#include "SDL.h"
+
+//Timeline of what each thread was doing, written at exit as Chrome trace-event JSON
+//(chrome://tracing, Perfetto). Off unless trace_start is called; while off every call
+//below is a flag check.
+//
+//Events go into chunks owned by the recording thread, so recording never takes a lock.
+//Names and categories must be string literals, detail (a command name, say) is copied.
+
+//Turns recording on, call before the other threads start
+void trace_start();
+//Turns recording off and writes everything recorded to path. False if it couldn't be written.
+bool trace_stop(const std::string& path);
+
+bool trace_enabled();
+
+//Name shown for the calling thread's row, call before the thread records anything
+void trace_thread_name(const char* name);
+
+//Performance counter reading to start a span from, 0 while tracing is off
+Uint64 trace_now();
+
+//Records a span from start to now and returns now, so back to back phases chain:
+//  Uint64 t = trace_now(); ...; t = trace_span("sites", "render", t); ...
+Uint64 trace_span(const char* name, const char* category, Uint64 start, const char* detail = nullptr);
+
+//Span covering the rest of the enclosing scope
+class TraceScope {
+
+private:
+    const char* name;
+    const char* category;
+    const char* detail;
+    Uint64 start;
+
+public:
+    TraceScope(const char* name, const char* category, const char* detail = nullptr) :
+        name(name), category(category), detail(detail), start(trace_now()) {}
+    ~TraceScope() {
+        if (start) {
+            trace_span(name, category, start, detail);
+        }
+    }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name, category) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+
+#endif
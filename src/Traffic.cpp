@@ -0,0 +1,159 @@
+#include "Traffic.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static const Uint32 NO_SECOND = 0xFFFFFFFF;
+
+static const Uint64 FNV_OFFSET = 14695981039346656037ULL;
+static const Uint64 FNV_PRIME = 1099511628211ULL;
+
+static Uint64 fnv1a(Uint64 hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<Uint8>(data[i]);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+CommandTraffic::CommandTraffic(TrafficDirection direction, const std::string& command) :
+    redundantBytes(0), lastHash(0), peakBytesPerSecond(0) {
+    if (direction == TRAFFIC_IN) {
+        size.publish("message_bytes_in", "Size of server messages by command", "command=\"" + command + "\"");
+    }
+    else {
+        size.publish("message_bytes_out", "Size of messages sent by command", "command=\"" + command + "\"");
+    }
+    for (int i = 0; i < TRAFFIC_WINDOW_S; i++) {
+        slotSecond[i] = NO_SECOND;
+        slotMessages[i] = 0;
+        slotBytes[i] = 0;
+    }
+}
+
+TrafficStats::TrafficStats() : lock(SDL_CreateMutex()), startMs(SDL_GetTicks()) {
+}
+
+TrafficStats::~TrafficStats() {
+    for (int d = 0; d < TRAFFIC_DIRECTIONS; d++) {
+        for (std::map<std::string, CommandTraffic*>::iterator it = commands[d].begin(); it != commands[d].end(); ++it) {
+            delete it->second;
+        }
+    }
+    SDL_DestroyMutex(lock);
+}
+
+Uint32 TrafficStats::currentSecond() const {
+    return (SDL_GetTicks() - startMs) / 1000;
+}
+
+void TrafficStats::recordInbound(const std::string& command, Uint64 bytes, const std::vector<std::string>& args) {
+    Uint64 hash = FNV_OFFSET;
+    for (size_t i = 0; i < args.size(); i++) {
+        hash = fnv1a(hash, args[i].data(), args[i].size());
+        hash = fnv1a(hash, ",", 1);
+    }
+    record(TRAFFIC_IN, command, bytes, hash);
+}
+
+void TrafficStats::recordOutbound(const std::string& command, const std::string& wire) {
+    record(TRAFFIC_OUT, command, wire.size(), fnv1a(FNV_OFFSET, wire.data(), wire.size()));
+}
+
+void TrafficStats::record(TrafficDirection direction, const std::string& command, Uint64 bytes, Uint64 hash) {
+    Uint32 second = currentSecond();
+    int slot = second % TRAFFIC_WINDOW_S;
+
+    SDL_LockMutex(lock);
+
+    CommandTraffic*& entry = commands[direction][command];
+    if (!entry) {
+        entry = new CommandTraffic(direction, command);
+    }
+    CommandTraffic& c = *entry;
+
+    //Nothing to compare the first message with, so it is never redundant
+    if (c.size.count() > 0 && hash == c.lastHash) {
+        c.redundantBytes += bytes;
+    }
+    c.lastHash = hash;
+    c.size.record(bytes);
+
+    if (c.slotSecond[slot] != second) {
+        c.slotSecond[slot] = second;
+        c.slotMessages[slot] = 0;
+        c.slotBytes[slot] = 0;
+    }
+    c.slotMessages[slot]++;
+    c.slotBytes[slot] += bytes;
+    c.peakBytesPerSecond = std::max(c.peakBytesPerSecond, c.slotBytes[slot]);
+
+    SDL_UnlockMutex(lock);
+}
+
+//Totals over the complete seconds in the window, the one in progress would drag the rate down
+static void window_totals(const CommandTraffic& c, Uint32 second, Uint64& messages, Uint64& bytes) {
+    for (int i = 0; i < TRAFFIC_WINDOW_S; i++) {
+        if (c.slotSecond[i] != NO_SECOND && c.slotSecond[i] < second && second - c.slotSecond[i] <= static_cast<Uint32>(TRAFFIC_WINDOW_S)) {
+            messages += c.slotMessages[i];
+            bytes += c.slotBytes[i];
+        }
+    }
+}
+
+static bool by_bytes(const std::pair<std::string, const CommandTraffic*>& a, const std::pair<std::string, const CommandTraffic*>& b) {
+    return a.second->size.sum() > b.second->size.sum();
+}
+
+void TrafficStats::printStats() {
+    static const char* const DIRECTION_NAMES[TRAFFIC_DIRECTIONS] = { "INBOUND", "OUTBOUND" };
+
+    Uint32 second = currentSecond();
+    //Rates are per second of the window, or of the session while it is shorter than the window
+    Uint32 windowS = std::min(second, static_cast<Uint32>(TRAFFIC_WINDOW_S));
+
+    SDL_LockMutex(lock);
+
+    for (int d = 0; d < TRAFFIC_DIRECTIONS; d++) {
+        std::vector<std::pair<std::string, const CommandTraffic*> > sorted(commands[d].begin(), commands[d].end());
+        std::sort(sorted.begin(), sorted.end(), by_bytes);
+
+        Uint64 totalMessages = 0, totalBytes = 0, totalRedundant = 0;
+        Uint64 windowMessages = 0, windowBytes = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            totalMessages += sorted[i].second->size.count();
+            totalBytes += sorted[i].second->size.sum();
+            totalRedundant += sorted[i].second->redundantBytes;
+            window_totals(*sorted[i].second, second, windowMessages, windowBytes);
+        }
+
+        printf("=== %s TRAFFIC (%u s) ===\n", DIRECTION_NAMES[d], static_cast<unsigned>(second));
+        printf("  %-18s %9s %11s %6s %8s %9s %10s %10s %10s\n", "command", "messages", "bytes", "share", "avg B",
+            "msg/s", "B/s", "peak B/s", "redundant");
+
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const CommandTraffic& c = *sorted[i].second;
+            Uint64 cMessages = c.size.count(), cBytes = c.size.sum();
+            Uint64 messages = 0, bytes = 0;
+            window_totals(c, second, messages, bytes);
+
+            printf("  %-18s %9llu %11llu %5.1f%% %8.1f %9.1f %10.1f %10llu %9.1f%%\n", sorted[i].first.c_str(),
+                static_cast<unsigned long long>(cMessages), static_cast<unsigned long long>(cBytes),
+                totalBytes > 0 ? 100.0 * cBytes / totalBytes : 0.0,
+                static_cast<double>(cBytes) / cMessages,
+                windowS > 0 ? static_cast<double>(messages) / windowS : 0.0,
+                windowS > 0 ? static_cast<double>(bytes) / windowS : 0.0,
+                static_cast<unsigned long long>(c.peakBytesPerSecond),
+                cBytes > 0 ? 100.0 * c.redundantBytes / cBytes : 0.0);
+        }
+
+        printf("  %-18s %9llu %11llu %6s %8s %9.1f %10.1f %10s %9.1f%%\n", "total",
+            static_cast<unsigned long long>(totalMessages), static_cast<unsigned long long>(totalBytes), "", "",
+            windowS > 0 ? static_cast<double>(windowMessages) / windowS : 0.0,
+            windowS > 0 ? static_cast<double>(windowBytes) / windowS : 0.0, "",
+            totalBytes > 0 ? 100.0 * totalRedundant / totalBytes : 0.0);
+    }
+    printf("===========================\n");
+
+    SDL_UnlockMutex(lock);
+}
@@ -0,0 +1,65 @@
+#ifndef __TRAFFIC_H__
+#define __TRAFFIC_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SDL.h"
+#include "Metrics.h"
+
+enum TrafficDirection {
+    TRAFFIC_IN,
+    TRAFFIC_OUT,
+    TRAFFIC_DIRECTIONS
+};
+
+//Seconds of history behind the rolling rates
+const int TRAFFIC_WINDOW_S = 10;
+
+struct CommandTraffic {
+    //Published as message_bytes_in or message_bytes_out{command="..."}, its count and sum are the totals
+    Histogram size;
+    Uint64 redundantBytes;      //same payload as the previous message of this command
+    Uint64 lastHash;
+    Uint64 peakBytesPerSecond;
+
+    //Ring of per-second totals, slot i holds second slotSecond[i] since the stats were created
+    Uint32 slotSecond[TRAFFIC_WINDOW_S];
+    Uint64 slotMessages[TRAFFIC_WINDOW_S];
+    Uint64 slotBytes[TRAFFIC_WINDOW_S];
+
+    CommandTraffic(TrafficDirection direction, const std::string& command);
+};
+
+//Bytes and message counts per command in each direction, for working out which messages
+//dominate the bandwidth and which ones are sent again unchanged. This is the only per-command
+//ledger: the size histograms it exports are the ones the dashboards read. The receive thread
+//records inbound, the send thread outbound, and any thread can print the summary.
+class TrafficStats {
+
+private:
+    SDL_mutex* lock;
+    //Made the first time a command is seen and kept, the set of commands is small and fixed
+    std::map<std::string, CommandTraffic*> commands[TRAFFIC_DIRECTIONS];
+    Uint32 startMs;
+
+    TrafficStats(const TrafficStats&);
+    TrafficStats& operator=(const TrafficStats&);
+
+    void record(TrafficDirection direction, const std::string& command, Uint64 bytes, Uint64 hash);
+    Uint32 currentSecond() const;
+
+public:
+    TrafficStats();
+    ~TrafficStats();
+
+    //Inbound messages arrive already split, bytes is their size on the wire and args tell repeats apart
+    void recordInbound(const std::string& command, Uint64 bytes, const std::vector<std::string>& args);
+    void recordOutbound(const std::string& command, const std::string& wire);
+
+    //Per command totals, share of the direction's bytes, rolling and peak rates, largest first
+    void printStats();
+};
+
+#endif